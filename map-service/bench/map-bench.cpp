@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Load generator for map-service.
+ * Connects one stub renderer, which answers new_request with provide_surface,
+ * and many simulated applications which subscribe and call request_map in a
+ * loop. Every second it prints requests/sec, map_created latency percentiles
+ * and the resident memory of the daemon.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <json-c/json.h>
+#include <systemd/sd-event.h>
+extern "C"
+{
+#include <afb/afb-wsj1.h>
+#include <afb/afb-ws-client.h>
+}
+
+static const char _api_pub[] = "map-service";
+static const char _api_prv[] = "map-private";
+static const char _ev_new_request[] = "map-private/new_request";
+static const char _ev_map_created[] = "map-service/map_created";
+
+typedef struct Options {
+    int port;
+    std::string token;
+    unsigned apps;
+    unsigned rounds;
+    unsigned duration;
+    int daemon_pid;
+} Options;
+
+typedef struct App {
+    unsigned index;
+    std::string appid;
+    struct afb_wsj1* ws;
+    uint64_t t_request;
+    unsigned rounds;
+    bool reply_pending;
+} App;
+
+static Options opt = {1700, "bench", 1000, 10, 60, 0};
+static sd_event* loop;
+static struct afb_wsj1* renderer;
+static std::vector<std::unique_ptr<App>> apps;
+static unsigned apps_done;
+static uint64_t t_begin;
+
+// Counters of the current report window and of the whole run
+static unsigned long sent_window, sent_total;
+static unsigned long failed_total;
+static unsigned long created_total;
+static unsigned long provided_total;
+static std::vector<uint64_t> created_window, created_all;
+static std::vector<uint64_t> reply_all;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static long daemon_rss_kb()
+{
+    if(opt.daemon_pid <= 0)
+        return -1;
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", opt.daemon_pid);
+    FILE* f = fopen(path, "r");
+    if(f == NULL)
+        return -1;
+    long kb = -1;
+    while(fgets(line, sizeof(line), f) != NULL) {
+        if(sscanf(line, "VmRSS: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(f);
+    return kb;
+}
+
+static double percentile_us(std::vector<uint64_t>& v, double q)
+{
+    if(v.empty())
+        return 0.0;
+    size_t rank = std::min(v.size() - 1, (size_t)(q * v.size()));
+    std::nth_element(v.begin(), v.begin() + rank, v.end());
+    return v[rank] / 1000.0;
+}
+
+static void print_latency(const char* name, std::vector<uint64_t>& v)
+{
+    double max = v.empty() ? 0.0 : *std::max_element(v.begin(), v.end()) / 1000.0;
+    printf("%s n=%zu p50=%.0fus p90=%.0fus p99=%.0fus max=%.0fus",
+           name, v.size(), percentile_us(v, 0.50), percentile_us(v, 0.90),
+           percentile_us(v, 0.99), max);
+}
+
+/************* Stub renderer *************/
+
+static void on_renderer_reply(void *closure, struct afb_wsj1_msg *msg)
+{
+    if(!afb_wsj1_msg_is_reply_ok(msg))
+        fprintf(stderr, "renderer call failed: %s\n", afb_wsj1_msg_object_s(msg));
+}
+
+static void on_renderer_event(void *closure, const char *event, struct afb_wsj1_msg *msg)
+{
+    if(strcmp(event, _ev_new_request) != 0)
+        return;
+    uint64_t recv = now_ns();
+    json_object *object = afb_wsj1_msg_object_j(msg);
+    json_object *j_val, *j_trace;
+
+    // assign and release need no answer
+    if(json_object_object_get_ex(object, "op", &j_val) &&
+       strcmp(json_object_get_string(j_val), "prepare") != 0)
+        return;
+
+    json_object* j = json_object_new_object();
+    if(json_object_object_get_ex(object, "uuid", &j_val))
+        json_object_object_add(j, "uuid", json_object_get(j_val));
+    if(json_object_object_get_ex(object, "appid", &j_val))
+        json_object_object_add(j, "appid", json_object_get(j_val));
+    if(json_object_object_get_ex(object, "trace", &j_trace)) {
+        json_object* trace = json_object_new_object();
+        const char* keys[] = {"id", "start", "last"};
+        for(const char* key : keys) {
+            if(json_object_object_get_ex(j_trace, key, &j_val))
+                json_object_object_add(trace, key, json_object_get(j_val));
+        }
+        json_object_object_add(trace, "recv", json_object_new_int64(recv));
+        json_object_object_add(trace, "sent", json_object_new_int64(now_ns()));
+        json_object_object_add(j, "trace", trace);
+    }
+    ++provided_total;
+    afb_wsj1_call_j(renderer, _api_prv, "provide_surface", j, on_renderer_reply, NULL);
+}
+
+static void on_hangup(void *closure, struct afb_wsj1 *wsj)
+{
+    fprintf(stderr, "connection closed by the daemon\n");
+    sd_event_exit(loop, 1);
+}
+
+static struct afb_wsj1_itf renderer_itf = { on_hangup, NULL, on_renderer_event };
+
+/************* Simulated applications *************/
+
+static void finish();
+static void on_request_reply(void *closure, struct afb_wsj1_msg *msg);
+
+static void send_request(App* app)
+{
+    json_object* j = json_object_new_object();
+    json_object_object_add(j, "appid", json_object_new_string(app->appid.c_str()));
+    json_object_object_add(j, "view", json_object_new_string("main"));
+    app->t_request = now_ns();
+    app->reply_pending = true;
+    ++sent_window;
+    ++sent_total;
+    afb_wsj1_call_j(app->ws, _api_pub, "request_map", j, on_request_reply, app);
+}
+
+static void next_round(App* app)
+{
+    if(++app->rounds < opt.rounds) {
+        send_request(app);
+    }
+    else if(++apps_done == apps.size()) {
+        finish();
+    }
+}
+
+static void on_request_reply(void *closure, struct afb_wsj1_msg *msg)
+{
+    App* app = static_cast<App*>(closure);
+    if(!app->reply_pending)
+        return;
+    app->reply_pending = false;
+    if(afb_wsj1_msg_is_reply_ok(msg)) {
+        reply_all.push_back(now_ns() - app->t_request);
+    }
+    else {
+        // No map_created will follow a failed request
+        ++failed_total;
+        next_round(app);
+    }
+}
+
+static void on_app_event(void *closure, const char *event, struct afb_wsj1_msg *msg)
+{
+    App* app = static_cast<App*>(closure);
+    if(strcmp(event, _ev_map_created) != 0)
+        return;
+    uint64_t lat = now_ns() - app->t_request;
+    created_window.push_back(lat);
+    created_all.push_back(lat);
+    ++created_total;
+    // map_created may overtake the reply of request_map
+    app->reply_pending = false;
+    next_round(app);
+}
+
+static void on_subscribe_reply(void *closure, struct afb_wsj1_msg *msg)
+{
+    App* app = static_cast<App*>(closure);
+    if(!afb_wsj1_msg_is_reply_ok(msg)) {
+        fprintf(stderr, "%s: subscribe failed: %s\n", app->appid.c_str(), afb_wsj1_msg_object_s(msg));
+        ++failed_total;
+        if(++apps_done == apps.size())
+            finish();
+        return;
+    }
+    send_request(app);
+}
+
+static struct afb_wsj1_itf app_itf = { on_hangup, NULL, on_app_event };
+
+/************* Report *************/
+
+static void on_stats_reply(void *closure, struct afb_wsj1_msg *msg)
+{
+    printf("map-service stats: %s\n", afb_wsj1_msg_object_s(msg));
+    sd_event_exit(loop, 0);
+}
+
+static void finish()
+{
+    static bool finished = false;
+    if(finished)
+        return;
+    finished = true;
+
+    double secs = (now_ns() - t_begin) / 1e9;
+    printf("---- summary ----\n");
+    printf("apps=%zu rounds=%u time=%.2fs sent=%lu created=%lu failed=%lu provided=%lu rate=%.1f req/s\n",
+           apps.size(), opt.rounds, secs, sent_total, created_total, failed_total, provided_total,
+           sent_total / secs);
+    print_latency("map_created", created_all);
+    printf("\n");
+    print_latency("reply", reply_all);
+    printf("\nrss=%ldkB\n", daemon_rss_kb());
+    fflush(stdout);
+
+    afb_wsj1_call_s(apps.front()->ws, _api_pub, "stats", "{}", on_stats_reply, NULL);
+}
+
+static int on_report_timer(sd_event_source *s, uint64_t usec, void *userdata)
+{
+    double secs = (now_ns() - t_begin) / 1e9;
+    printf("[%6.1fs] %lu req/s ", secs, sent_window);
+    print_latency("map_created", created_window);
+    printf(" rss=%ldkB\n", daemon_rss_kb());
+    fflush(stdout);
+    sent_window = 0;
+    created_window.clear();
+
+    if(opt.duration > 0 && secs >= opt.duration) {
+        printf("duration elapsed, %u of %zu apps finished\n", apps_done, apps.size());
+        finish();
+        return 0;
+    }
+    sd_event_source_set_time(s, usec + 1000000);
+    sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+    return 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -p, --port N        afb-daemon port (1700)\n"
+        "  -t, --token S       afb-daemon token (bench)\n"
+        "  -a, --apps N        simulated applications (1000)\n"
+        "  -r, --rounds N      request_map calls per application (10)\n"
+        "  -d, --duration S    stop after S seconds, 0 for no limit (60)\n"
+        "  -P, --daemon-pid N  report resident memory of this process\n",
+        name);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"port", required_argument, NULL, 'p'},
+        {"token", required_argument, NULL, 't'},
+        {"apps", required_argument, NULL, 'a'},
+        {"rounds", required_argument, NULL, 'r'},
+        {"duration", required_argument, NULL, 'd'},
+        {"daemon-pid", required_argument, NULL, 'P'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+    while((c = getopt_long(argc, argv, "p:t:a:r:d:P:", options, NULL)) != -1) {
+        switch(c) {
+        case 'p': opt.port = atoi(optarg); break;
+        case 't': opt.token = optarg; break;
+        case 'a': opt.apps = strtoul(optarg, NULL, 10); break;
+        case 'r': opt.rounds = strtoul(optarg, NULL, 10); break;
+        case 'd': opt.duration = strtoul(optarg, NULL, 10); break;
+        case 'P': opt.daemon_pid = atoi(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if(opt.apps == 0 || opt.rounds == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sd_event_default(&loop);
+    std::string uri = "ws://localhost:" + std::to_string(opt.port) + "/api?token=" + opt.token;
+
+    renderer = afb_ws_client_connect_wsj1(loop, uri.c_str(), &renderer_itf, NULL);
+    if(renderer == NULL) {
+        fprintf(stderr, "can't connect to %s\n", uri.c_str());
+        return 1;
+    }
+    afb_wsj1_call_s(renderer, _api_prv, "start_service", "{}", on_renderer_reply, NULL);
+
+    t_begin = now_ns();
+    for(unsigned i = 0; i < opt.apps; ++i) {
+        std::unique_ptr<App> app(new App{i, "bench-app-" + std::to_string(i), NULL, 0, 0, false});
+        app->ws = afb_ws_client_connect_wsj1(loop, uri.c_str(), &app_itf, app.get());
+        if(app->ws == NULL) {
+            fprintf(stderr, "connection %u failed, running with %u apps\n", i, i);
+            break;
+        }
+        json_object* j = json_object_new_object();
+        json_object_object_add(j, "appid", json_object_new_string(app->appid.c_str()));
+        afb_wsj1_call_j(app->ws, _api_pub, "subscribe", j, on_subscribe_reply, app.get());
+        apps.push_back(std::move(app));
+    }
+    if(apps.empty())
+        return 1;
+
+    uint64_t now;
+    sd_event_now(loop, CLOCK_MONOTONIC, &now);
+    sd_event_add_time(loop, NULL, CLOCK_MONOTONIC, now + 1000000, 0, on_report_timer, NULL);
+
+    int ret = sd_event_loop(loop);
+    for(auto& app : apps)
+        afb_wsj1_unref(app->ws);
+    afb_wsj1_unref(renderer);
+    sd_event_unref(loop);
+    return ret;
+}
@@ -0,0 +1,60 @@
+#!/bin/bash
+#
+# Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Run map-bench against a local afb-daemon which loads map-service,
+# map-private and the stub window manager.
+#
+#   run-bench.sh [map-bench options]
+#
+# Environment:
+#   PORT                  daemon port (1799)
+#   UNIX_DIR              directory of the api sockets (/tmp/map-bench)
+#   STUB_WM_LATENCY_US    window manager reply latency (2000)
+#   STUB_WM_JITTER_US     extra random latency (0)
+#   MAP_SERVICE_*         settings of the bindings under test
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+BINDING_DIR=${BINDING_DIR:-$BENCH_DIR/../binding}
+PORT=${PORT:-1799}
+TOKEN=bench
+UNIX_DIR=${UNIX_DIR:-/tmp/map-bench}
+mkdir -p "$UNIX_DIR"
+
+# Simulated apps loop on request_map, measure them without the per-app limit
+export MAP_SERVICE_APP_RATE=${MAP_SERVICE_APP_RATE:-0}
+export STUB_WM_LATENCY_US=${STUB_WM_LATENCY_US:-2000}
+# The stub window manager attaches pooled surfaces, the real one can't
+export MAP_SERVICE_POOL_SIZE=${MAP_SERVICE_POOL_SIZE:-2}
+
+afb-daemon --port=$PORT --token=$TOKEN --workdir=/tmp \
+    --ws-server=unix:$UNIX_DIR/windowmanager \
+    --ws-server=unix:$UNIX_DIR/map-private \
+    --binding=$BENCH_DIR/libmap-service-bench-binding.so \
+    --binding=$BINDING_DIR/libmap-local-binding.so \
+    --binding=$BENCH_DIR/libstub-wm-binding.so &
+DAEMON=$!
+trap 'kill $DAEMON 2>/dev/null' EXIT INT TERM
+
+# Wait for the daemon to listen
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    sleep 0.5
+    if (echo > /dev/tcp/127.0.0.1/$PORT) 2>/dev/null || nc -z 127.0.0.1 $PORT 2>/dev/null; then
+        break
+    fi
+done
+
+"$BENCH_DIR/map-bench" --port $PORT --token $TOKEN --daemon-pid $DAEMON "$@"
+"$BENCH_DIR/transport-bench" --port $PORT --token $TOKEN --unix unix:$UNIX_DIR
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Stand-in for the window manager binding, used by map-bench.
+ * attachSurfaceToApp answers after a configurable delay:
+ *   STUB_WM_LATENCY_US  base latency of a reply (default 2000)
+ *   STUB_WM_JITTER_US   uniform random extra latency (default 0)
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <json-c/json.h>
+#include <systemd/sd-event.h>
+
+#define AFB_BINDING_VERSION 3
+#include <afb/afb-binding>
+
+static const char _key_srfc[] = "surface";
+static const char _key_uuid[] = "uuid";
+static const int _first_surface_id = 10000;
+
+static sd_event* _loop;
+static uint64_t _latency_us = 2000;
+static uint64_t _jitter_us = 0;
+static std::atomic<unsigned> _next_uuid(0);
+static std::atomic<int> _next_surface(_first_surface_id);
+
+typedef struct PendingAttach {
+    afb_req_t req;
+    int surface;
+    sd_event_source* timer;
+} PendingAttach;
+
+static uint64_t env_us(const char* name, uint64_t def) {
+    const char* val = getenv(name);
+    return (val != nullptr && *val != '\0') ? strtoull(val, nullptr, 10) : def;
+}
+
+static int on_attach_timer(sd_event_source *s, uint64_t usec, void *userdata) {
+    PendingAttach* p = static_cast<PendingAttach*>(userdata);
+    afb::req req(p->req);
+    std::string uuid = "stub-" + std::to_string(++_next_uuid);
+
+    json_object* j_reply = json_object_new_object();
+    json_object_object_add(j_reply, _key_srfc, json_object_new_int(p->surface));
+    json_object_object_add(j_reply, _key_uuid, json_object_new_string(uuid.c_str()));
+    req.success(j_reply);
+    req.unref();
+    sd_event_source_unref(p->timer);
+    delete p;
+    return 0;
+}
+
+static void attachSurfaceToApp(afb_req_t r) {
+    afb::req req(r);
+    json_object* j_srfc;
+
+    // A pooled surface keeps its id, otherwise allocate one like the window manager
+    PendingAttach* p = new PendingAttach{r, -1, nullptr};
+    if(json_object_object_get_ex(req.json(), _key_srfc, &j_srfc)) {
+        p->surface = json_object_get_int(j_srfc);
+    }
+    else {
+        p->surface = _next_surface++;
+    }
+
+    uint64_t now, delay = _latency_us;
+    if(_jitter_us > 0) {
+        delay += (uint64_t)rand() % _jitter_us;
+    }
+    req.addref();
+    sd_event_now(_loop, CLOCK_MONOTONIC, &now);
+    if(sd_event_add_time(_loop, &p->timer, CLOCK_MONOTONIC, now + delay, 0, on_attach_timer, p) < 0) {
+        req.fail("failed to arm timer");
+        req.unref();
+        delete p;
+    }
+}
+
+static void wm_subscribe(afb_req_t r) {
+    afb::req(r).success();
+}
+
+static void endDraw(afb_req_t r) {
+    afb::req(r).success();
+}
+
+int init(afb_api_t api) {
+    _loop = afb_api_get_event_loop(api);
+    _latency_us = env_us("STUB_WM_LATENCY_US", _latency_us);
+    _jitter_us = env_us("STUB_WM_JITTER_US", _jitter_us);
+    AFB_NOTICE("stub window manager, latency %llu us, jitter %llu us",
+               (unsigned long long)_latency_us, (unsigned long long)_jitter_us);
+    return 0;
+}
+
+const afb_verb_t verbs[] = {
+    afb::verb("attachSurfaceToApp", attachSurfaceToApp, "attach surface after a delay", AFB_SESSION_LOA_0),
+    afb::verb("wm_subscribe", wm_subscribe, "accept any subscription", AFB_SESSION_LOA_0),
+    afb::verb("endDraw", endDraw, "accept endDraw", AFB_SESSION_LOA_0),
+    afb::verbend()
+};
+
+const afb_binding_t afbBindingExport =
+    afb::binding("windowmanager", verbs, "window manager stub for benchmarks", init);
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Round-trip latency of one verb over the UI binding transports.
+ * Calls the verb back to back, one at a time, over loopback TCP and over the
+ * unix socket of the api when a directory is given, and prints percentiles of
+ * each. TCP speaks wsj1, the daemon's unix sockets speak afb-proto-ws with one
+ * socket per api (--ws-server=unix:<dir>/<api>).
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <json-c/json.h>
+#include <systemd/sd-event.h>
+extern "C"
+{
+#include <afb/afb-wsj1.h>
+#include <afb/afb-proto-ws.h>
+#include <afb/afb-ws-client.h>
+}
+
+typedef struct Options {
+    int port;
+    std::string token;
+    std::string endpoint;
+    std::string api;
+    std::string verb;
+    unsigned count;
+    unsigned warmup;
+} Options;
+
+static Options opt = {1700, "bench", "", "windowmanager", "endDraw", 10000, 100};
+static sd_event* loop;
+static bool replied;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double percentile_us(std::vector<uint64_t>& v, double q)
+{
+    if(v.empty())
+        return 0.0;
+    size_t rank = std::min(v.size() - 1, (size_t)(q * v.size()));
+    std::nth_element(v.begin(), v.begin() + rank, v.end());
+    return v[rank] / 1000.0;
+}
+
+static void on_hangup(void *closure, struct afb_wsj1 *wsj)
+{
+    fprintf(stderr, "connection closed by the daemon\n");
+    sd_event_exit(loop, 1);
+}
+
+static struct afb_wsj1_itf itf = { on_hangup, NULL, NULL };
+
+static void on_reply(void *closure, struct afb_wsj1_msg *msg)
+{
+    replied = true;
+}
+
+static void on_api_hangup(void *closure)
+{
+    fprintf(stderr, "api socket closed by the daemon\n");
+    sd_event_exit(loop, 1);
+}
+
+static void on_api_reply(void *closure, void *request, struct json_object *obj,
+                         const char *error, const char *info)
+{
+    replied = true;
+}
+
+static struct afb_proto_ws_client_itf api_itf = {
+    on_api_reply, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+/* One transport: a connection and a call on it, both opaque to measure() */
+typedef struct Transport {
+    const char* name;
+    void* (*connect)(const std::string& uri);
+    int (*call)(void* conn, json_object* j);
+    void (*close)(void* conn);
+} Transport;
+
+static void* tcp_connect(const std::string& uri)
+{
+    return afb_ws_client_connect_wsj1(loop, uri.c_str(), &itf, NULL);
+}
+
+static int tcp_call(void* conn, json_object* j)
+{
+    /* takes j */
+    return afb_wsj1_call_j((struct afb_wsj1*)conn, opt.api.c_str(), opt.verb.c_str(), j, on_reply, NULL);
+}
+
+static void tcp_close(void* conn)
+{
+    afb_wsj1_unref((struct afb_wsj1*)conn);
+}
+
+static void* unix_connect(const std::string& uri)
+{
+    struct afb_proto_ws* ws = afb_ws_client_connect_api(loop, uri.c_str(), &api_itf, NULL);
+    if(ws != NULL)
+        afb_proto_ws_on_hangup(ws, on_api_hangup);
+    return ws;
+}
+
+static int unix_call(void* conn, json_object* j)
+{
+    /* the api is the socket, only the verb is sent; j stays ours */
+    int rc = afb_proto_ws_client_call((struct afb_proto_ws*)conn, opt.verb.c_str(), j,
+                                      opt.token.c_str(), NULL, NULL);
+    json_object_put(j);
+    return rc;
+}
+
+static void unix_close(void* conn)
+{
+    afb_proto_ws_unref((struct afb_proto_ws*)conn);
+}
+
+static const Transport tcp = { "tcp", tcp_connect, tcp_call, tcp_close };
+static const Transport unix_socket = { "unix", unix_connect, unix_call, unix_close };
+
+static int round_trip(const Transport& t, void* conn)
+{
+    json_object* j = json_object_new_object();
+    json_object_object_add(j, "drawing_name", json_object_new_string("bench"));
+    replied = false;
+    if(t.call(conn, j) < 0)
+        return -1;
+    while(!replied) {
+        if(sd_event_run(loop, 1000000) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int measure(const Transport& t, const std::string& uri)
+{
+    void* conn = t.connect(uri);
+    if(conn == NULL) {
+        fprintf(stderr, "%s: cannot connect to %s\n", t.name, uri.c_str());
+        return -1;
+    }
+    for(unsigned i = 0; i < opt.warmup; i++) {
+        if(round_trip(t, conn) < 0)
+            break;
+    }
+
+    std::vector<uint64_t> rtt;
+    rtt.reserve(opt.count);
+    for(unsigned i = 0; i < opt.count; i++) {
+        uint64_t t0 = now_ns();
+        if(round_trip(t, conn) < 0) {
+            fprintf(stderr, "%s: call failed after %u round trips\n", t.name, i);
+            break;
+        }
+        rtt.push_back(now_ns() - t0);
+    }
+    t.close(conn);
+
+    double max = rtt.empty() ? 0.0 : *std::max_element(rtt.begin(), rtt.end()) / 1000.0;
+    printf("%-5s n=%zu p50=%.1fus p90=%.1fus p99=%.1fus max=%.1fus\n",
+           t.name, rtt.size(), percentile_us(rtt, 0.50), percentile_us(rtt, 0.90),
+           percentile_us(rtt, 0.99), max);
+    return rtt.size() == opt.count ? 0 : -1;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -p, --port N        daemon TCP port (1700)\n"
+        "  -t, --token T       websocket token (bench)\n"
+        "  -u, --unix DIR      unix:<dir> holding the daemon's api sockets\n"
+        "  -a, --api API       api to call (windowmanager)\n"
+        "  -v, --verb VERB     verb to call (endDraw)\n"
+        "  -n, --count N       measured round trips per transport (10000)\n",
+        name);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"port", required_argument, NULL, 'p'},
+        {"token", required_argument, NULL, 't'},
+        {"unix", required_argument, NULL, 'u'},
+        {"api", required_argument, NULL, 'a'},
+        {"verb", required_argument, NULL, 'v'},
+        {"count", required_argument, NULL, 'n'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+    while((c = getopt_long(argc, argv, "p:t:u:a:v:n:", options, NULL)) != -1) {
+        switch(c) {
+        case 'p': opt.port = atoi(optarg); break;
+        case 't': opt.token = optarg; break;
+        case 'u': opt.endpoint = optarg; break;
+        case 'a': opt.api = optarg; break;
+        case 'v': opt.verb = optarg; break;
+        case 'n': opt.count = strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+
+    if(sd_event_new(&loop) < 0) {
+        fprintf(stderr, "cannot create event loop\n");
+        return 1;
+    }
+    printf("%s/%s round trips\n", opt.api.c_str(), opt.verb.c_str());
+    int ret = measure(tcp, "ws://localhost:" + std::to_string(opt.port) + "/api?token=" + opt.token);
+    if(!opt.endpoint.empty())
+        ret |= measure(unix_socket, opt.endpoint + "/" + opt.api);
+    sd_event_unref(loop);
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "admission-control.h"
+
+// Buckets of idle applications are dropped once in this many admits
+static const unsigned _prune_interval = 64;
+
+AdmissionControl::AdmissionControl()
+    : limit(0), rate(0), burst(0), in_use(0),
+      n_admitted(0), n_queue_full(0), n_rate_limited(0), since_prune(0)
+{
+}
+
+void AdmissionControl::configure(unsigned max_pending, double rate, double burst) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->limit = max_pending;
+    this->rate = rate;
+    this->burst = (burst < 1.0) ? 1.0 : burst;
+    this->buckets.clear();
+}
+
+void AdmissionControl::refill(Bucket& bucket, uint64_t now_ns) const {
+    if(now_ns > bucket.last_ns) {
+        bucket.tokens += this->rate * (double)(now_ns - bucket.last_ns) / 1e9;
+        if(bucket.tokens > this->burst) {
+            bucket.tokens = this->burst;
+        }
+    }
+    bucket.last_ns = now_ns;
+}
+
+void AdmissionControl::prune(uint64_t now_ns) {
+    for(auto it = this->buckets.begin(); it != this->buckets.end(); ) {
+        this->refill(it->second, now_ns);
+        if(it->second.tokens >= this->burst) {
+            // A full bucket is the same as a new one
+            it = this->buckets.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+AdmissionControl::verdict AdmissionControl::admit(const std::string& appid, unsigned count, uint64_t now_ns) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if(this->limit != 0 && this->in_use + count > this->limit) {
+        ++this->n_queue_full;
+        return QUEUE_FULL;
+    }
+    if(this->rate > 0) {
+        if(++this->since_prune >= _prune_interval) {
+            this->since_prune = 0;
+            this->prune(now_ns);
+        }
+        auto res = this->buckets.emplace(appid, Bucket{this->burst, now_ns});
+        Bucket& bucket = res.first->second;
+        this->refill(bucket, now_ns);
+        if(bucket.tokens < (double)count) {
+            ++this->n_rate_limited;
+            return RATE_LIMITED;
+        }
+        bucket.tokens -= (double)count;
+    }
+    this->in_use += count;
+    this->n_admitted += count;
+    return ADMIT;
+}
+
+void AdmissionControl::release(unsigned count) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->in_use = (count > this->in_use) ? 0 : this->in_use - count;
+}
+
+unsigned AdmissionControl::pending() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->in_use;
+}
+
+unsigned AdmissionControl::max_pending() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->limit;
+}
+
+uint64_t AdmissionControl::admitted() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->n_admitted;
+}
+
+uint64_t AdmissionControl::shed_queue_full() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->n_queue_full;
+}
+
+uint64_t AdmissionControl::shed_rate_limited() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->n_rate_limited;
+}
+
+size_t AdmissionControl::apps() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->buckets.size();
+}
+
+const char* AdmissionControl::reason(verdict v) {
+    switch(v) {
+    case QUEUE_FULL:
+        return "too many pending requests, try again later";
+    case RATE_LIMITED:
+        return "request rate of the application is over its limit";
+    default:
+        return "";
+    }
+}
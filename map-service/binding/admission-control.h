@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ADMISSION_CONTROL_H
+#define ADMISSION_CONTROL_H
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+
+/*
+ * Decides whether map-private takes a request before any work is done for it.
+ * Admitted requests count as pending until release(), the count is bounded.
+ * Each application also has a token bucket, so one looping caller is shed
+ * without eating into the pending slots of the others.
+ */
+class AdmissionControl {
+  public:
+    enum verdict {
+        ADMIT,
+        QUEUE_FULL,   // too many requests are already pending
+        RATE_LIMITED  // the application has used up its tokens
+    };
+
+    AdmissionControl();
+    ~AdmissionControl() = default;
+    AdmissionControl(const AdmissionControl &) = delete;
+    AdmissionControl &operator=(const AdmissionControl &) = delete;
+
+    // max_pending 0 and rate 0 disable the respective check
+    void configure(unsigned max_pending, double rate, double burst);
+    // Ask for count pending slots and tokens on behalf of appid
+    verdict admit(const std::string& appid, unsigned count, uint64_t now_ns);
+    void release(unsigned count);
+
+    unsigned pending() const;
+    unsigned max_pending() const;
+    uint64_t admitted() const;
+    uint64_t shed_queue_full() const;
+    uint64_t shed_rate_limited() const;
+    size_t apps() const;
+
+    static const char* reason(verdict v);
+  private:
+    struct Bucket {
+        double tokens;
+        uint64_t last_ns;
+    };
+    void refill(Bucket& bucket, uint64_t now_ns) const;
+    void prune(uint64_t now_ns);
+
+    mutable std::mutex mtx;
+    std::unordered_map<std::string, Bucket> buckets;
+    unsigned limit;
+    double rate;   // tokens per second
+    double burst;  // bucket size
+    unsigned in_use;
+    uint64_t n_admitted;
+    uint64_t n_queue_full;
+    uint64_t n_rate_limited;
+    unsigned since_prune;
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "call-limiter.h"
+
+CallLimiter::CallLimiter(unsigned max_inflight)
+    : max_inflight(max_inflight), running(0)
+{
+}
+
+void CallLimiter::set_max_inflight(unsigned max_inflight) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->max_inflight = max_inflight;
+}
+
+void CallLimiter::submit(task t, request_class cls) {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        if(this->max_inflight != 0 && this->running >= this->max_inflight) {
+            this->pending.push(cls, std::move(t));
+            return;
+        }
+        ++this->running;
+    }
+    // Start the call outside of the lock, its reply may arrive immediately
+    t();
+}
+
+void CallLimiter::done() {
+    task next;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        if((this->max_inflight != 0 && this->running > this->max_inflight) ||
+           !this->pending.pop(&next)) {
+            // The cap was lowered while running, or nothing is waiting
+            --this->running;
+            return;
+        }
+        // Hand over the slot of the finished call to the next waiter
+    }
+    next();
+}
+
+unsigned CallLimiter::inflight() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->running;
+}
+
+size_t CallLimiter::queued() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->pending.size();
+}
+
+size_t CallLimiter::queued(request_class cls) const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->pending.size(cls);
+}
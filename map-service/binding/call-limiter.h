@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CALL_LIMITER_H
+#define CALL_LIMITER_H
+#include <functional>
+#include <mutex>
+#include "request-priority.h"
+
+/*
+ * Caps the number of asynchronous verb calls in flight.
+ * A submitted call starts at once while under the cap, otherwise it waits
+ * in its priority class until a running call reports completion with done().
+ */
+class CallLimiter {
+  public:
+    using task = std::function<void()>;
+
+    explicit CallLimiter(unsigned max_inflight = 0);
+    ~CallLimiter() = default;
+    CallLimiter(const CallLimiter &) = delete;
+    CallLimiter &operator=(const CallLimiter &) = delete;
+
+    void set_max_inflight(unsigned max_inflight);
+    void submit(task t, request_class cls = PRIORITY_NORMAL);
+    void done();
+    unsigned inflight() const;
+    size_t queued() const;
+    size_t queued(request_class cls) const;
+  private:
+    mutable std::mutex mtx;
+    ClassQueue<task> pending;
+    unsigned max_inflight;
+    unsigned running;
+};
+
+#endif
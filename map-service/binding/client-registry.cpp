@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "client-registry.h"
+#include "map-client.h"
+
+// FNV-1a, computed once per lookup over the caller's buffer
+ClientRegistry::Key::Key(const char* s)
+    : str(s), len(0), hash(14695981039346656037ULL)
+{
+    for(const char* p = s; *p != '\0'; ++p, ++len) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ULL;
+    }
+}
+
+ClientRegistry::client_ptr ClientRegistry::find(const char* appid) const {
+    if(appid == nullptr) {
+        return nullptr;
+    }
+    Key key(appid);
+    const Shard& shard = this->shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.clients.find(key);
+    return (it != shard.clients.end()) ? it->second : nullptr;
+}
+
+ClientRegistry::client_ptr ClientRegistry::acquire(const char* appid, const factory& make, const joiner& join) {
+    if(appid == nullptr) {
+        return nullptr;
+    }
+    Key key(appid);
+    Shard& shard = this->shard_of(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.clients.find(key);
+        if(it != shard.clients.end()) {
+            join(it->second);
+            return it->second;
+        }
+    }
+
+    // Intern outside of the shard lock, the pool has its own
+    key.str = this->intern(appid);
+
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.clients.find(key);
+    if(it != shard.clients.end()) {
+        // Another thread created it in the meantime
+        join(it->second);
+        return it->second;
+    }
+    client_ptr client = make();
+    if(client != nullptr) {
+        shard.clients.emplace(key, client);
+    }
+    return client;
+}
+
+bool ClientRegistry::release(const char* appid, bool* last) {
+    if(last != nullptr) {
+        *last = false;
+    }
+    if(appid == nullptr) {
+        return false;
+    }
+    Key key(appid);
+    client_ptr removed;
+    Shard& shard = this->shard_of(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.clients.find(key);
+        if(it == shard.clients.end()) {
+            return false;
+        }
+        if(it->second->remove_session() > 0) {
+            return true;
+        }
+        removed = std::move(it->second);
+        shard.clients.erase(it);
+    }
+    if(last != nullptr) {
+        *last = true;
+    }
+    // The client is released here, outside of the shard lock
+    return true;
+}
+
+size_t ClientRegistry::size() const {
+    size_t n = 0;
+    for(const Shard& shard : this->shards) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        n += shard.clients.size();
+    }
+    return n;
+}
+
+const char* ClientRegistry::intern(const char* appid) {
+    std::lock_guard<std::mutex> lock(this->intern_mtx);
+    return this->interned.emplace(appid).first->c_str();
+}
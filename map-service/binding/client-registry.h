@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CLIENT_REGISTRY_H
+#define CLIENT_REGISTRY_H
+#include <string.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+class MapClient;
+
+/*
+ * Thread-safe registry of subscribed map clients keyed by application id.
+ * The map is split in shards, each guarded by its own mutex, so that
+ * subscribe, session removal and event fan-out on different daemon threads
+ * rarely contend. Keys point to interned appid strings, lookups hash the
+ * caller's C string in place and never allocate.
+ */
+class ClientRegistry {
+  public:
+    using client_ptr = std::shared_ptr<MapClient>;
+    using factory = std::function<client_ptr()>;
+    using joiner = std::function<void(const client_ptr&)>;
+
+    ClientRegistry() = default;
+    ~ClientRegistry() = default;
+    ClientRegistry(const ClientRegistry &) = delete;
+    ClientRegistry &operator=(const ClientRegistry &) = delete;
+
+    client_ptr find(const char* appid) const;
+    // Create the client with make, or add a session to it with join.
+    // Both run under the shard lock so they can't race with release()
+    client_ptr acquire(const char* appid, const factory& make, const joiner& join);
+    // Drop a session, the client is removed with its last session and
+    // last tells whether it was
+    bool release(const char* appid, bool* last = nullptr);
+    size_t size() const;
+
+    // Stable storage for an appid, valid for the lifetime of the process
+    const char* intern(const char* appid);
+
+  private:
+    struct Key {
+        const char* str;
+        size_t len;
+        size_t hash;
+        explicit Key(const char* s);
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const { return k.hash; }
+    };
+    struct KeyEqual {
+        bool operator()(const Key& a, const Key& b) const {
+            return a.len == b.len && (a.str == b.str || memcmp(a.str, b.str, a.len) == 0);
+        }
+    };
+    struct Shard {
+        mutable std::mutex mtx;
+        std::unordered_map<Key, client_ptr, KeyHash, KeyEqual> clients;
+    };
+
+    static const size_t shard_count = 16;
+
+    Shard& shard_of(const Key& k) { return shards[k.hash % shard_count]; }
+    const Shard& shard_of(const Key& k) const { return shards[k.hash % shard_count]; }
+
+    Shard shards[shard_count];
+    std::mutex intern_mtx;
+    std::unordered_set<std::string> interned;
+};
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ENV_CONFIG_H
+#define ENV_CONFIG_H
+#include <stdlib.h>
+
+/*
+ * Binding settings come from the environment of the widget,
+ * a missing or malformed value falls back to the default.
+ */
+static inline unsigned env_unsigned(const char* name, unsigned def) {
+    const char* val = getenv(name);
+    if(val == nullptr || *val == '\0') {
+        return def;
+    }
+    char* end;
+    unsigned long n = strtoul(val, &end, 10);
+    return (*end == '\0') ? (unsigned)n : def;
+}
+
+static inline double env_double(const char* name, double def) {
+    const char* val = getenv(name);
+    if(val == nullptr || *val == '\0') {
+        return def;
+    }
+    char* end;
+    double d = strtod(val, &end);
+    return (*end == '\0') ? d : def;
+}
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "latency-trace.h"
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <json-c/json.h>
+
+static const char _key_trace[] = "trace";
+static const char _key_id[] = "id";
+static const char _key_start[] = "start";
+static const char _key_last[] = "last";
+
+static const char* _stage_names[TRACE_STAGE_MAX] = {
+    "public_to_private",
+    "attach_queue",
+    "wm_attach",
+    "renderer_delivery",
+    "surface_create",
+    "provide_delivery",
+    "map_created_delivery",
+    "total",
+};
+
+/*
+ * Log-linear buckets: values below 16ns are exact, above that each power of
+ * two is split in 8 buckets (12.5% resolution) up to 2^40ns.
+ */
+static const unsigned _sub_bits = 3;
+static const unsigned _sub_count = 1 << _sub_bits;
+static const unsigned _max_msb = 40;
+static const unsigned _bucket_count = 2 * _sub_count + (_max_msb - _sub_bits) * _sub_count;
+
+static unsigned bucket_of(uint64_t v) {
+    if(v < 2 * _sub_count) {
+        return (unsigned)v;
+    }
+    unsigned msb = 63 - __builtin_clzll(v);
+    if(msb > _max_msb) {
+        return _bucket_count - 1;
+    }
+    unsigned mantissa = (unsigned)(v >> (msb - _sub_bits)) - _sub_count;
+    return 2 * _sub_count + (msb - _sub_bits - 1) * _sub_count + mantissa;
+}
+
+// Upper bound of the values counted in bucket b
+static uint64_t bucket_value(unsigned b) {
+    if(b < 2 * _sub_count) {
+        return b;
+    }
+    unsigned msb = (b - 2 * _sub_count) / _sub_count + _sub_bits + 1;
+    uint64_t mantissa = (b - 2 * _sub_count) % _sub_count + _sub_count;
+    return ((mantissa + 1) << (msb - _sub_bits)) - 1;
+}
+
+namespace {
+
+// Written by its owner thread only, read by stats()
+struct ThreadBuffer {
+    std::atomic<uint64_t> buckets[TRACE_STAGE_MAX][_bucket_count];
+    std::atomic<uint64_t> max[TRACE_STAGE_MAX];
+
+    ThreadBuffer() {
+        for(unsigned s = 0; s < TRACE_STAGE_MAX; ++s) {
+            for(unsigned b = 0; b < _bucket_count; ++b) {
+                buckets[s][b].store(0, std::memory_order_relaxed);
+            }
+            max[s].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+struct BufferList {
+    std::mutex mtx;
+    // Buffers outlive their threads, daemon workers are long lived
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+}
+
+static BufferList& buffer_list() {
+    static BufferList list;
+    return list;
+}
+
+static ThreadBuffer* this_thread_buffer() {
+    static thread_local ThreadBuffer* buffer = nullptr;
+    if(buffer == nullptr) {
+        BufferList& list = buffer_list();
+        std::lock_guard<std::mutex> lock(list.mtx);
+        list.buffers.emplace_back(new ThreadBuffer());
+        buffer = list.buffers.back().get();
+    }
+    return buffer;
+}
+
+TraceContext TraceContext::begin() {
+    static std::atomic<uint64_t> next_id(0);
+    TraceContext ctxt;
+    ctxt.id = ++next_id;
+    ctxt.start = ctxt.last = LatencyTracer::now();
+    return ctxt;
+}
+
+uint64_t TraceContext::stamp_of(json_object* obj, const char* key) {
+    json_object *j_trace, *j_val;
+    if(obj == nullptr || !json_object_object_get_ex(obj, _key_trace, &j_trace) ||
+       !json_object_object_get_ex(j_trace, key, &j_val)) {
+        return 0;
+    }
+    return json_object_get_int64(j_val);
+}
+
+bool TraceContext::read(json_object* obj) {
+    json_object *j_trace, *j_val;
+    if(obj == nullptr || !json_object_object_get_ex(obj, _key_trace, &j_trace)) {
+        return false;
+    }
+    if(json_object_object_get_ex(j_trace, _key_id, &j_val)) {
+        this->id = json_object_get_int64(j_val);
+    }
+    if(json_object_object_get_ex(j_trace, _key_start, &j_val)) {
+        this->start = json_object_get_int64(j_val);
+    }
+    if(json_object_object_get_ex(j_trace, _key_last, &j_val)) {
+        this->last = json_object_get_int64(j_val);
+    }
+    return this->valid();
+}
+
+void TraceContext::write(json_object* obj) const {
+    if(!this->valid()) {
+        return;
+    }
+    json_object* j_trace = json_object_new_object();
+    json_object_object_add(j_trace, _key_id, json_object_new_int64(this->id));
+    json_object_object_add(j_trace, _key_start, json_object_new_int64(this->start));
+    json_object_object_add(j_trace, _key_last, json_object_new_int64(this->last));
+    json_object_object_add(obj, _key_trace, j_trace);
+}
+
+void TraceContext::stamp(trace_stage stage) {
+    this->stamp(stage, LatencyTracer::now());
+}
+
+void TraceContext::stamp(trace_stage stage, uint64_t now) {
+    if(!this->valid()) {
+        return;
+    }
+    LatencyTracer::record(stage, (now > this->last) ? now - this->last : 0);
+    this->last = now;
+}
+
+uint64_t LatencyTracer::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void LatencyTracer::record(trace_stage stage, uint64_t ns) {
+    ThreadBuffer* buffer = this_thread_buffer();
+    // Single writer, a plain load and store is enough
+    std::atomic<uint64_t>& bucket = buffer->buckets[stage][bucket_of(ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if(ns > buffer->max[stage].load(std::memory_order_relaxed)) {
+        buffer->max[stage].store(ns, std::memory_order_relaxed);
+    }
+}
+
+const char* LatencyTracer::stage_name(trace_stage stage) {
+    return _stage_names[stage];
+}
+
+json_object* LatencyTracer::stats() {
+    std::vector<uint64_t> counts(_bucket_count);
+    json_object* j_stages = json_object_new_object();
+    BufferList& list = buffer_list();
+    std::lock_guard<std::mutex> lock(list.mtx);
+
+    for(unsigned s = 0; s < TRACE_STAGE_MAX; ++s) {
+        uint64_t total = 0, max = 0;
+        std::fill(counts.begin(), counts.end(), 0);
+        for(const auto& buffer : list.buffers) {
+            for(unsigned b = 0; b < _bucket_count; ++b) {
+                uint64_t n = buffer->buckets[s][b].load(std::memory_order_relaxed);
+                counts[b] += n;
+                total += n;
+            }
+            uint64_t m = buffer->max[s].load(std::memory_order_relaxed);
+            if(m > max) {
+                max = m;
+            }
+        }
+        if(total == 0) {
+            continue;
+        }
+
+        static const double quantiles[] = {0.50, 0.90, 0.99};
+        static const char* keys[] = {"p50_us", "p90_us", "p99_us"};
+        json_object* j_stage = json_object_new_object();
+        json_object_object_add(j_stage, "count", json_object_new_int64(total));
+        unsigned b = 0;
+        uint64_t seen = 0;
+        for(unsigned q = 0; q < 3; ++q) {
+            uint64_t rank = (uint64_t)(quantiles[q] * total + 0.5);
+            if(rank == 0) {
+                rank = 1;
+            }
+            while(b < _bucket_count && seen + counts[b] < rank) {
+                seen += counts[b++];
+            }
+            uint64_t v = bucket_value(b);
+            json_object_object_add(j_stage, keys[q], json_object_new_double((v < max ? v : max) / 1000.0));
+        }
+        json_object_object_add(j_stage, "max_us", json_object_new_double(max / 1000.0));
+        json_object_object_add(j_stages, _stage_names[s], j_stage);
+    }
+    return j_stages;
+}
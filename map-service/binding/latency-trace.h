@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+#include <stdint.h>
+
+struct json_object;
+
+/*
+ * Stages of the request_map -> new_request -> provide_surface -> map_created
+ * pipeline. Each one is the time since the previous stamp of the same trace.
+ */
+enum trace_stage {
+    TRACE_PUBLIC_TO_PRIVATE = 0, // map-service received -> map-private received
+    TRACE_ATTACH_QUEUE,          // waiting for an in-flight slot
+    TRACE_WM_ATTACH,             // attachSurfaceToApp round trip
+    TRACE_RENDERER_DELIVERY,     // new_request pushed -> renderer received
+    TRACE_SURFACE_CREATE,        // renderer received -> provide_surface sent
+    TRACE_PROVIDE_DELIVERY,      // provide_surface sent -> map-private received
+    TRACE_MAP_CREATED_DELIVERY,  // map_created pushed -> map-service received
+    TRACE_TOTAL,                 // map-service received -> map_created pushed to app
+    TRACE_STAGE_MAX
+};
+
+/*
+ * Trace id and timestamps which travel with a request in its "trace" member.
+ * Timestamps are CLOCK_MONOTONIC nanoseconds, comparable across processes.
+ */
+struct TraceContext {
+    uint64_t id;
+    uint64_t start;
+    uint64_t last;
+
+    TraceContext() : id(0), start(0), last(0) {}
+    bool valid() const { return id != 0; }
+    // Start a new trace at the entry of the pipeline
+    static TraceContext begin();
+    // Read the "trace" member of obj, returns false when it is absent
+    bool read(json_object* obj);
+    // Add the trace as "trace" member of obj
+    void write(json_object* obj) const;
+    // Extra timestamp key of the "trace" member of obj, 0 when it is absent
+    static uint64_t stamp_of(json_object* obj, const char* key);
+    // Record the time since the previous stamp as stage and restart from now
+    void stamp(trace_stage stage);
+    void stamp(trace_stage stage, uint64_t now);
+};
+
+/*
+ * Per-stage latency histograms.
+ * Every thread records into its own buffer with relaxed atomics, the only
+ * lock is taken once per thread to register the buffer. stats() folds
+ * all buffers together and reports percentiles in microseconds.
+ */
+class LatencyTracer {
+  public:
+    static uint64_t now();
+    static void record(trace_stage stage, uint64_t ns);
+    // {"<stage>": {"count", "p50_us", "p90_us", "p99_us", "max_us"}, ...}
+    static json_object* stats();
+    static const char* stage_name(trace_stage stage);
+};
+
+#endif
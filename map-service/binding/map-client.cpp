@@ -26,11 +26,27 @@
 
 static const char mp_created[] = "map_created";
 
-MapClient::MapClient(afb::req req) {
+MapClient::MapClient(afb::req req)
+    : sessions(1)
+{
     this->map_created = afb::make_event(mp_created);
     req.subscribe(this->map_created);
 }
 
+// Every session of the application receives map_created,
+// so one surface can be shared by all of them
+void MapClient::add_session(afb::req req) {
+    req.subscribe(this->map_created);
+    ++this->sessions;
+}
+
+unsigned MapClient::remove_session() {
+    if(this->sessions > 0) {
+        --this->sessions;
+    }
+    return this->sessions;
+}
+
 void MapClient::push_map_created(json_object* content) {
     this->map_created.push(content);
 }
@@ -33,9 +33,12 @@ class MapClient {
   public:
     MapClient(afb::req req);
     ~MapClient() = default;
+    void add_session(afb::req req);
+    unsigned remove_session();
     void push_map_created(json_object* resp);
   private:
     afb::event map_created;
+    unsigned sessions;
 };
 
 #endif
\ No newline at end of file
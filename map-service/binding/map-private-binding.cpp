@@ -22,14 +22,27 @@
  */
 
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <stdio.h>
 #include <json-c/json.h>
+#include <systemd/sd-event.h>
+#include "call-limiter.h"
+#include "admission-control.h"
+#include "request-priority.h"
+#include "env-config.h"
+#include "request-router.h"
+#include "request-coalescer.h"
+#include "surface-pool.h"
+#include "latency-trace.h"
 
 #define AFB_BINDING_VERSION 3
 #include <afb/afb-binding>
 
 using std::string;
 
-static int service_id = 0;
+static std::atomic<unsigned> service_id(0);
 static string g_my_role = "Map.";
 static const char _to_myself[] = "map-private";
 static const char _key_dest[] = "destination";
@@ -38,116 +51,571 @@ static const char _key_req_srfc_id[] = "request_surface_id";
 static const char _key_srfc[] = "surface";
 static const char _key_uuid[] = "uuid";
 static const char _key_appid[] = "appid";
+static const char _key_role[] = "role";
+static const char _key_op[] = "op";
+static const char _op_prepare[] = "prepare";
+static const char _op_assign[] = "assign";
+static const char _op_release[] = "release";
+static const char _key_recv[] = "recv";
+static const char _key_sent[] = "sent";
+static const char _key_stages[] = "stages";
+static const char _key_surfaces[] = "surfaces";
+static const char _key_error[] = "error";
+static const size_t _max_batch = 8;
 
 static const char _api_wm[] = "windowmanager";
 static const char _verb_wm_atch_srf_to_app[] = "attachSurfaceToApp";
 static const char _verb_provide_surface[] = "provide_surface";
+static const char _env_max_inflight[] = "MAP_SERVICE_MAX_INFLIGHT";
+static const unsigned _def_max_inflight = 8;
+static const char _env_pool_size[] = "MAP_SERVICE_POOL_SIZE";
+static const char _env_pool_base[] = "MAP_SERVICE_POOL_SURFACE_BASE";
+static const char _env_pool_ids[] = "MAP_SERVICE_POOL_SURFACE_COUNT";
+static const char _env_pool_psi[] = "MAP_SERVICE_POOL_PSI_LIMIT";
+// Pooling needs a window manager whose attachSurfaceToApp attaches the
+// "surface" it is given; the AGL one always allocates the surface itself,
+// so the pool is off unless MAP_SERVICE_POOL_SIZE is set
+static const unsigned _def_pool_size = 0;
+static const unsigned _def_pool_base = 9100;
+static const unsigned _def_pool_ids = 64;
+static const double _def_pool_psi = 10.0; // memory "some avg10" in percent
+static const uint64_t _pool_check_interval = 5000000; // usec
+static const char _psi_memory[] = "/proc/pressure/memory";
+static const char _env_max_pending[] = "MAP_SERVICE_MAX_PENDING";
+static const char _env_app_rate[] = "MAP_SERVICE_APP_RATE";
+static const char _env_app_burst[] = "MAP_SERVICE_APP_BURST";
+static const unsigned _def_max_pending = 32;
+static const double _def_app_rate = 5.0;  // request_map per second and application
+static const double _def_app_burst = 10.0;
+static const unsigned _service_id_wrap = 100000; // WM role names are reused past this
+static const char _err_busy[] = "busy";
+static const char _key_admission[] = "admission";
+static const char _key_scheduler[] = "scheduler";
+static const char _env_renderer_window[] = "MAP_SERVICE_RENDERER_WINDOW";
+static const unsigned _def_renderer_window = 2;
+static const char _env_flight_ttl[] = "MAP_SERVICE_FLIGHT_TTL_MS";
+static const unsigned _def_flight_ttl = 5000; // identical requests share an unprovided surface this long
+static const char _env_renderer_timeout[] = "MAP_SERVICE_RENDERER_TIMEOUT_MS";
+static const unsigned _def_renderer_timeout = 10000; // a renderer has this long to provide a surface
+static const uint64_t _expire_check_interval = 1000000; // usec
+
+static std::atomic_flag g_subscribed = ATOMIC_FLAG_INIT; // This will be deleted
+
+afb::event map_created;
+static CallLimiter _wm_calls;
+static AdmissionControl _admission;
+static RequestRouter _router;
+static RequestCoalescer _flights;
+static SurfacePool _pool;
+static double _pool_psi_limit;
+static sd_event_source* _pool_timer;
+static sd_event_source* _expire_timer;
+
+static void push_map_created(const char* uuid, const char* appid, const TraceContext& trace) {
+    json_object* j_created = json_object_new_object();
+    json_object_object_add(j_created, _key_uuid, json_object_new_string(uuid));
+    json_object_object_add(j_created, _key_appid, json_object_new_string(appid));
+    trace.write(j_created);
+    map_created.push(j_created);
+}
 
-static bool g_first_time = true; // This will be deleted
+// Request of op on a surface a renderer holds
+static json_object* make_op_request(const char* op, int surface) {
+    json_object* j = json_object_new_object();
+    json_object_object_add(j, _key_op, json_object_new_string(op));
+    json_object_object_add(j, _key_srfc, json_object_new_int(surface));
+    return j;
+}
 
-afb::event new_request, map_created;
+// Ask renderers to create the surfaces missing in the pool
+static void refill_pool() {
+    for(int id : _pool.reserve()) {
+        string token = SurfacePool::token(id);
+        json_object* j = make_op_request(_op_prepare, id);
+        json_object_object_add(j, _key_uuid, json_object_new_string(token.c_str()));
+        // Surfaces for later never delay a request somebody waits for
+        _router.dispatch(token.c_str(), "", j, PRIORITY_BACKGROUND);
+    }
+}
 
-static void request_map(afb_req_t r) {
+static void release_pool(unsigned keep) {
+    for(const SurfacePool::Surface& s : _pool.trim(keep)) {
+        AFB_INFO("release pooled surface %d", s.id);
+        _router.push_to(s.renderer, make_op_request(_op_release, s.id));
+    }
+}
+
+// "some avg10" of the memory pressure stall information, -1 if unavailable
+static double read_memory_pressure() {
+    FILE* f = fopen(_psi_memory, "r");
+    if(f == nullptr) {
+        return -1.0;
+    }
+    double avg10 = -1.0;
+    if(fscanf(f, "some avg10=%lf", &avg10) != 1) {
+        avg10 = -1.0;
+    }
+    fclose(f);
+    return avg10;
+}
+
+static int on_pool_timer(sd_event_source *s, uint64_t usec, void *userdata) {
+    double psi = read_memory_pressure();
+    bool pressure = psi >= _pool_psi_limit;
+    _pool.set_pressure(pressure);
+    if(pressure) {
+        AFB_NOTICE("memory pressure %.2f, release pooled surfaces", psi);
+        release_pool(0);
+    }
+    else {
+        refill_pool();
+    }
+    sd_event_source_set_time(s, usec + _pool_check_interval);
+    sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+    return 0;
+}
+
+// Requests a renderer sat on are given up, their slots go to the next ones
+static int on_expire_timer(sd_event_source *s, uint64_t usec, void *userdata) {
+    int id;
+    bool refill = false;
+    for(const RequestRouter::Surface& e : _router.expire()) {
+        AFB_WARNING("renderer did not answer %s in time", e.uuid.c_str());
+        if(SurfacePool::parse_token(e.uuid.c_str(), &id)) {
+            _pool.cancel(id);
+            refill = true;
+        }
+        else {
+            _flights.finish(e.uuid.c_str());
+        }
+        // The surface may be made after all, nobody would be told of it
+        if(e.surface >= 0) {
+            _router.push_to(e.renderer, make_op_request(_op_release, e.surface));
+        }
+    }
+    if(refill) {
+        refill_pool();
+    }
+    sd_event_source_set_time(s, usec + _expire_check_interval);
+    sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+    return 0;
+}
+
+typedef struct RendererContext {
+    RequestRouter::renderer_ptr renderer;
+} RendererContext;
+
+// Pending requests are handed over to another renderer, their surfaces are
+// created anew so callers joining them must not be given the old ones.
+// Pool surfaces it was preparing are not, their ids are free again
+static void drop_renderer(const RendererSession* renderer) {
+    std::vector<string> requeued, dropped;
+    int id;
+    _router.remove_renderer(renderer, &requeued, &dropped);
+    for(const string& uuid : requeued) {
+        _flights.finish(uuid.c_str());
+    }
+    for(const string& uuid : dropped) {
+        if(SurfacePool::parse_token(uuid.c_str(), &id)) {
+            _pool.cancel(id);
+        }
+    }
+    _pool.drop_renderer(renderer);
+    refill_pool();
+}
+
+static void cbRemoveRenderer(void *data) {
+    RendererContext *ctxt = (RendererContext *)data;
+    if (ctxt == nullptr) {
+        return;
+    }
+    AFB_INFO("remove renderer");
+    if(ctxt->renderer != nullptr) {
+        drop_renderer(ctxt->renderer.get());
+    }
+    delete ctxt;
+}
+
+typedef struct AttachContext {
+    string key;
+    string appid;
+    string role; // service surface name given to the window manager
+    SurfacePool::Surface pooled; // id is -1 when the window manager allocates it
+    TraceContext trace;
+    request_class cls;
+} AttachContext;
+
+static void reply_attached(afb_req_t r, const char* uuid, int surface) {
+    afb::req req(r);
+    json_object* j_reply = json_object_new_object();
+    json_object_object_add(j_reply, _key_srfc, json_object_new_int(surface));
+    json_object_object_add(j_reply, _key_uuid, json_object_new_string(uuid));
+    req.success(j_reply);
+}
+
+// Arguments of attachSurfaceToApp, a pooled surface only has to be attached.
+// The service surface name is the role the window manager knows the map by
+static json_object* make_wm_arg(const char* app_id, const SurfacePool::Surface& pooled, string* role) {
+    string service = g_my_role + std::to_string(service_id++ % _service_id_wrap);
+    *role = service;
+    json_object* wm_arg = json_object_new_object();
+    json_object_object_add(wm_arg, _key_dest, json_object_new_string(app_id));
+    json_object_object_add(wm_arg, _key_srv_srfc, json_object_new_string(service.c_str()));
+    if(pooled.id >= 0) {
+        json_object_object_add(wm_arg, _key_srfc, json_object_new_int(pooled.id));
+        json_object_object_add(wm_arg, _key_req_srfc_id, json_object_new_boolean(false));
+    }
+    else {
+        // If UI process in this security context requeires ivi surface id,
+        // add "request_surface_id" parameter to the argument
+        json_object_object_add(wm_arg, _key_req_srfc_id, json_object_new_boolean(true));
+    }
+    AFB_DEBUG("request to wm: %s", json_object_get_string(wm_arg));
+    return wm_arg;
+}
+
+// Request of the UI process to create (or take over) a surface
+static json_object* make_ui_request(const char* uuid, int surface, const char* appid, const char* role,
+                                    const TraceContext& trace) {
+    json_object* j_ui_req = json_object_new_object();
+    // Add surface, uuid
+    json_object_object_add(j_ui_req, _key_srfc, json_object_new_int(surface));
+    json_object_object_add(j_ui_req, _key_uuid, json_object_new_string(uuid));
+    json_object_object_add(j_ui_req, _key_appid, json_object_new_string(appid));
+    json_object_object_add(j_ui_req, _key_role, json_object_new_string(role));
+    trace.write(j_ui_req);
+    // ========= Add some request to UI process here ===========
+
+    // =================================================
+    return j_ui_req;
+}
+
+static void on_attach_reply(void *closure, json_object *resp, const char *error, const char *info, afb_api_t api) {
     AFB_DEBUG(__FUNCTION__);
-    char* error, *info;
-    json_object *args, *wm_arg, *j_app, *resp, *jsurface, *juuid;
+    AttachContext *ctxt = static_cast<AttachContext*>(closure);
+    json_object *jsurface, *juuid;
     int surface = -1;
-    string service = g_my_role + std::to_string(++service_id); // This may be deleted
+
+    AFB_INFO("error : %s, info: %s, resp: %s", error, info, json_object_get_string(resp));
+    ctxt->trace.stamp(TRACE_WM_ATTACH);
+    if(error == nullptr && json_object_object_get_ex(resp, _key_uuid, &juuid)) {
+        // Unpack response from WM
+        if(json_object_object_get_ex(resp, _key_srfc, &jsurface)) {
+            surface = json_object_get_int(jsurface);
+        }
+        const char* uuid = json_object_get_string(juuid);
+        if(ctxt->pooled.id >= 0) {
+            surface = ctxt->pooled.id;
+        }
+        // Resolve first, provide_surface may finish the flight right after dispatch
+        std::vector<afb_req_t> waiters = _flights.resolve(ctxt->key, uuid, surface, LatencyTracer::now());
+
+        json_object* j_ui_req = make_ui_request(uuid, surface, ctxt->appid.c_str(), ctxt->role.c_str(), ctxt->trace);
+        if(ctxt->pooled.id >= 0) {
+            // The surface exists already, its renderer only learns the owner
+            json_object_object_add(j_ui_req, _key_op, json_object_new_string(_op_assign));
+            json_object_get(j_ui_req);
+            if(_router.push_to(ctxt->pooled.renderer, j_ui_req)) {
+                json_object_put(j_ui_req);
+                _router.adopt(uuid, ctxt->appid.c_str(), ctxt->pooled.renderer, surface);
+                _flights.finish(uuid);
+                push_map_created(uuid, ctxt->appid.c_str(), ctxt->trace);
+            }
+            else {
+                // The renderer went away, let another one create the surface
+                _pool.keep(surface);
+                json_object_object_del(j_ui_req, _key_op);
+                _router.dispatch(uuid, ctxt->appid.c_str(), j_ui_req, ctxt->cls);
+            }
+        }
+        else {
+            // Request the UI process to create surface,
+            // only the renderer which owns the request receives it
+            _router.dispatch(uuid, ctxt->appid.c_str(), j_ui_req, ctxt->cls);
+        }
+
+        // Every joined request gets the same surface
+        for(afb_req_t w : waiters) {
+            reply_attached(w, uuid, surface);
+            afb_req_unref(w);
+        }
+    }
+    else {
+        const char* reason = (error != nullptr) ? "failed to call window manager verb"
+                                                : "window manager doesn't return uuid";
+        if(ctxt->pooled.id >= 0) {
+            _pool.put_back(ctxt->pooled);
+        }
+        for(afb_req_t w : _flights.fail(ctxt->key)) {
+            afb::req(w).fail(reason);
+            afb_req_unref(w);
+        }
+    }
+    delete ctxt;
+
+    // Let the next waiting attach run
+    _admission.release(1);
+    _wm_calls.done();
+}
+
+static void request_map(afb_req_t r) {
+    AFB_DEBUG(__FUNCTION__);
+    json_object *args, *wm_arg, *j_app;
     afb::req req(r);
 
     // Subscribe at first time
     /* const auto ctxt = req.context(); */
-    if(g_first_time) {
+    if(!g_subscribed.test_and_set()) {
         AFB_DEBUG("first time subscribe");
         req.subscribe(map_created);
-        g_first_time = false;
     }
 
     args = req.json();
-    wm_arg = json_object_new_object();
+    TraceContext trace;
+    if(trace.read(args)) {
+        trace.stamp(TRACE_PUBLIC_TO_PRIVATE);
+    }
 
-    // Call window manager verb to attach service surface to the caller
     json_object_object_get_ex(args, _key_appid, &j_app);
     const char* app_id = json_object_get_string(j_app);
     if(app_id == nullptr) {
         req.fail("application id is not set");
         return;
     }
-    json_object_object_add(wm_arg, _key_dest, json_object_new_string(app_id));
-    json_object_object_add(wm_arg, _key_srv_srfc, json_object_new_string(service.c_str())); // This may be deleted
-    // If UI process in this security context requeires ivi surface id,
-    // add "request_surface_id" parameter to the argument
-    json_object_object_add(wm_arg, _key_req_srfc_id, json_object_new_boolean(true));
 
-    AFB_DEBUG("request to wm: %s", json_object_get_string(wm_arg));
-    bool ret = afb::callsync(_api_wm, _verb_wm_atch_srf_to_app, wm_arg, resp, error, info);
+    // Join an identical request of the same application if one is in flight
+    string key = RequestCoalescer::make_key(app_id, args);
+    string uuid;
+    int surface;
+    req.addref();
+    switch(_flights.join(key, r, LatencyTracer::now(), &uuid, &surface)) {
+    case RequestCoalescer::WAITING:
+        AFB_DEBUG("join request of %s", app_id);
+        return;
+    case RequestCoalescer::ATTACHED:
+        AFB_DEBUG("surface %s is already attached to %s", uuid.c_str(), app_id);
+        reply_attached(r, uuid.c_str(), surface);
+        req.unref();
+        return;
+    case RequestCoalescer::LEADER:
+        break;
+    }
 
-    AFB_INFO("error : %s, info: %s, resp: %s", error, info, json_object_get_string(resp));
-    if(ret) {
-        // afb returns true if calling verb is success
-        req.fail("failed to call window manager verb");
+    // Shed the request before it reaches window manager, joined callers included
+    AdmissionControl::verdict verdict = _admission.admit(app_id, 1, LatencyTracer::now());
+    if(verdict != AdmissionControl::ADMIT) {
+        AFB_INFO("reject request of %s: %s", app_id, AdmissionControl::reason(verdict));
+        for(afb_req_t w : _flights.fail(key)) {
+            afb::req(w).reply(nullptr, _err_busy, AdmissionControl::reason(verdict));
+            afb_req_unref(w);
+        }
         return;
     }
 
-    // Unpack response from WM
-    if(json_object_object_get_ex(resp, _key_srfc, &jsurface)) {
-        surface = json_object_get_int(jsurface);
+    // Call window manager verb to attach service surface to the caller,
+    // a pooled surface is used when one is ready. Background requests
+    // leave the pool to the maps somebody looks at
+    request_class cls = request_priority(args);
+    SurfacePool::Surface pooled = {-1, nullptr};
+    if(cls != PRIORITY_BACKGROUND && _pool.take(&pooled)) {
+        refill_pool();
     }
-    if(json_object_object_get_ex(resp, _key_uuid, &juuid)) {
-        // Request the UI process to create surface
-        const char* uuid = json_object_get_string(juuid);
-        json_object* j_ui_req = json_object_new_object();
-        // Add surface, uuid
-        json_object_object_add(j_ui_req, _key_srfc, json_object_new_int(surface));
-        json_object_object_add(j_ui_req, _key_uuid, json_object_new_string(uuid));
-        json_object_object_add(j_ui_req, _key_appid, json_object_new_string(app_id));
-        // ========= Add some request to UI process here ===========
-
-        // =================================================
-        new_request.push(args);
-        req.success();
+    string role;
+    wm_arg = make_wm_arg(app_id, pooled, &role);
+
+    // Reply is deferred until window manager answers
+    AttachContext *ctxt = new AttachContext{key, app_id, role, pooled, trace, cls};
+    _wm_calls.submit([wm_arg, ctxt]() {
+        ctxt->trace.stamp(TRACE_ATTACH_QUEUE);
+        afb::call(_api_wm, _verb_wm_atch_srf_to_app, wm_arg, on_attach_reply, ctxt);
+    }, cls);
+}
+
+typedef struct BatchContext {
+    afb_req_t req;
+    string appid;
+    request_class cls;
+    TraceContext trace;
+    std::mutex mtx;
+    size_t remaining;
+    json_object* results; // one entry per surface spec, in order
+    std::vector<std::pair<string, json_object*>> ui_requests;
+} BatchContext;
+
+typedef struct BatchItemContext {
+    BatchContext* batch;
+    size_t index;
+    string role;
+} BatchItemContext;
+
+static void complete_batch(BatchContext* batch) {
+    afb::req req(batch->req);
+    batch->trace.stamp(TRACE_WM_ATTACH);
+    for(auto& ui_req : batch->ui_requests) {
+        batch->trace.write(ui_req.second);
+    }
+
+    if(batch->ui_requests.empty()) {
+        json_object_put(batch->results);
+        req.fail("failed to attach any surface");
+    }
+    else {
+        // One new_request event carries what a renderer gets of the batch
+        _router.dispatch_batch(batch->appid.c_str(), batch->ui_requests, batch->cls);
+        json_object* j_reply = json_object_new_object();
+        json_object_object_add(j_reply, _key_surfaces, batch->results);
+        req.success(j_reply);
+    }
+    req.unref();
+    delete batch;
+}
+
+static void on_batch_attach_reply(void *closure, json_object *resp, const char *error, const char *info, afb_api_t api) {
+    AFB_DEBUG(__FUNCTION__);
+    BatchItemContext *item = static_cast<BatchItemContext*>(closure);
+    BatchContext *batch = item->batch;
+    json_object *jsurface, *juuid;
+    json_object* j_result = json_object_new_object();
+    json_object* j_ui_req = nullptr;
+    const char* uuid = nullptr;
 
-        ////////////////// test ////////////////////////
-        json_object *jtest, *jresponse_test;
-        char* test_info, *test_err;
-        jtest = json_object_new_object();
-        json_object_object_add(jtest, _key_uuid, json_object_new_string(uuid));
-        json_object_object_add(jtest, _key_appid, json_object_new_string(app_id));
-        // This is test because I don't implement UI process, so UI process can't create surface now.
-        /* afb::callsync(_to_myself, _verb_provide_surface, jtest, jresponse_test, test_info, test_err);
-        AFB_INFO("response test : %s", json_object_get_string(jresponse_test));
-        json_object_put(jresponse_test); */
-        ////////////////// test ////////////////////////
+    AFB_INFO("error : %s, info: %s, resp: %s", error, info, json_object_get_string(resp));
+    if(error == nullptr && json_object_object_get_ex(resp, _key_uuid, &juuid)) {
+        int surface = -1;
+        if(json_object_object_get_ex(resp, _key_srfc, &jsurface)) {
+            surface = json_object_get_int(jsurface);
+        }
+        uuid = json_object_get_string(juuid);
+        json_object_object_add(j_result, _key_srfc, json_object_new_int(surface));
+        json_object_object_add(j_result, _key_uuid, json_object_new_string(uuid));
+        j_ui_req = make_ui_request(uuid, surface, batch->appid.c_str(), item->role.c_str(), TraceContext());
     }
     else {
-        req.fail("window manager doesn't return uuid");
+        json_object_object_add(j_result, _key_error, json_object_new_string(
+            (error != nullptr) ? "failed to call window manager verb"
+                               : "window manager doesn't return uuid"));
     }
-    // free response json_object
-    json_object_put(resp);
 
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(batch->mtx);
+        json_object_array_put_idx(batch->results, item->index, j_result);
+        if(j_ui_req != nullptr) {
+            batch->ui_requests.emplace_back(uuid, j_ui_req);
+        }
+        last = (--batch->remaining == 0);
+    }
+    delete item;
+    if(last) {
+        complete_batch(batch);
+    }
 
+    // Let the next waiting attach run
+    _admission.release(1);
+    _wm_calls.done();
+}
+
+static void request_maps(afb_req_t r) {
+    AFB_DEBUG(__FUNCTION__);
+    json_object *args, *j_app, *j_specs;
+    afb::req req(r);
+
+    if(!g_subscribed.test_and_set()) {
+        AFB_DEBUG("first time subscribe");
+        req.subscribe(map_created);
+    }
 
+    args = req.json();
+    json_object_object_get_ex(args, _key_appid, &j_app);
+    const char* app_id = json_object_get_string(j_app);
+    if(app_id == nullptr) {
+        req.fail("application id is not set");
+        return;
+    }
+    if(!json_object_object_get_ex(args, _key_surfaces, &j_specs) ||
+       !json_object_is_type(j_specs, json_type_array)) {
+        req.fail("surfaces is not an array");
+        return;
+    }
+    size_t count = json_object_array_length(j_specs);
+    if(count == 0 || count > _max_batch) {
+        string msg = "surfaces must hold 1 to " + std::to_string(_max_batch) + " entries";
+        req.fail(msg.c_str());
+        return;
+    }
+    // A surface takes no parameter yet, reject what would be silently ignored
+    for(size_t i = 0; i < count; ++i) {
+        json_object* j_spec = json_object_array_get_idx(j_specs, i);
+        if(!json_object_is_type(j_spec, json_type_object) || json_object_object_length(j_spec) != 0) {
+            req.fail("surfaces entries must be empty objects");
+            return;
+        }
+    }
+    // A batch is admitted as a whole or not at all
+    AdmissionControl::verdict verdict = _admission.admit(app_id, count, LatencyTracer::now());
+    if(verdict != AdmissionControl::ADMIT) {
+        AFB_INFO("reject batch of %s: %s", app_id, AdmissionControl::reason(verdict));
+        req.reply(nullptr, _err_busy, AdmissionControl::reason(verdict));
+        return;
+    }
+
+    BatchContext* batch = new BatchContext();
+    batch->req = r;
+    batch->appid = app_id;
+    batch->remaining = count;
+    batch->results = json_object_new_array();
+    if(batch->trace.read(args)) {
+        batch->trace.stamp(TRACE_PUBLIC_TO_PRIVATE);
+    }
+    req.addref();
+
+    request_class cls = request_priority(args);
+    batch->cls = cls;
+    // Every attach is issued at once, the replies are gathered in the batch.
+    // Pooled surfaces are kept for single requests, a batch creates its own
+    SurfacePool::Surface none = {-1, nullptr};
+    for(size_t i = 0; i < count; ++i) {
+        string role;
+        json_object* wm_arg = make_wm_arg(app_id, none, &role);
+        BatchItemContext* item = new BatchItemContext{batch, i, role};
+        _wm_calls.submit([wm_arg, item]() {
+            if(item->index == 0) {
+                item->batch->trace.stamp(TRACE_ATTACH_QUEUE);
+            }
+            afb::call(_api_wm, _verb_wm_atch_srf_to_app, wm_arg, on_batch_attach_reply, item);
+        }, cls);
+    }
 }
 
 static void start_service(afb_req_t r) {
     AFB_DEBUG(__FUNCTION__);
     afb::req req(r);
 
-    req.subscribe(new_request);
-    /* if(json_object_object_get_ex(args, "type", jtype) && req.context() == nullptr) {
-        string type = json_object_get_string(jtype);
-        if(type == "local") {
-            req.subscribe(map_created);
-        }
-    } */
+    RendererContext *ctxt = (RendererContext *)afb_req_context_get(r);
+    if (!ctxt) {
+        ctxt = new RendererContext();
+        afb_req_context_set(r, ctxt, cbRemoveRenderer);
+    }
+    if (ctxt->renderer == nullptr) {
+        // Subscribe this session to its own new_request event
+        ctxt->renderer = _router.add_renderer(req);
+    }
     req.success();
+
+    // Let the new renderer warm up the pool
+    refill_pool();
 }
 
 static void stop_service(afb_req_t r) {
     AFB_DEBUG(__FUNCTION__);
     afb::req req(r);
 
-    req.unsubscribe(new_request);
+    RendererContext *ctxt = (RendererContext *)afb_req_context_get(r);
+    if (ctxt && ctxt->renderer != nullptr) {
+        req.unsubscribe(ctxt->renderer->new_request);
+        drop_renderer(ctxt->renderer.get());
+        ctxt->renderer = nullptr;
+    }
     req.success();
 
     // TODO : some shutdown processes are necessary.
@@ -157,18 +625,109 @@ static void provide_surface(afb_req_t r) {
     AFB_DEBUG(__FUNCTION__);
     afb::req req(r);
 
-    // Store uuid
     json_object *j, *j_uuid;
     j = req.json();
+    if(!json_object_object_get_ex(j, _key_uuid, &j_uuid)) {
+        req.fail("uuid is not set");
+        return;
+    }
+
+    RendererContext *ctxt = (RendererContext *)afb_req_context_get(r);
+    if (!ctxt || ctxt->renderer == nullptr) {
+        req.fail("start_service is not called");
+        return;
+    }
 
-    // Notify app of uuid with request id
-    if(json_object_object_get_ex(j, "uuid", &j_uuid)) {
-        map_created.push(j);
+    // Only the renderer the request was routed to may complete it
+    const char* uuid = json_object_get_string(j_uuid);
+    string appid;
+    if(!_router.complete(uuid, ctxt->renderer.get(), &appid)) {
+        req.fail("unknown uuid");
+        return;
+    }
+
+    int pooled;
+    if(SurfacePool::parse_token(uuid, &pooled)) {
+        // A surface prepared for the pool, it waits there for a request
+        _pool.ready(pooled, ctxt->renderer.get());
         req.success();
+        return;
     }
-    else {
-        req.fail();
+
+    // Identical requests from now on need a new surface
+    _flights.finish(uuid);
+
+    // The renderer stamps when it got new_request and when it answered
+    TraceContext trace;
+    if(trace.read(j)) {
+        trace.stamp(TRACE_RENDERER_DELIVERY, TraceContext::stamp_of(j, _key_recv));
+        trace.stamp(TRACE_SURFACE_CREATE, TraceContext::stamp_of(j, _key_sent));
+        trace.stamp(TRACE_PROVIDE_DELIVERY);
     }
+
+    // Notify app of uuid with request id, every joined request shares it
+    push_map_created(uuid, appid.c_str(), trace);
+    req.success();
+}
+
+/*
+ * The application is done with a map, or with all of them when no uuid is
+ * given (its last session closed). Their renderers destroy the surfaces.
+ */
+static void release(afb_req_t r) {
+    AFB_DEBUG(__FUNCTION__);
+    afb::req req(r);
+    json_object *args, *j_app, *j_uuid;
+
+    args = req.json();
+    json_object_object_get_ex(args, _key_appid, &j_app);
+    const char* app_id = json_object_get_string(j_app);
+    if(app_id == nullptr) {
+        req.fail("application id is not set");
+        return;
+    }
+    const char* uuid = json_object_object_get_ex(args, _key_uuid, &j_uuid) ?
+        json_object_get_string(j_uuid) : nullptr;
+
+    for(const RequestRouter::Surface& s : _router.release(app_id, uuid)) {
+        AFB_INFO("release surface %d of %s", s.surface, app_id);
+        // Identical requests must not be given the released surface
+        _flights.finish(s.uuid.c_str());
+        if(s.surface >= 0) {
+            _router.push_to(s.renderer, make_op_request(_op_release, s.surface));
+            _pool.release(s.surface);
+        }
+    }
+    req.success();
+    refill_pool();
+}
+
+static void stats(afb_req_t r) {
+    AFB_DEBUG(__FUNCTION__);
+    afb::req req(r);
+    json_object* j_stats = json_object_new_object();
+    json_object_object_add(j_stats, _key_stages, LatencyTracer::stats());
+
+    json_object* j_adm = json_object_new_object();
+    json_object_object_add(j_adm, "pending", json_object_new_int64(_admission.pending()));
+    json_object_object_add(j_adm, "max_pending", json_object_new_int64(_admission.max_pending()));
+    json_object_object_add(j_adm, "queued", json_object_new_int64(_wm_calls.queued()));
+    json_object_object_add(j_adm, "inflight", json_object_new_int64(_wm_calls.inflight()));
+    json_object_object_add(j_adm, "admitted", json_object_new_int64(_admission.admitted()));
+    json_object_object_add(j_adm, "shed_queue_full", json_object_new_int64(_admission.shed_queue_full()));
+    json_object_object_add(j_adm, "shed_rate_limited", json_object_new_int64(_admission.shed_rate_limited()));
+    json_object_object_add(j_adm, "limited_apps", json_object_new_int64(_admission.apps()));
+    json_object_object_add(j_stats, _key_admission, j_adm);
+
+    static const char* const class_names[PRIORITY_CLASSES] = {"foreground", "normal", "background"};
+    json_object* j_sched = json_object_new_object();
+    for(int c = 0; c < PRIORITY_CLASSES; ++c) {
+        json_object_object_add(j_sched, class_names[c],
+                               json_object_new_int64(_wm_calls.queued((request_class)c)));
+    }
+    json_object_object_add(j_sched, "renderer_waiting", json_object_new_int64(_router.waiting()));
+    json_object_object_add(j_stats, _key_scheduler, j_sched);
+    req.success(j_stats);
 }
 
 int preinit(afb_api_t api) {
@@ -178,8 +737,36 @@ int preinit(afb_api_t api) {
 
 int init(afb_api_t api) {
     AFB_NOTICE(__FUNCTION__);
-    new_request = afb::make_event("new_request");
     map_created = afb::make_event("map_created");
+    _wm_calls.set_max_inflight(env_unsigned(_env_max_inflight, _def_max_inflight));
+    _router.set_window(env_unsigned(_env_renderer_window, _def_renderer_window));
+    _flights.set_ttl((uint64_t)env_unsigned(_env_flight_ttl, _def_flight_ttl) * 1000000);
+    unsigned renderer_timeout = env_unsigned(_env_renderer_timeout, _def_renderer_timeout);
+    _router.set_timeout((uint64_t)renderer_timeout * 1000000);
+    _admission.configure(env_unsigned(_env_max_pending, _def_max_pending),
+                         env_double(_env_app_rate, _def_app_rate),
+                         env_double(_env_app_burst, _def_app_burst));
+
+    unsigned pool_size = env_unsigned(_env_pool_size, _def_pool_size);
+    _pool.configure(pool_size,
+                    env_unsigned(_env_pool_base, _def_pool_base),
+                    env_unsigned(_env_pool_ids, _def_pool_ids));
+    _pool_psi_limit = env_double(_env_pool_psi, _def_pool_psi);
+    if(pool_size != 0) {
+        AFB_NOTICE("surface pool of %u, %s must attach a given surface", pool_size, _api_wm);
+    }
+
+    // Check memory pressure and refill the pool in the background
+    uint64_t now;
+    sd_event* loop = afb_api_get_event_loop(api);
+    if(loop != nullptr && sd_event_now(loop, CLOCK_MONOTONIC, &now) >= 0) {
+        sd_event_add_time(loop, &_pool_timer, CLOCK_MONOTONIC, now + _pool_check_interval, 0,
+                          on_pool_timer, nullptr);
+        if(renderer_timeout != 0) {
+            sd_event_add_time(loop, &_expire_timer, CLOCK_MONOTONIC, now + _expire_check_interval, 0,
+                              on_expire_timer, nullptr);
+        }
+    }
     return 0;
 }
 
@@ -193,6 +780,9 @@ const afb_verb_t verbs[] = {
     afb::verb("stop_service", stop_service, "stop service", AFB_SESSION_LOA_0),
     afb::verb(_verb_provide_surface, provide_surface, "provide service", AFB_SESSION_LOA_0),
     afb::verb("request_map", request_map, "receive request from public", AFB_SESSION_LOA_0),
+    afb::verb("request_maps", request_maps, "receive batch request from public", AFB_SESSION_LOA_0),
+    afb::verb("release", release, "receive release of maps from public", AFB_SESSION_LOA_0),
+    afb::verb("stats", stats, "latency of map-private stages", AFB_SESSION_LOA_0),
     afb::verbend()
 };
 
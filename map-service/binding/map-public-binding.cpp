@@ -22,91 +22,223 @@
  */
 
 #include <string>
+#include <string.h>
 #include <json-c/json.h>
 #include <memory>
-#include <unordered_map>
 #include "map-client.h"
+#include "client-registry.h"
+#include "call-limiter.h"
+#include "latency-trace.h"
+#include "env-config.h"
 
 #define AFB_BINDING_VERSION 3
 #include <afb/afb-binding>
 
 using std::string;
-using std::unordered_map;
 using std::shared_ptr;
 
 static const char _mp_prv_api[] = "map-private";
 static const char _verb_req_map[] = "request_map";
+static const char _verb_req_maps[] = "request_maps";
+static const char _verb_release[] = "release";
+static const char _verb_stats[] = "stats";
+static const char _key_stages[] = "stages";
+static const char _key_admission[] = "admission";
+static const char _key_scheduler[] = "scheduler";
 static const char _key_appid[] = "appid";
 static const char _key_uuid[] = "uuid";
 static const char _key_mp_sfc[] = "map_surface";
-static const char _ev_map_created[] = "map_created";
-static unordered_map<string, shared_ptr<MapClient>> _client_list;
+static const char _ev_map_created[] = "map-private/map_created";
+static const char _env_max_inflight[] = "MAP_SERVICE_MAX_INFLIGHT";
+static const unsigned _def_max_inflight = 8;
+static ClientRegistry _clients;
+static CallLimiter _prv_calls;
 
 typedef struct MapContext {
-    string name;
+    const char* name; // interned by the registry
     MapContext(const char *appName) {
-        name = appName;
+        name = _clients.intern(appName);
     }
 } MapContext;
 
+static void on_release_reply(void *closure, json_object *object, const char *error, const char *info, afb_api_t api) {
+    if(error != nullptr) {
+        AFB_WARNING("release of %s failed: %s", static_cast<const char*>(closure), error);
+    }
+}
+
 static void cbRemoveClientCtxt(void *data) {
     MapContext *ctxt = (MapContext *)data;
     if (ctxt == nullptr) {
         return;
     }
-    AFB_INFO("remove app %s", ctxt->name.c_str());
+    AFB_INFO("remove app %s", ctxt->name);
 
-    if(_client_list.count(ctxt->name) != 0) {
-        _client_list.erase(ctxt->name);
+    bool last;
+    _clients.release(ctxt->name, &last);
+    if(last) {
+        // Nobody of the app is left to show its maps
+        json_object* args = json_object_new_object();
+        json_object_object_add(args, _key_appid, json_object_new_string(ctxt->name));
+        afb::call(_mp_prv_api, _verb_release, args, on_release_reply, (void*)ctxt->name);
     }
     delete ctxt;
 }
 
-static void createSecurityContext(afb_req_t req, const char* appid) {
+/*
+ * Application id of the caller, malloc'ed.
+ * Only the benchmark build of this binding (bench/CMakeLists.txt) lets
+ * callers name themselves with an "appid" argument, its simulated apps
+ * all connect with one credential.
+ */
+static char* get_caller_appid(afb::req& req) {
+#ifdef MAP_SERVICE_BENCH_TRUST_APPID
+    json_object *j_app;
+    if(json_object_object_get_ex(req.json(), _key_appid, &j_app)) {
+        return strdup(json_object_get_string(j_app));
+    }
+#endif
+    return req.get_application_id();
+}
+
+static bool createSecurityContext(afb_req_t req, const char* appid) {
     MapContext *ctxt = (MapContext *)afb_req_context_get(req);
     if (!ctxt) {
         // Create Security Context at first time
         MapContext *ctxt = new MapContext(appid);
-        AFB_INFO("create session for %s", ctxt->name.c_str());
+        AFB_INFO("create session for %s", ctxt->name);
         afb_req_context_set(req, ctxt, cbRemoveClientCtxt);
+        return true;
     }
+    return false;
 }
 
-static void request_map(afb_req_t r) {
+static void on_request_map_reply(void *closure, json_object *object, const char *error, const char *info, afb_api_t api) {
     AFB_DEBUG(__FUNCTION__);
-    char *app_id, *error, *info;
-    json_object *args, *resp, *jsurface, *juuid;
+    afb::req req(static_cast<afb_req_t>(closure));
+    AFB_INFO("%s : %s", error, info);
+    AFB_INFO("%s", json_object_get_string(object));
+
+    // Reply to the application with the result of map-private
+    req.reply(json_object_get(object), error, info);
+    req.unref();
+
+    // Let the next waiting request_map run
+    _prv_calls.done();
+}
+
+// Forward a request of the caller to the same verb of map-private
+static void forward_request(afb_req_t r, const char* verb) {
+    char *app_id;
+    json_object *args;
     afb::req req(r);
     args = req.json();
-    app_id = req.get_application_id();
+    app_id = get_caller_appid(req);
+    if(app_id == nullptr) {
+        req.fail("application id is not set");
+        return;
+    }
     json_object_object_add(args, _key_appid, json_object_new_string(app_id));
-    json_object_get(args); // +1 for reference to json_object
+    free(app_id);
+    // The trace follows the request down to map_created
+    TraceContext::begin().write(args);
+    json_object_get(args); // +1 for reference to json_object, released by afb::call
 
-    afb::callsync(_mp_prv_api, _verb_req_map, args, resp, error, info);
-    AFB_INFO("%s : %s", error, info);
-    AFB_INFO("%s", json_object_get_string(resp));
+    // Keep the request alive until map-private replies
+    req.addref();
+    _prv_calls.submit([r, args, verb]() {
+        afb::call(_mp_prv_api, verb, args, on_request_map_reply, r);
+    }, request_priority(args));
+}
 
-    req.success();
+/*
+ * Request a map surface for the caller.
+ * args may hold "priority": "foreground", "normal" (default) or "background"
+ * (or 0 to 2), the visible map should ask for foreground.
+ */
+static void request_map(afb_req_t r) {
+    AFB_DEBUG(__FUNCTION__);
+    forward_request(r, _verb_req_map);
+}
+
+/*
+ * Request several surfaces in one call.
+ * args: {"surfaces": [{}, ...]}, one empty object per wanted surface.
+ * reply: {"surfaces": [{"uuid", "surface"} or {"error"}, ...]} in the same order.
+ */
+static void request_maps(afb_req_t r) {
+    AFB_DEBUG(__FUNCTION__);
+    forward_request(r, _verb_req_maps);
+}
+
+/*
+ * Give a map back.
+ * args: {"uuid": map_surface of its map_created event}
+ */
+static void release_map(afb_req_t r) {
+    AFB_DEBUG(__FUNCTION__);
+    forward_request(r, _verb_release);
 }
 
 static void subscribe(afb_req_t r) {
     AFB_DEBUG(__FUNCTION__);
     afb::req req(r);
-    char* app_id = req.get_application_id();
-    if(_client_list.count(app_id) == 0) {
-        createSecurityContext(r, app_id);
-        shared_ptr<MapClient> client = std::make_shared<MapClient>(req);
-        _client_list[app_id] = client;
+    char* app_id = get_caller_appid(req);
+    if(app_id == nullptr) {
+        req.fail("application id is not set");
+        return;
+    }
+    // One registration per session, each session of the app gets map_created
+    if(createSecurityContext(r, app_id)) {
+        _clients.acquire(app_id, [&req]() {
+            return std::make_shared<MapClient>(req);
+        }, [&req](const shared_ptr<MapClient>& client) {
+            client->add_session(req);
+        });
+    }
+    free(app_id);
+    req.success();
+}
+
+static void on_stats_reply(void *closure, json_object *object, const char *error, const char *info, afb_api_t api) {
+    afb::req req(static_cast<afb_req_t>(closure));
+    json_object *j_stats, *j_stages, *j_prv_stages;
+
+    // Stages measured here, completed with the ones of map-private
+    j_stages = LatencyTracer::stats();
+    if(error == nullptr && json_object_object_get_ex(object, _key_stages, &j_prv_stages)) {
+        json_object_object_foreach(j_prv_stages, name, j_stage) {
+            json_object_object_add(j_stages, name, json_object_get(j_stage));
+        }
+    }
+    else {
+        AFB_WARNING("no stats from map-private: %s", error);
     }
-    if(app_id) {
-        free(app_id);
+    j_stats = json_object_new_object();
+    json_object_object_add(j_stats, _key_stages, j_stages);
+    // Admission and scheduler counters live in map-private only
+    if(error == nullptr && json_object_object_get_ex(object, _key_admission, &j_prv_stages)) {
+        json_object_object_add(j_stats, _key_admission, json_object_get(j_prv_stages));
     }
+    if(error == nullptr && json_object_object_get_ex(object, _key_scheduler, &j_prv_stages)) {
+        json_object_object_add(j_stats, _key_scheduler, json_object_get(j_prv_stages));
+    }
+    json_object_object_add(j_stats, "clients", json_object_new_int64(_clients.size()));
+    req.success(j_stats);
+    req.unref();
+}
+
+static void stats(afb_req_t r) {
+    AFB_DEBUG(__FUNCTION__);
+    afb::req req(r);
+    req.addref();
+    afb::call(_mp_prv_api, _verb_stats, json_object_new_object(), on_stats_reply, r);
 }
 
 static void on_map_created(const char* app, const char* uuid) {
     // Get client object
     AFB_DEBUG(__FUNCTION__);
-    auto client = _client_list[app];
+    shared_ptr<MapClient> client = _clients.find(app);
     if(client != nullptr) {
         json_object* resp = json_object_new_object();
         json_object_object_add(resp, _key_mp_sfc, json_object_new_string(uuid));
@@ -126,6 +258,10 @@ int preinit(afb_api_t api) {
 
 int init(afb_api_t api) {
     AFB_NOTICE(__FUNCTION__);
+    _prv_calls.set_max_inflight(env_unsigned(_env_max_inflight, _def_max_inflight));
+#ifdef MAP_SERVICE_BENCH_TRUST_APPID
+    AFB_WARNING("benchmark build, the appid argument is trusted");
+#endif
     return 0;
 }
 
@@ -133,7 +269,7 @@ void on_event(afb_api_t api, const char* event, struct json_object *object)
 {
     AFB_DEBUG(__FUNCTION__);
     AFB_INFO("%s, %s", event, json_object_get_string(object));
-    if(string(event).find(_ev_map_created) != string::npos)
+    if(strcmp(event, _ev_map_created) == 0)
     {
         json_object *juuid, *jappid;
         if(json_object_object_get_ex(object, _key_uuid, &juuid) &&
@@ -141,13 +277,22 @@ void on_event(afb_api_t api, const char* event, struct json_object *object)
             const char* appid = json_object_get_string(jappid);
             const char* surface_uuid = json_object_get_string(juuid);
             on_map_created(appid, surface_uuid);
+
+            TraceContext trace;
+            if(trace.read(object)) {
+                trace.stamp(TRACE_MAP_CREATED_DELIVERY);
+                LatencyTracer::record(TRACE_TOTAL, trace.last - trace.start);
+            }
         }
     }
 }
 
 const afb_verb_t verbs[] = {
     afb::verb("request_map", request_map, "request map with argument", AFB_SESSION_LOA_0),
+    afb::verb("request_maps", request_maps, "request several maps at once", AFB_SESSION_LOA_0),
+    afb::verb("release_map", release_map, "release a map", AFB_SESSION_LOA_0),
     afb::verb("subscribe", subscribe, "subscribe event", AFB_SESSION_LOA_0),
+    afb::verb(_verb_stats, stats, "latency of request_map stages", AFB_SESSION_LOA_0),
     afb::verbend()
 };
 
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "request-coalescer.h"
+#include <algorithm>
+#include <string.h>
+#include <json-c/json.h>
+
+static const char _key_appid[] = "appid";
+static const char _key_trace[] = "trace";
+
+RequestCoalescer::RequestCoalescer()
+    : ttl_ns(0)
+{
+}
+
+void RequestCoalescer::set_ttl(uint64_t ttl_ns) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->ttl_ns = ttl_ns;
+}
+
+RequestCoalescer::join_result RequestCoalescer::join(const std::string& key, afb_req_t req, uint64_t now_ns,
+                                                     std::string* uuid, int* surface) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = this->flights.find(key);
+    if(it != this->flights.end() && it->second.attached && this->ttl_ns != 0 &&
+       now_ns - it->second.attached_ns >= this->ttl_ns) {
+        // The renderer never provided the surface, don't hand out its uuid again
+        this->keys.erase(it->second.uuid);
+        this->flights.erase(it);
+        it = this->flights.end();
+    }
+    if(it == this->flights.end()) {
+        Flight& flight = this->flights[key];
+        flight.surface = -1;
+        flight.attached = false;
+        flight.attached_ns = 0;
+        flight.waiters.push_back(req);
+        return LEADER;
+    }
+    Flight& flight = it->second;
+    if(flight.attached) {
+        *uuid = flight.uuid;
+        *surface = flight.surface;
+        return ATTACHED;
+    }
+    flight.waiters.push_back(req);
+    return WAITING;
+}
+
+std::vector<afb_req_t> RequestCoalescer::resolve(const std::string& key, const char* uuid, int surface, uint64_t now_ns) {
+    std::vector<afb_req_t> waiters;
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = this->flights.find(key);
+    if(it == this->flights.end()) {
+        return waiters;
+    }
+    Flight& flight = it->second;
+    waiters.swap(flight.waiters);
+    flight.uuid = uuid;
+    flight.surface = surface;
+    flight.attached = true;
+    flight.attached_ns = now_ns;
+    this->keys[flight.uuid] = key;
+    return waiters;
+}
+
+std::vector<afb_req_t> RequestCoalescer::fail(const std::string& key) {
+    std::vector<afb_req_t> waiters;
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = this->flights.find(key);
+    if(it != this->flights.end()) {
+        waiters.swap(it->second.waiters);
+        this->flights.erase(it);
+    }
+    return waiters;
+}
+
+void RequestCoalescer::finish(const char* uuid) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = this->keys.find(uuid);
+    if(it == this->keys.end()) {
+        return;
+    }
+    this->flights.erase(it->second);
+    this->keys.erase(it);
+}
+
+std::string RequestCoalescer::make_key(const char* appid, json_object* args) {
+    std::vector<std::pair<const char*, const char*>> params;
+    if(args != nullptr && json_object_is_type(args, json_type_object)) {
+        json_object_object_foreach(args, k, v) {
+            // Identity and tracing of the caller are not request parameters
+            if(strcmp(k, _key_appid) != 0 && strcmp(k, _key_trace) != 0) {
+                params.emplace_back(k, json_object_to_json_string_ext(v, JSON_C_TO_STRING_PLAIN));
+            }
+        }
+    }
+    std::sort(params.begin(), params.end(),
+        [](const std::pair<const char*, const char*>& a, const std::pair<const char*, const char*>& b) {
+            return strcmp(a.first, b.first) < 0;
+        });
+
+    // appid and parameters are separated by characters json can't emit raw
+    std::string key(appid);
+    for(const auto& p : params) {
+        key += '\n';
+        key += p.first;
+        key += '\t';
+        key += p.second;
+    }
+    return key;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef REQUEST_COALESCER_H
+#define REQUEST_COALESCER_H
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#define AFB_BINDING_VERSION 3
+#include <afb/afb-binding>
+
+struct json_object;
+
+/*
+ * Joins concurrent identical request_map calls.
+ * Requests with the same appid and parameters share one window manager
+ * attach and one surface. The first caller leads the flight, the others wait
+ * on it; once the surface is attached, late joiners are answered at once
+ * until the renderer provides the surface. An attached flight whose surface
+ * is never provided expires after the ttl, the next caller leads a new one.
+ */
+class RequestCoalescer {
+  public:
+    enum join_result {
+        LEADER,   // caller must start the window manager call
+        WAITING,  // reply will come with resolve() or fail()
+        ATTACHED  // uuid and surface are already known
+    };
+
+    RequestCoalescer();
+    ~RequestCoalescer() = default;
+    RequestCoalescer(const RequestCoalescer &) = delete;
+    RequestCoalescer &operator=(const RequestCoalescer &) = delete;
+
+    // How long an attached flight is shared, 0 until its surface is provided
+    void set_ttl(uint64_t ttl_ns);
+    // req must hold a reference while it waits, it is handed back by resolve/fail
+    join_result join(const std::string& key, afb_req_t req, uint64_t now_ns, std::string* uuid, int* surface);
+    std::vector<afb_req_t> resolve(const std::string& key, const char* uuid, int surface, uint64_t now_ns);
+    std::vector<afb_req_t> fail(const std::string& key);
+    // The surface of uuid was provided or its request went back to the router
+    // queue, following requests start a new flight
+    void finish(const char* uuid);
+
+    // Key from appid and the request arguments, independent of their order
+    static std::string make_key(const char* appid, json_object* args);
+
+  private:
+    struct Flight {
+        std::vector<afb_req_t> waiters;
+        std::string uuid;
+        int surface;
+        bool attached;
+        uint64_t attached_ns;
+    };
+
+    std::mutex mtx;
+    uint64_t ttl_ns;
+    std::unordered_map<std::string, Flight> flights;
+    std::unordered_map<std::string, std::string> keys; // uuid -> flight key
+};
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef REQUEST_PRIORITY_H
+#define REQUEST_PRIORITY_H
+#include <deque>
+#include <string.h>
+#include <json-c/json.h>
+
+/*
+ * Priority class of a surface request, the visible map comes first.
+ * The caller gives it in the "priority" argument, either by name or as
+ * the class number; requests without one are PRIORITY_NORMAL.
+ */
+enum request_class {
+    PRIORITY_FOREGROUND = 0,
+    PRIORITY_NORMAL,
+    PRIORITY_BACKGROUND,
+    PRIORITY_CLASSES
+};
+
+static const char _key_priority[] = "priority";
+
+static inline request_class request_priority(json_object* args) {
+    json_object* j_prio;
+    if(!json_object_object_get_ex(args, _key_priority, &j_prio)) {
+        return PRIORITY_NORMAL;
+    }
+    if(json_object_is_type(j_prio, json_type_int)) {
+        int n = json_object_get_int(j_prio);
+        return (n >= 0 && n < PRIORITY_CLASSES) ? (request_class)n : PRIORITY_NORMAL;
+    }
+    const char* name = json_object_get_string(j_prio);
+    if(name == nullptr) {
+        return PRIORITY_NORMAL;
+    }
+    if(strcmp(name, "foreground") == 0) {
+        return PRIORITY_FOREGROUND;
+    }
+    if(strcmp(name, "background") == 0) {
+        return PRIORITY_BACKGROUND;
+    }
+    return PRIORITY_NORMAL;
+}
+
+/*
+ * FIFO per priority class. pop() takes from the highest class with entries,
+ * but a class passed over aging_limit times is served next so that a steady
+ * stream of foreground requests can't starve the others.
+ * Not thread safe, the owner holds its own lock.
+ */
+template <typename T>
+class ClassQueue {
+  public:
+    explicit ClassQueue(unsigned aging_limit = 4)
+        : aging_limit(aging_limit), skipped() {}
+
+    void push(request_class cls, T item) {
+        this->queues[cls].push_back(std::move(item));
+    }
+    // Put an entry back ahead of its class, e.g. when its consumer went away
+    void push_front(request_class cls, T item) {
+        this->queues[cls].push_front(std::move(item));
+    }
+    bool pop(T* out) {
+        int pick = -1;
+        for(int c = PRIORITY_NORMAL; c < PRIORITY_CLASSES; ++c) {
+            if(!this->queues[c].empty() && this->skipped[c] >= this->aging_limit) {
+                pick = c;
+                break;
+            }
+        }
+        if(pick < 0) {
+            for(int c = PRIORITY_FOREGROUND; c < PRIORITY_CLASSES; ++c) {
+                if(!this->queues[c].empty()) {
+                    pick = c;
+                    break;
+                }
+            }
+        }
+        if(pick < 0) {
+            return false;
+        }
+        for(int c = 0; c < PRIORITY_CLASSES; ++c) {
+            if(c == pick || this->queues[c].empty()) {
+                this->skipped[c] = 0;
+            }
+            else if(c > pick) {
+                ++this->skipped[c];
+            }
+        }
+        *out = std::move(this->queues[pick].front());
+        this->queues[pick].pop_front();
+        return true;
+    }
+    bool empty() const {
+        return this->size() == 0;
+    }
+    size_t size() const {
+        size_t n = 0;
+        for(const auto& q : this->queues) {
+            n += q.size();
+        }
+        return n;
+    }
+    size_t size(request_class cls) const {
+        return this->queues[cls].size();
+    }
+  private:
+    unsigned aging_limit;
+    unsigned skipped[PRIORITY_CLASSES];
+    std::deque<T> queues[PRIORITY_CLASSES];
+};
+
+#endif
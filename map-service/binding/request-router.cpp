@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "request-router.h"
+#include <algorithm>
+#include <time.h>
+#include <json-c/json.h>
+
+static const char _ev_new_request[] = "new_request";
+static const char _key_requests[] = "requests";
+static const char _key_surface[] = "surface";
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int surface_of(json_object* payload) {
+    json_object* j_surface;
+    if(!json_object_object_get_ex(payload, _key_surface, &j_surface)) {
+        return -1;
+    }
+    return json_object_get_int(j_surface);
+}
+
+RendererSession::RendererSession(afb::req req)
+    : pending(0)
+{
+    this->new_request = afb::make_event(_ev_new_request);
+    req.subscribe(this->new_request);
+}
+
+RendererSession::~RendererSession() {
+    this->new_request.unref();
+}
+
+void RendererSession::push(json_object* payload) {
+    this->new_request.push(payload);
+}
+
+RequestRouter::RequestRouter()
+    : window(0), timeout_ns(0)
+{
+}
+
+RequestRouter::~RequestRouter() {
+    for(auto& it : this->requests) {
+        json_object_put(it.second.payload);
+    }
+}
+
+void RequestRouter::set_window(unsigned window) {
+    send_list sends;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->window = window;
+        this->schedule(&sends);
+    }
+    for(auto& s : sends) {
+        s.first->push(s.second);
+    }
+}
+
+void RequestRouter::set_timeout(uint64_t timeout_ns) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->timeout_ns = timeout_ns;
+}
+
+RequestRouter::renderer_ptr RequestRouter::add_renderer(afb::req req) {
+    renderer_ptr renderer = std::make_shared<RendererSession>(req);
+    send_list sends;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->renderers.push_back(renderer);
+        // Hand over the requests which arrived while no renderer had room
+        this->schedule(&sends);
+    }
+    for(auto& s : sends) {
+        s.first->push(s.second);
+    }
+    return renderer;
+}
+
+void RequestRouter::remove_renderer(const RendererSession* renderer, std::vector<std::string>* requeued,
+                                    std::vector<std::string>* dropped) {
+    renderer_ptr removed;
+    send_list sends;
+    std::vector<json_object*> payloads;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        auto rit = std::find_if(this->renderers.begin(), this->renderers.end(),
+            [renderer](const renderer_ptr& r) { return r.get() == renderer; });
+        if(rit == this->renderers.end()) {
+            return;
+        }
+        removed = std::move(*rit);
+        this->renderers.erase(rit);
+
+        // Its surfaces are gone with it
+        for(auto it = this->live.begin(); it != this->live.end();) {
+            if(it->second.owner == renderer) {
+                it = this->live.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        // Requests of the leaving renderer go ahead of the waiting ones
+        for(auto it = this->requests.begin(); it != this->requests.end();) {
+            if(it->second.owner != renderer) {
+                ++it;
+                continue;
+            }
+            if(it->second.appid.empty()) {
+                if(dropped != nullptr) {
+                    dropped->push_back(it->first);
+                }
+                payloads.push_back(it->second.payload);
+                it = this->requests.erase(it);
+                continue;
+            }
+            it->second.owner = nullptr;
+            this->queue.push_front(it->second.cls, it->first);
+            if(requeued != nullptr) {
+                requeued->push_back(it->first);
+            }
+            ++it;
+        }
+        this->schedule(&sends);
+    }
+    for(json_object* payload : payloads) {
+        json_object_put(payload);
+    }
+    for(auto& s : sends) {
+        s.first->push(s.second);
+    }
+}
+
+RendererSession* RequestRouter::pick_renderer() {
+    // The least loaded renderer with room gets the request
+    RendererSession* best = nullptr;
+    for(const renderer_ptr& r : this->renderers) {
+        if(this->window != 0 && r->pending >= this->window) {
+            continue;
+        }
+        if(best == nullptr || r->pending < best->pending) {
+            best = r.get();
+        }
+    }
+    return best;
+}
+
+RequestRouter::renderer_ptr RequestRouter::shared(const RendererSession* renderer) const {
+    for(const renderer_ptr& r : this->renderers) {
+        if(r.get() == renderer) {
+            return r;
+        }
+    }
+    return renderer_ptr();
+}
+
+void RequestRouter::schedule(send_list* sends) {
+    std::string uuid;
+    uint64_t now = now_ns();
+    while(!this->queue.empty()) {
+        RendererSession* renderer = this->pick_renderer();
+        if(renderer == nullptr || !this->queue.pop(&uuid)) {
+            return;
+        }
+        auto it = this->requests.find(uuid);
+        if(it == this->requests.end() || it->second.owner != nullptr) {
+            continue;
+        }
+        it->second.owner = renderer;
+        it->second.sent_ns = now;
+        ++renderer->pending;
+        sends->emplace_back(this->shared(renderer), json_object_get(it->second.payload));
+    }
+}
+
+void RequestRouter::dispatch(const char* uuid, const char* appid, json_object* payload, request_class cls) {
+    send_list sends;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        auto res = this->requests.emplace(uuid, Pending{appid, nullptr, payload, cls, 0});
+        if(!res.second) {
+            // Window manager handed out the same uuid again, keep the first request
+            json_object_put(payload);
+            return;
+        }
+        if(this->renderers.empty()) {
+            AFB_WARNING("no renderer is running, %s is queued", uuid);
+        }
+        this->queue.push(cls, uuid);
+        this->schedule(&sends);
+    }
+    for(auto& s : sends) {
+        s.first->push(s.second);
+    }
+}
+
+void RequestRouter::dispatch_batch(const char* appid, const std::vector<std::pair<std::string, json_object*>>& items,
+                                   request_class cls) {
+    send_list sends;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        for(const auto& item : items) {
+            auto res = this->requests.emplace(item.first, Pending{appid, nullptr, item.second, cls, 0});
+            if(!res.second) {
+                json_object_put(item.second);
+                continue;
+            }
+            this->queue.push(cls, item.first);
+        }
+        this->schedule(&sends);
+    }
+
+    // Payloads of one renderer go out as one new_request event
+    std::vector<std::pair<renderer_ptr, json_object*>> events;
+    for(auto& s : sends) {
+        auto e = std::find_if(events.begin(), events.end(),
+            [&s](const std::pair<renderer_ptr, json_object*>& e) { return e.first == s.first; });
+        if(e == events.end()) {
+            events.emplace_back(s.first, json_object_new_array());
+            e = events.end() - 1;
+        }
+        json_object_array_add(e->second, s.second);
+    }
+    for(auto& e : events) {
+        json_object* j_event;
+        if(json_object_array_length(e.second) == 1) {
+            j_event = json_object_get(json_object_array_get_idx(e.second, 0));
+            json_object_put(e.second);
+        }
+        else {
+            j_event = json_object_new_object();
+            json_object_object_add(j_event, _key_requests, e.second);
+        }
+        e.first->push(j_event);
+    }
+}
+
+bool RequestRouter::push_to(const RendererSession* renderer, json_object* payload) {
+    renderer_ptr target;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        target = this->shared(renderer);
+    }
+    if(target == nullptr) {
+        json_object_put(payload);
+        return false;
+    }
+    target->push(payload);
+    return true;
+}
+
+bool RequestRouter::complete(const char* uuid, const RendererSession* from, std::string* appid) {
+    json_object* payload;
+    send_list sends;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        auto it = this->requests.find(uuid);
+        if(it == this->requests.end() || it->second.owner != from) {
+            return false;
+        }
+        payload = it->second.payload;
+        // Requests of no application are pool work, their surface is not in use
+        if(!it->second.appid.empty()) {
+            this->live[uuid] = Live{it->second.appid, from, surface_of(payload)};
+        }
+        if(appid != nullptr) {
+            *appid = std::move(it->second.appid);
+        }
+        for(const renderer_ptr& r : this->renderers) {
+            if(r.get() == from && r->pending > 0) {
+                --r->pending;
+                break;
+            }
+        }
+        this->requests.erase(it);
+        // The renderer has room for the next waiting request
+        this->schedule(&sends);
+    }
+    json_object_put(payload);
+    for(auto& s : sends) {
+        s.first->push(s.second);
+    }
+    return true;
+}
+
+void RequestRouter::adopt(const char* uuid, const char* appid, const RendererSession* renderer, int surface) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->live[uuid] = Live{appid, renderer, surface};
+}
+
+std::vector<RequestRouter::Surface> RequestRouter::release(const char* appid, const char* uuid) {
+    std::vector<Surface> released;
+    std::vector<json_object*> payloads;
+    send_list sends;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        for(auto it = this->live.begin(); it != this->live.end();) {
+            if(it->second.appid == appid && (uuid == nullptr || it->first == uuid)) {
+                released.push_back(Surface{it->first, it->second.owner, it->second.surface});
+                it = this->live.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        for(auto it = this->requests.begin(); it != this->requests.end();) {
+            if(it->second.appid != appid || (uuid != nullptr && it->first != uuid)) {
+                ++it;
+                continue;
+            }
+            // A renderer that got the request may have created the surface
+            RendererSession* owner = it->second.owner;
+            if(owner != nullptr) {
+                released.push_back(Surface{it->first, owner, surface_of(it->second.payload)});
+                if(owner->pending > 0) {
+                    --owner->pending;
+                }
+            }
+            // A queued uuid left in the queue is skipped by schedule()
+            payloads.push_back(it->second.payload);
+            it = this->requests.erase(it);
+        }
+        this->schedule(&sends);
+    }
+    for(json_object* payload : payloads) {
+        json_object_put(payload);
+    }
+    for(auto& s : sends) {
+        s.first->push(s.second);
+    }
+    return released;
+}
+
+std::vector<RequestRouter::Surface> RequestRouter::expire() {
+    std::vector<Surface> expired;
+    std::vector<json_object*> payloads;
+    send_list sends;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        if(this->timeout_ns == 0) {
+            return expired;
+        }
+        uint64_t now = now_ns();
+        for(auto it = this->requests.begin(); it != this->requests.end();) {
+            RendererSession* owner = it->second.owner;
+            if(owner == nullptr || now - it->second.sent_ns < this->timeout_ns) {
+                ++it;
+                continue;
+            }
+            expired.push_back(Surface{it->first, owner, surface_of(it->second.payload)});
+            if(owner->pending > 0) {
+                --owner->pending;
+            }
+            payloads.push_back(it->second.payload);
+            it = this->requests.erase(it);
+        }
+        // The freed slots take the next waiting requests
+        this->schedule(&sends);
+    }
+    for(json_object* payload : payloads) {
+        json_object_put(payload);
+    }
+    for(auto& s : sends) {
+        s.first->push(s.second);
+    }
+    return expired;
+}
+
+size_t RequestRouter::pending() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->requests.size();
+}
+
+size_t RequestRouter::waiting() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->queue.size();
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef REQUEST_ROUTER_H
+#define REQUEST_ROUTER_H
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "request-priority.h"
+#define AFB_BINDING_VERSION 3
+#include <afb/afb-binding>
+
+struct json_object;
+
+/*
+ * A UI process which called start_service.
+ * Each renderer gets its own new_request event so that a request is only
+ * delivered to the renderer that owns it.
+ */
+class RendererSession {
+  public:
+    RendererSession(afb::req req);
+    ~RendererSession();
+    void push(json_object* payload);
+    unsigned pending;
+    afb::event new_request;
+};
+
+/*
+ * Routes surface requests of map-private.
+ * Every pending request is keyed by its uuid and remembers its appid and the
+ * renderer it was handed to; provide_surface is only accepted from that
+ * renderer and completes the request exactly once. The surface of a
+ * completed request stays recorded until its application releases it.
+ * A renderer is given at most window requests at a time, the others wait
+ * in their priority class so that a foreground request overtakes queued
+ * background work instead of sitting behind it in the event stream.
+ * A request its renderer does not answer within the timeout is dropped
+ * by expire() and frees its slot.
+ */
+class RequestRouter {
+  public:
+    using renderer_ptr = std::shared_ptr<RendererSession>;
+
+    // A surface some renderer holds for an application
+    struct Surface {
+        std::string uuid;
+        const RendererSession* renderer;
+        int surface;
+    };
+
+    RequestRouter();
+    ~RequestRouter();
+    RequestRouter(const RequestRouter &) = delete;
+    RequestRouter &operator=(const RequestRouter &) = delete;
+
+    renderer_ptr add_renderer(afb::req req);
+    // Requests of renderer go back to the queue, their uuids are added to
+    // requeued. Those of no application (pool work) are dropped instead
+    void remove_renderer(const RendererSession* renderer, std::vector<std::string>* requeued = nullptr,
+                         std::vector<std::string>* dropped = nullptr);
+
+    // Requests handed to one renderer at a time, 0 for no limit
+    void set_window(unsigned window);
+    // How long a renderer has to answer a request, 0 for no limit
+    void set_timeout(uint64_t timeout_ns);
+    // Record a request and push payload (ownership taken) to a renderer
+    void dispatch(const char* uuid, const char* appid, json_object* payload,
+                  request_class cls = PRIORITY_NORMAL);
+    // Record every (uuid, payload) of items like dispatch(); what a renderer
+    // gets of them at once is pushed as one event
+    void dispatch_batch(const char* appid, const std::vector<std::pair<std::string, json_object*>>& items,
+                        request_class cls = PRIORITY_NORMAL);
+    // Push payload (ownership taken) to one renderer without recording it
+    bool push_to(const RendererSession* renderer, json_object* payload);
+    // Complete a request; fails when uuid is unknown or owned by another renderer
+    bool complete(const char* uuid, const RendererSession* from, std::string* appid);
+    // Record a surface that was handed over without a request, a pooled one
+    void adopt(const char* uuid, const char* appid, const RendererSession* renderer, int surface);
+    // Forget the surfaces of appid, only the one of uuid unless it is null.
+    // Requests still pending are cancelled, the returned surfaces (those a
+    // renderer may have created) are for the caller to destroy
+    std::vector<Surface> release(const char* appid, const char* uuid);
+    // Drop the requests their renderer did not answer in time, the returned
+    // surfaces may have been created and are for the caller to destroy
+    std::vector<Surface> expire();
+    size_t pending() const;
+    size_t waiting() const;
+
+  private:
+    struct Pending {
+        std::string appid;
+        RendererSession* owner;
+        json_object* payload; // kept until completion to replay on reassignment
+        request_class cls;
+        uint64_t sent_ns; // when owner got it
+    };
+    struct Live {
+        std::string appid;
+        const RendererSession* owner;
+        int surface;
+    };
+    using send_list = std::vector<std::pair<renderer_ptr, json_object*>>;
+
+    RendererSession* pick_renderer();
+    renderer_ptr shared(const RendererSession* renderer) const;
+    // Hand waiting requests to renderers with room, sends are done unlocked
+    void schedule(send_list* sends);
+
+    mutable std::mutex mtx;
+    std::vector<renderer_ptr> renderers;
+    std::unordered_map<std::string, Pending> requests;
+    std::unordered_map<std::string, Live> live; // completed, by uuid
+    ClassQueue<std::string> queue; // uuids waiting for a renderer
+    unsigned window;
+    uint64_t timeout_ns;
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "surface-pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+static const char _token_prefix[] = "pool-";
+
+SurfacePool::SurfacePool()
+    : target(0), pressure(false), hits(0), misses(0)
+{
+}
+
+void SurfacePool::configure(unsigned size, int id_base, unsigned id_count) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->target = size;
+    this->free_ids.clear();
+    // Lowest ids are handed out first
+    for(unsigned i = 0; i < id_count; ++i) {
+        this->free_ids.push_back(id_base + (int)i);
+    }
+}
+
+std::vector<int> SurfacePool::reserve() {
+    std::vector<int> ids;
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if(this->pressure) {
+        return ids;
+    }
+    while(this->idle.size() + this->preparing.size() < this->target && !this->free_ids.empty()) {
+        ids.push_back(this->free_ids.front());
+        this->preparing.push_back(this->free_ids.front());
+        this->free_ids.pop_front();
+    }
+    return ids;
+}
+
+void SurfacePool::ready(int id, const RendererSession* renderer) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = std::find(this->preparing.begin(), this->preparing.end(), id);
+    if(it == this->preparing.end()) {
+        return;
+    }
+    this->preparing.erase(it);
+    this->idle.push_back(Surface{id, renderer});
+}
+
+void SurfacePool::cancel(int id) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = std::find(this->preparing.begin(), this->preparing.end(), id);
+    if(it == this->preparing.end()) {
+        return;
+    }
+    this->preparing.erase(it);
+    this->free_ids.push_back(id);
+}
+
+bool SurfacePool::take(Surface* out) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if(this->idle.empty()) {
+        ++this->misses;
+        return false;
+    }
+    // Take the most recently prepared one, its buffers are the warmest
+    *out = this->idle.back();
+    this->idle.pop_back();
+    this->taken.push_back(*out);
+    ++this->hits;
+    return true;
+}
+
+void SurfacePool::put_back(const Surface& surface) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = std::find_if(this->taken.begin(), this->taken.end(),
+        [&surface](const Surface& s) { return s.id == surface.id; });
+    if(it == this->taken.end()) {
+        return;
+    }
+    this->taken.erase(it);
+    this->idle.push_back(surface);
+}
+
+void SurfacePool::release(int id) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = std::find_if(this->taken.begin(), this->taken.end(),
+        [id](const Surface& s) { return s.id == id; });
+    if(it == this->taken.end()) {
+        return;
+    }
+    this->taken.erase(it);
+    this->free_ids.push_back(id);
+}
+
+void SurfacePool::keep(int id) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = std::find_if(this->taken.begin(), this->taken.end(),
+        [id](const Surface& s) { return s.id == id; });
+    if(it != this->taken.end()) {
+        it->renderer = nullptr;
+        return;
+    }
+    // Its renderer was dropped already
+    auto fit = std::find(this->free_ids.begin(), this->free_ids.end(), id);
+    if(fit != this->free_ids.end()) {
+        this->free_ids.erase(fit);
+        this->taken.push_back(Surface{id, nullptr});
+    }
+}
+
+void SurfacePool::drop_renderer(const RendererSession* renderer) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto gone = [renderer](const Surface& s) { return s.renderer == renderer; };
+    auto it = std::remove_if(this->idle.begin(), this->idle.end(), gone);
+    for(auto i = it; i != this->idle.end(); ++i) {
+        this->free_ids.push_back(i->id);
+    }
+    this->idle.erase(it, this->idle.end());
+    auto tit = std::remove_if(this->taken.begin(), this->taken.end(), gone);
+    for(auto i = tit; i != this->taken.end(); ++i) {
+        this->free_ids.push_back(i->id);
+    }
+    this->taken.erase(tit, this->taken.end());
+}
+
+std::vector<SurfacePool::Surface> SurfacePool::trim(unsigned keep) {
+    std::vector<Surface> released;
+    std::lock_guard<std::mutex> lock(this->mtx);
+    while(this->idle.size() > keep) {
+        // The oldest idle surfaces go first
+        released.push_back(this->idle.front());
+        this->free_ids.push_back(this->idle.front().id);
+        this->idle.pop_front();
+    }
+    return released;
+}
+
+void SurfacePool::set_pressure(bool pressure) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->pressure = pressure;
+}
+
+unsigned SurfacePool::idle_count() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->idle.size();
+}
+
+unsigned SurfacePool::preparing_count() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->preparing.size();
+}
+
+unsigned SurfacePool::taken_count() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->taken.size();
+}
+
+unsigned SurfacePool::free_count() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->free_ids.size();
+}
+
+unsigned long SurfacePool::hit_count() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->hits;
+}
+
+unsigned long SurfacePool::miss_count() const {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->misses;
+}
+
+std::string SurfacePool::token(int id) {
+    return _token_prefix + std::to_string(id);
+}
+
+bool SurfacePool::parse_token(const char* uuid, int* id) {
+    size_t len = sizeof(_token_prefix) - 1;
+    if(uuid == nullptr || strncmp(uuid, _token_prefix, len) != 0) {
+        return false;
+    }
+    char* end;
+    long n = strtol(uuid + len, &end, 10);
+    if(end == uuid + len || *end != '\0') {
+        return false;
+    }
+    *id = (int)n;
+    return true;
+}
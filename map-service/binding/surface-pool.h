@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SURFACE_POOL_H
+#define SURFACE_POOL_H
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class RendererSession;
+
+/*
+ * Surfaces the renderer has created ahead of any request_map.
+ * map-private hands out ivi surface ids from its own range, asks a renderer
+ * to prepare them and keeps the ready ones idle. A request that takes one
+ * only needs the window manager attach before map_created.
+ * Every id of the range is free, preparing, idle or taken; it goes back to
+ * the free ones when its surface is released or its renderer goes away.
+ */
+class SurfacePool {
+  public:
+    struct Surface {
+        int id;
+        const RendererSession* renderer;
+    };
+
+    SurfacePool();
+    ~SurfacePool() = default;
+    SurfacePool(const SurfacePool &) = delete;
+    SurfacePool &operator=(const SurfacePool &) = delete;
+
+    void configure(unsigned size, int id_base, unsigned id_count);
+    // Reserve ids for the surfaces missing to reach the configured size
+    std::vector<int> reserve();
+    void ready(int id, const RendererSession* renderer);
+    // The prepare request of id was dropped, no surface will come
+    void cancel(int id);
+    bool take(Surface* out);
+    void put_back(const Surface& surface);
+    // The application gave back the taken surface id, ids the pool did not
+    // hand out are ignored
+    void release(int id);
+    // The taken id outlives its renderer, another one creates the surface
+    void keep(int id);
+    // Surfaces of a renderer which went away are gone with it
+    void drop_renderer(const RendererSession* renderer);
+    // Release idle surfaces down to keep, the renderer has to destroy them
+    std::vector<Surface> trim(unsigned keep);
+    // No refill while the system is short of memory
+    void set_pressure(bool pressure);
+
+    unsigned idle_count() const;
+    unsigned preparing_count() const;
+    unsigned taken_count() const;
+    unsigned free_count() const;
+    unsigned long hit_count() const;
+    unsigned long miss_count() const;
+
+    // The uuid a renderer answers a prepare request with
+    static std::string token(int id);
+    static bool parse_token(const char* uuid, int* id);
+
+  private:
+    mutable std::mutex mtx;
+    unsigned target;
+    bool pressure;
+    unsigned long hits;
+    unsigned long misses;
+    std::vector<int> preparing;
+    std::deque<Surface> idle;
+    std::vector<Surface> taken;
+    // Oldest freed first, a renderer may still be destroying a recent one
+    std::deque<int> free_ids;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <string>
+#include "request-priority.h"
+
+/* Items are "<class letter><sequence>", F foreground, N normal, B background */
+static std::string drain(ClassQueue<std::string>& q) {
+    std::string order, item;
+    while(q.pop(&item)) {
+        order += item[0];
+    }
+    return order;
+}
+
+static void fill(ClassQueue<std::string>& q, request_class cls, char name, int n) {
+    for(int i = 0; i < n; ++i) {
+        q.push(cls, std::string(1, name) + std::to_string(i));
+    }
+}
+
+static void test_fifo_within_class() {
+    ClassQueue<std::string> q;
+    std::string item;
+    assert(!q.pop(&item));
+    fill(q, PRIORITY_NORMAL, 'N', 3);
+    q.push_front(PRIORITY_NORMAL, "N-1");
+    assert(q.size() == 4 && q.size(PRIORITY_NORMAL) == 4);
+    const char* expect[] = {"N-1", "N0", "N1", "N2"};
+    for(const char* e : expect) {
+        assert(q.pop(&item) && item == e);
+    }
+    assert(q.empty());
+}
+
+static void test_strict_priority_without_contention() {
+    ClassQueue<std::string> q(100);
+    fill(q, PRIORITY_BACKGROUND, 'B', 2);
+    fill(q, PRIORITY_NORMAL, 'N', 2);
+    fill(q, PRIORITY_FOREGROUND, 'F', 2);
+    assert(drain(q) == "FFNNBB");
+}
+
+// A class passed over aging_limit times is served next
+static void test_aging_serves_starved_classes() {
+    ClassQueue<std::string> q(2);
+    fill(q, PRIORITY_FOREGROUND, 'F', 10);
+    fill(q, PRIORITY_NORMAL, 'N', 3);
+    fill(q, PRIORITY_BACKGROUND, 'B', 3);
+    assert(drain(q) == "FFNBFFNBFFNBFFFF");
+}
+
+// Skips only count while the class is waiting
+static void test_empty_class_does_not_age() {
+    ClassQueue<std::string> q(2);
+    fill(q, PRIORITY_FOREGROUND, 'F', 8);
+    std::string item;
+    for(int i = 0; i < 5; ++i) {
+        assert(q.pop(&item) && item[0] == 'F');
+    }
+    fill(q, PRIORITY_NORMAL, 'N', 1);
+    assert(drain(q) == "FFNF");
+}
+
+int main() {
+    test_fifo_within_class();
+    test_strict_priority_without_contention();
+    test_aging_serves_starved_classes();
+    test_empty_class_does_not_age();
+    printf("class-queue: ok\n");
+    return 0;
+}
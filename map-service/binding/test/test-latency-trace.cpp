@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <thread>
+#include <json-c/json.h>
+#include "latency-trace.h"
+
+/* The histograms are process wide, every test records into its own stage */
+
+static json_object* stage_stats(json_object* stats, trace_stage stage) {
+    json_object* j_stage = nullptr;
+    json_object_object_get_ex(stats, LatencyTracer::stage_name(stage), &j_stage);
+    return j_stage;
+}
+
+static double value(json_object* j_stage, const char* key) {
+    json_object* j_val;
+    assert(json_object_object_get_ex(j_stage, key, &j_val));
+    return json_object_get_double(j_val);
+}
+
+static int64_t count(json_object* j_stage) {
+    json_object* j_val;
+    assert(json_object_object_get_ex(j_stage, "count", &j_val));
+    return json_object_get_int64(j_val);
+}
+
+// Small values have a bucket each
+static void test_exact_below_16ns() {
+    for(int i = 0; i < 100; ++i) {
+        LatencyTracer::record(TRACE_ATTACH_QUEUE, 5);
+    }
+    LatencyTracer::record(TRACE_ATTACH_QUEUE, 15);
+    json_object* stats = LatencyTracer::stats();
+    json_object* j_stage = stage_stats(stats, TRACE_ATTACH_QUEUE);
+    assert(j_stage != nullptr);
+    assert(count(j_stage) == 101);
+    assert(value(j_stage, "p50_us") == 5 / 1000.0);
+    assert(value(j_stage, "p99_us") == 5 / 1000.0);
+    assert(value(j_stage, "max_us") == 15 / 1000.0);
+    json_object_put(stats);
+}
+
+// A percentile is the upper bound of its bucket, at most 12.5% above
+static void test_log_linear_resolution() {
+    for(uint64_t us = 1; us <= 1000; ++us) {
+        LatencyTracer::record(TRACE_WM_ATTACH, us * 1000);
+    }
+    json_object* stats = LatencyTracer::stats();
+    json_object* j_stage = stage_stats(stats, TRACE_WM_ATTACH);
+    assert(count(j_stage) == 1000);
+    double p50 = value(j_stage, "p50_us"), p90 = value(j_stage, "p90_us");
+    double p99 = value(j_stage, "p99_us"), max = value(j_stage, "max_us");
+    assert(p50 >= 500 && p50 <= 500 * 1.125);
+    assert(p90 >= 900 && p90 <= 1000);
+    assert(p99 >= 990 && p99 <= 1000);
+    assert(max == 1000);
+    assert(p50 <= p90 && p90 <= p99 && p99 <= max);
+    json_object_put(stats);
+}
+
+// Each power of two is split in 8 buckets, the bounds of one are exact
+static void test_bucket_bounds() {
+    // 1024..1151ns share a bucket, 1152 starts the next one
+    LatencyTracer::record(TRACE_PROVIDE_DELIVERY, 1024);
+    LatencyTracer::record(TRACE_PROVIDE_DELIVERY, 1152);
+    LatencyTracer::record(TRACE_PROVIDE_DELIVERY, 100000);
+    json_object* stats = LatencyTracer::stats();
+    json_object* j_stage = stage_stats(stats, TRACE_PROVIDE_DELIVERY);
+    assert(value(j_stage, "p50_us") == 1279 / 1000.0);
+    json_object_put(stats);
+
+    LatencyTracer::record(TRACE_RENDERER_DELIVERY, 1024);
+    LatencyTracer::record(TRACE_RENDERER_DELIVERY, 1151);
+    LatencyTracer::record(TRACE_RENDERER_DELIVERY, 100000);
+    stats = LatencyTracer::stats();
+    j_stage = stage_stats(stats, TRACE_RENDERER_DELIVERY);
+    assert(value(j_stage, "p50_us") == 1151 / 1000.0);
+    json_object_put(stats);
+}
+
+// Beyond 2^40ns everything lands in the last bucket, the max stays exact
+static void test_overflow_bucket() {
+    const uint64_t huge = 1ULL << 50;
+    LatencyTracer::record(TRACE_SURFACE_CREATE, huge);
+    json_object* stats = LatencyTracer::stats();
+    json_object* j_stage = stage_stats(stats, TRACE_SURFACE_CREATE);
+    assert(value(j_stage, "max_us") == huge / 1000.0);
+    assert(value(j_stage, "p50_us") >= (1ULL << 40) / 1000.0);
+    assert(value(j_stage, "p50_us") <= huge / 1000.0);
+    json_object_put(stats);
+}
+
+// Buffers of every thread are folded, also those of exited threads
+static void test_threads_folded() {
+    std::thread t([] {
+        for(int i = 0; i < 10; ++i) {
+            LatencyTracer::record(TRACE_MAP_CREATED_DELIVERY, 2000);
+        }
+    });
+    t.join();
+    for(int i = 0; i < 10; ++i) {
+        LatencyTracer::record(TRACE_MAP_CREATED_DELIVERY, 4000);
+    }
+    json_object* stats = LatencyTracer::stats();
+    json_object* j_stage = stage_stats(stats, TRACE_MAP_CREATED_DELIVERY);
+    assert(count(j_stage) == 20);
+    assert(value(j_stage, "max_us") == 4);
+    json_object_put(stats);
+}
+
+// Stages nothing was recorded for are left out
+static void test_empty_stage_absent() {
+    json_object* stats = LatencyTracer::stats();
+    assert(stage_stats(stats, TRACE_PUBLIC_TO_PRIVATE) == nullptr);
+    json_object_put(stats);
+}
+
+// A stamp records the time since the previous one, a clock going back as 0
+static void test_stamp() {
+    TraceContext ctxt;
+    ctxt.stamp(TRACE_TOTAL, 1000); // not started, nothing recorded
+    ctxt.id = 1;
+    ctxt.last = 1000;
+    ctxt.stamp(TRACE_TOTAL, 3000);
+    assert(ctxt.last == 3000);
+    ctxt.stamp(TRACE_TOTAL, 2000);
+    json_object* stats = LatencyTracer::stats();
+    json_object* j_stage = stage_stats(stats, TRACE_TOTAL);
+    assert(count(j_stage) == 2);
+    assert(value(j_stage, "max_us") == 2);
+    json_object_put(stats);
+}
+
+int main() {
+    test_empty_stage_absent();
+    test_exact_below_16ns();
+    test_log_linear_resolution();
+    test_bucket_bounds();
+    test_overflow_bucket();
+    test_threads_folded();
+    test_stamp();
+    printf("latency-trace: ok\n");
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include "surface-pool.h"
+
+static const int _id_base = 100;
+static const unsigned _id_count = 8;
+
+/* Only compared, never dereferenced by the pool */
+static const RendererSession* renderer(int n) {
+    static char sessions[4];
+    return reinterpret_cast<const RendererSession*>(&sessions[n]);
+}
+
+// Every id of the range is in exactly one state
+static void check_ids(const SurfacePool& pool) {
+    assert(pool.free_count() + pool.preparing_count() + pool.idle_count() +
+           pool.taken_count() == _id_count);
+}
+
+static void test_reserve_ready_take() {
+    SurfacePool pool;
+    pool.configure(3, _id_base, _id_count);
+    std::vector<int> ids = pool.reserve();
+    assert(ids.size() == 3);
+    assert(ids[0] == _id_base && ids[1] == _id_base + 1 && ids[2] == _id_base + 2);
+    assert(pool.preparing_count() == 3);
+    // Already at size, preparing ones count
+    assert(pool.reserve().empty());
+    check_ids(pool);
+
+    pool.ready(ids[0], renderer(0));
+    pool.ready(ids[1], renderer(0));
+    pool.ready(_id_base + 7, renderer(0)); // never reserved
+    assert(pool.idle_count() == 2 && pool.preparing_count() == 1);
+    check_ids(pool);
+
+    SurfacePool::Surface s;
+    assert(pool.take(&s));
+    assert(s.id == ids[1] && s.renderer == renderer(0));
+    assert(pool.taken_count() == 1 && pool.hit_count() == 1);
+    check_ids(pool);
+
+    // Refill covers the taken one only
+    std::vector<int> refill = pool.reserve();
+    assert(refill.size() == 1 && refill[0] == _id_base + 3);
+    check_ids(pool);
+}
+
+static void test_release_returns_id() {
+    SurfacePool pool;
+    pool.configure(1, _id_base, _id_count);
+    int id = pool.reserve()[0];
+    pool.ready(id, renderer(0));
+    SurfacePool::Surface s;
+    assert(pool.take(&s));
+    assert(!pool.take(&s));
+    assert(pool.miss_count() == 1);
+
+    pool.release(_id_base + 5); // not handed out
+    assert(pool.taken_count() == 1);
+    pool.release(id);
+    pool.release(id); // twice is ignored
+    assert(pool.taken_count() == 0 && pool.free_count() == _id_count);
+    check_ids(pool);
+
+    // Oldest freed id first, the released one comes last
+    std::vector<int> ids = pool.reserve();
+    assert(ids.size() == 1 && ids[0] == _id_base + 1);
+}
+
+static void test_put_back_and_cancel() {
+    SurfacePool pool;
+    pool.configure(2, _id_base, _id_count);
+    std::vector<int> ids = pool.reserve();
+    pool.cancel(ids[0]);
+    pool.cancel(ids[0]);
+    assert(pool.preparing_count() == 1 && pool.free_count() == _id_count - 1);
+    check_ids(pool);
+
+    pool.ready(ids[1], renderer(1));
+    SurfacePool::Surface s;
+    assert(pool.take(&s));
+    pool.put_back(s);
+    pool.put_back(s); // no longer taken
+    assert(pool.idle_count() == 1 && pool.taken_count() == 0);
+    check_ids(pool);
+}
+
+static void test_drop_renderer_and_keep() {
+    SurfacePool pool;
+    pool.configure(4, _id_base, _id_count);
+    std::vector<int> ids = pool.reserve();
+    pool.ready(ids[0], renderer(0));
+    pool.ready(ids[1], renderer(0));
+    pool.ready(ids[2], renderer(1));
+    SurfacePool::Surface taken;
+    assert(pool.take(&taken));
+    assert(taken.renderer == renderer(1));
+    assert(pool.take(&taken));
+    assert(taken.renderer == renderer(0));
+
+    // The idle and the taken surface of renderer 0 go back to the free ids
+    pool.drop_renderer(renderer(0));
+    assert(pool.idle_count() == 0 && pool.taken_count() == 1);
+    check_ids(pool);
+
+    // The application still shows it, another renderer recreates it
+    pool.keep(taken.id);
+    assert(pool.taken_count() == 2);
+    check_ids(pool);
+    pool.drop_renderer(renderer(0));
+    assert(pool.taken_count() == 2);
+    pool.release(taken.id);
+    assert(pool.taken_count() == 1);
+    check_ids(pool);
+}
+
+static void test_trim_and_pressure() {
+    SurfacePool pool;
+    pool.configure(4, _id_base, _id_count);
+    for(int id : pool.reserve()) {
+        pool.ready(id, renderer(0));
+    }
+    std::vector<SurfacePool::Surface> released = pool.trim(1);
+    assert(released.size() == 3);
+    assert(released[0].id == _id_base); // oldest first
+    assert(pool.idle_count() == 1);
+    check_ids(pool);
+
+    pool.set_pressure(true);
+    assert(pool.reserve().empty());
+    pool.set_pressure(false);
+    assert(pool.reserve().size() == 3);
+    check_ids(pool);
+}
+
+static void test_token() {
+    int id = 0;
+    assert(SurfacePool::parse_token(SurfacePool::token(42).c_str(), &id) && id == 42);
+    assert(!SurfacePool::parse_token("pool-", &id));
+    assert(!SurfacePool::parse_token("pool-4x", &id));
+    assert(!SurfacePool::parse_token("map-4", &id));
+    assert(!SurfacePool::parse_token(nullptr, &id));
+}
+
+int main() {
+    test_reserve_ready_take();
+    test_release_returns_id();
+    test_put_back_and_cancel();
+    test_drop_renderer_and_keep();
+    test_trim_and_pressure();
+    test_token();
+    printf("surface-pool: ok\n");
+    return 0;
+}
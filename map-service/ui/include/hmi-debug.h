@@ -17,11 +17,7 @@
 #ifndef __HMI_DEBUG_H__
 #define __HMI_DEBUG_H__
 
-#include <time.h>
-#include <stdio.h>
-#include <stdarg.h>
 #include <string.h>
-#include <stdlib.h>
 
 enum LOG_LEVEL{
     LOG_LEVEL_NONE = 0,
@@ -33,38 +29,42 @@ enum LOG_LEVEL{
     LOG_LEVEL_MAX = LOG_LEVEL_DEBUG
 };
 
-#define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
-
-#define HMI_ERROR(prefix, args,...) _HMI_LOG(LOG_LEVEL_ERROR, __FILENAME__, __FUNCTION__, __LINE__, prefix, args, ##__VA_ARGS__)
-#define HMI_WARNING(prefix, args,...) _HMI_LOG(LOG_LEVEL_WARNING, __FILENAME__, __FUNCTION__,__LINE__, prefix, args,##__VA_ARGS__)
-#define HMI_NOTICE(prefix, args,...) _HMI_LOG(LOG_LEVEL_NOTICE, __FILENAME__, __FUNCTION__,__LINE__, prefix, args,##__VA_ARGS__)
-#define HMI_INFO(prefix, args,...)  _HMI_LOG(LOG_LEVEL_INFO, __FILENAME__, __FUNCTION__,__LINE__, prefix, args,##__VA_ARGS__)
-#define HMI_DEBUG(prefix, args,...) _HMI_LOG(LOG_LEVEL_DEBUG, __FILENAME__, __FUNCTION__,__LINE__, prefix, args,##__VA_ARGS__)
+/*
+ * Levels above this are compiled out, e.g. -DHMI_LOG_COMPILED_LEVEL=2
+ * keeps errors and warnings only.
+ */
+#ifndef HMI_LOG_COMPILED_LEVEL
+#define HMI_LOG_COMPILED_LEVEL LOG_LEVEL_MAX
+#endif
 
-static char ERROR_FLAG[6][20] = {"NONE", "ERROR", "WARNING", "NOTICE", "INFO", "DEBUG"};
+#define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 
-static void _HMI_LOG(enum LOG_LEVEL level, const char* file, const char* func, const int line, const char* prefix, const char* log, ...)
-{
-    const int log_level = (getenv("USE_HMI_DEBUG") == NULL)?LOG_LEVEL_ERROR:atoi(getenv("USE_HMI_DEBUG"));
-    if(log_level < level)
-    {
-        return;
-    }
+#define _HMI_LOG_AT(level, prefix, args, ...) \
+    do { \
+        if ((level) <= HMI_LOG_COMPILED_LEVEL && (level) <= hmi_log_level()) \
+            _HMI_LOG(level, __FILENAME__, __FUNCTION__, __LINE__, prefix, args, ##__VA_ARGS__); \
+    } while (0)
 
-    char *message;
-    struct timespec tp;
-    unsigned int time;
+#define HMI_ERROR(prefix, args,...) _HMI_LOG_AT(LOG_LEVEL_ERROR, prefix, args, ##__VA_ARGS__)
+#define HMI_WARNING(prefix, args,...) _HMI_LOG_AT(LOG_LEVEL_WARNING, prefix, args, ##__VA_ARGS__)
+#define HMI_NOTICE(prefix, args,...) _HMI_LOG_AT(LOG_LEVEL_NOTICE, prefix, args, ##__VA_ARGS__)
+#define HMI_INFO(prefix, args,...)  _HMI_LOG_AT(LOG_LEVEL_INFO, prefix, args, ##__VA_ARGS__)
+#define HMI_DEBUG(prefix, args,...) _HMI_LOG_AT(LOG_LEVEL_DEBUG, prefix, args, ##__VA_ARGS__)
 
-    clock_gettime(CLOCK_REALTIME, &tp);
-	time = (tp.tv_sec * 1000000L) + (tp.tv_nsec / 1000);
+/*
+ * Level of USE_HMI_DEBUG (ERROR when unset), read at the first log.
+ * Records keep the format and a copy of the arguments in a ring of the
+ * calling thread. A background thread formats them to stderr, or writes
+ * them unformatted to the binary file named by HMI_LOG_BINARY.
+ * A full ring drops the record, logging never blocks the caller.
+ * file, func, prefix and the format must be string literals or otherwise
+ * static; string arguments are copied.
+ */
+int hmi_log_level(void);
 
-	va_list args;
-	va_start(args, log);
-	if (log == NULL || vasprintf(&message, log, args) < 0)
-        message = NULL;
-    fprintf(stderr,  "[%10.3f] [%s %s] [%s, %s(), Line:%d] >>> %s \n", time / 1000.0, prefix, ERROR_FLAG[level], file, func, line, message);
-    va_end(args);
-	free(message);
-}
+void _HMI_LOG(enum LOG_LEVEL level, const char* file, const char* func, const int line, const char* prefix, const char* log, ...)
+    __attribute__((format(printf, 6, 7)));
+/* Write out everything queued so far, e.g. before exiting */
+void hmi_log_flush(void);
 
 #endif  //__HMI_DEBUG_H__
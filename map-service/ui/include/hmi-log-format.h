@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HMI_LOG_FORMAT_H__
+#define __HMI_LOG_FORMAT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * A record keeps the printf format and its raw arguments, the message is
+ * made by the writer thread or by tools/hmi-log-expand.
+ *
+ * Binary log written when HMI_LOG_BINARY names a file, expanded to text
+ * by tools/hmi-log-expand. Integers are in host byte order.
+ *
+ * file   : HMI_LOG_MAGIC, then records
+ * record : struct hmi_log_record, then file, func, prefix, format and
+ *          argument bytes of the given lengths, none of them NUL terminated
+ * args   : for each conversion in order, its '*' width and precision and
+ *          its value: integers, pointers and doubles in 8 bytes, strings
+ *          as a uint16_t length and the bytes
+ */
+#define HMI_LOG_MAGIC "HMILOG2\n"
+#define HMI_LOG_MAGIC_LEN 8
+/* Argument bytes of a record, later conversions are cut */
+#define HMI_LOG_ARGS_MAX 224
+
+struct hmi_log_record {
+    uint64_t time_us;   /* CLOCK_REALTIME */
+    uint32_t line;
+    uint8_t level;
+    uint8_t file_len;
+    uint8_t func_len;
+    uint8_t prefix_len;
+    uint16_t args_len;
+    uint16_t fmt_len;
+};
+
+static const char *const hmi_log_level_names[6] = {"NONE", "ERROR", "WARNING", "NOTICE", "INFO", "DEBUG"};
+
+enum hmi_log_arg {
+    HMI_LOG_ARG_NONE,     /* %% */
+    HMI_LOG_ARG_SIGNED,
+    HMI_LOG_ARG_UNSIGNED,
+    HMI_LOG_ARG_DOUBLE,
+    HMI_LOG_ARG_POINTER,
+    HMI_LOG_ARG_STRING,   /* %s, and %m as the text of errno */
+    HMI_LOG_ARG_SKIP      /* %n, nothing is written back */
+};
+
+/* One conversion of a printf format */
+struct hmi_log_spec {
+    const char *start;  /* its '%' */
+    size_t body;        /* '%', flags, width and precision */
+    size_t len;         /* up to and with the conversion letter */
+    int stars;          /* '*' width and precision, an int each */
+    char size;          /* 'H' hh, 'h', 'l', 'q' ll, 'L', 'j', 'z', 't', 0 */
+    char conv;
+    enum hmi_log_arg arg;
+};
+
+/* The next conversion at or after fmt, NULL past the last one */
+static inline const char *hmi_log_next_spec(const char *fmt, struct hmi_log_spec *spec)
+{
+    const char *p = strchr(fmt, '%');
+    if (p == NULL)
+        return NULL;
+    spec->start = p++;
+    spec->stars = 0;
+    spec->size = 0;
+    while (*p != '\0' && strchr("-+ #0'I", *p) != NULL)
+        p++;
+    if (*p == '*') {
+        spec->stars++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->stars++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    spec->body = p - spec->start;
+    switch (*p) {
+    case 'h':
+        spec->size = (p[1] == 'h') ? 'H' : 'h';
+        p += (p[1] == 'h') ? 2 : 1;
+        break;
+    case 'l':
+        spec->size = (p[1] == 'l') ? 'q' : 'l';
+        p += (p[1] == 'l') ? 2 : 1;
+        break;
+    case 'q': case 'L': case 'j': case 'z': case 't':
+        spec->size = *p++;
+        break;
+    }
+    spec->conv = *p;
+    switch (*p) {
+    case 'd': case 'i': case 'c':
+        spec->arg = HMI_LOG_ARG_SIGNED;
+        break;
+    case 'u': case 'o': case 'x': case 'X':
+        spec->arg = HMI_LOG_ARG_UNSIGNED;
+        break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        spec->arg = HMI_LOG_ARG_DOUBLE;
+        break;
+    case 'p':
+        spec->arg = HMI_LOG_ARG_POINTER;
+        break;
+    case 's': case 'm':
+        spec->arg = HMI_LOG_ARG_STRING;
+        break;
+    case 'n':
+        spec->arg = HMI_LOG_ARG_SKIP;
+        break;
+    case '%':
+        spec->arg = HMI_LOG_ARG_NONE;
+        break;
+    default:
+        /* Not a conversion printf knows, it ends the format */
+        return NULL;
+    }
+    spec->len = p + 1 - spec->start;
+    return spec->start + spec->len;
+}
+
+static inline int hmi_log_take(const unsigned char **args, const unsigned char *end, void *v, size_t n)
+{
+    if ((size_t)(end - *args) < n)
+        return 0;
+    memcpy(v, *args, n);
+    *args += n;
+    return 1;
+}
+
+/*
+ * Print fmt with the arguments a record holds into out, returns the
+ * length of the message, cut to out_len - 1. The message stops at the
+ * first conversion whose argument was cut.
+ */
+static inline size_t hmi_log_expand(const char *fmt, const unsigned char *args, size_t args_len,
+                                    char *out, size_t out_len)
+{
+    const unsigned char *end = args + args_len;
+    char text[HMI_LOG_ARGS_MAX + 1];
+    char conv[32];
+    struct hmi_log_spec spec;
+    size_t pos = 0;
+    const char *p = fmt;
+    const char *next;
+    int n;
+
+    if (out_len == 0)
+        return 0;
+    while (pos < out_len - 1) {
+        next = hmi_log_next_spec(p, &spec);
+        size_t lit = next ? (size_t)(spec.start - p) : strlen(p);
+        if (lit > out_len - 1 - pos)
+            lit = out_len - 1 - pos;
+        memcpy(out + pos, p, lit);
+        pos += lit;
+        if (next == NULL)
+            break;
+        p = next;
+
+        int64_t star[2] = {0, 0};
+        int ok = 1;
+        for (int i = 0; i < spec.stars; i++)
+            ok = ok && hmi_log_take(&args, end, &star[i], sizeof(star[i]));
+        if (!ok || spec.body + 4 > sizeof(conv))
+            break;
+        /* The conversion again, with the size of the stored value */
+        memcpy(conv, spec.start, spec.body);
+        size_t c = spec.body;
+        size_t room = out_len - pos;
+        union { int64_t i; uint64_t u; double d; } v;
+        switch (spec.arg) {
+        case HMI_LOG_ARG_NONE:
+            out[pos++] = '%';
+            continue;
+        case HMI_LOG_ARG_SKIP:
+            continue;
+        case HMI_LOG_ARG_SIGNED:
+        case HMI_LOG_ARG_UNSIGNED:
+        case HMI_LOG_ARG_POINTER:
+        case HMI_LOG_ARG_DOUBLE:
+            if (!hmi_log_take(&args, end, &v, sizeof(v)))
+                break;
+            if (spec.arg == HMI_LOG_ARG_SIGNED || spec.arg == HMI_LOG_ARG_UNSIGNED) {
+                if (spec.conv != 'c') {
+                    conv[c++] = 'l';
+                    conv[c++] = 'l';
+                }
+            }
+            conv[c++] = spec.conv;
+            conv[c] = '\0';
+#define HMI_LOG_PRINT(value) \
+            (spec.stars == 0 ? snprintf(out + pos, room, conv, value) : \
+             spec.stars == 1 ? snprintf(out + pos, room, conv, (int)star[0], value) : \
+             snprintf(out + pos, room, conv, (int)star[0], (int)star[1], value))
+            if (spec.conv == 'c')
+                n = HMI_LOG_PRINT((int)v.i);
+            else if (spec.arg == HMI_LOG_ARG_SIGNED)
+                n = HMI_LOG_PRINT((long long)v.i);
+            else if (spec.arg == HMI_LOG_ARG_UNSIGNED)
+                n = HMI_LOG_PRINT((unsigned long long)v.u);
+            else if (spec.arg == HMI_LOG_ARG_POINTER)
+                n = HMI_LOG_PRINT((void *)(uintptr_t)v.u);
+            else
+                n = HMI_LOG_PRINT(v.d);
+            pos += (n < 0) ? 0 : ((size_t)n >= room ? room - 1 : (size_t)n);
+            continue;
+        case HMI_LOG_ARG_STRING: {
+            uint16_t len;
+            if (!hmi_log_take(&args, end, &len, sizeof(len)) || len >= sizeof(text) ||
+                !hmi_log_take(&args, end, text, len))
+                break;
+            text[len] = '\0';
+            conv[c++] = 's';
+            conv[c] = '\0';
+            n = HMI_LOG_PRINT(text);
+#undef HMI_LOG_PRINT
+            pos += (n < 0) ? 0 : ((size_t)n >= room ? room - 1 : (size_t)n);
+            continue;
+        }
+        }
+        /* The argument was cut */
+        break;
+    }
+    out[pos] = '\0';
+    return pos;
+}
+
+#endif  //__HMI_LOG_FORMAT_H__
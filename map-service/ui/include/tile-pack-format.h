@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TILE_PACK_FORMAT_H__
+#define __TILE_PACK_FORMAT_H__
+
+#include <stdint.h>
+
+/*
+ * Offline tile pack read by simple-egl through mmap, built by
+ * tools/tile-pack. Integers are little endian whatever the host, a
+ * reader converts them with le32toh/le64toh.
+ *
+ * file  : struct tile_pack_header, tile blobs, then the index at
+ *         index_offset (8 byte aligned)
+ * index : count struct tile_pack_entry sorted by z, x, y, so a tile is
+ *         found by binary search without reading anything else
+ */
+#define TILE_PACK_MAGIC "MAPTPK1\n"
+#define TILE_PACK_MAGIC_LEN 8
+#define TILE_PACK_VERSION 1
+
+struct tile_pack_header {
+    char magic[TILE_PACK_MAGIC_LEN];
+    uint32_t version;
+    uint32_t count;
+    uint64_t index_offset;
+    uint64_t reserved;
+};
+
+struct tile_pack_entry {
+    uint32_t x, y;      /* XYZ scheme, y grows southwards */
+    uint8_t z;
+    uint8_t reserved[3];
+    uint32_t length;
+    uint64_t offset;    /* from the start of the file */
+};
+
+#endif  //__TILE_PACK_FORMAT_H__
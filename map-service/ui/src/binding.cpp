@@ -16,36 +16,110 @@
 
 #include <stdarg.h>
 #include <sys/socket.h>
-#include <iostream>
 #include <algorithm>
-#include <thread>
 #include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "binding.hpp"
+#include "hmi-debug.h"
 
-#define ELOG(args,...) _ELOG(__FUNCTION__,__LINE__,args,##__VA_ARGS__)
-#ifdef DEBUGMODE
- #define DLOG(args,...) _DLOG(__FUNCTION__,__LINE__,args,##__VA_ARGS__)
-#else
- #define DLOG(args,...)
-#endif
-static void _DLOG(const char* func, const int line, const char* log, ...);
-static void _ELOG(const char* func, const int line, const char* log, ...);
+#define ELOG(args,...) HMI_ERROR("binding", args, ##__VA_ARGS__)
+#define ILOG(args,...) HMI_INFO("binding", args, ##__VA_ARGS__)
+#define DLOG(args,...) HMI_DEBUG("binding", args, ##__VA_ARGS__)
 
 using namespace std;
 
 constexpr const char *const wmAPI = "windowmanager";
 constexpr const char *const mpPrvAPI = "map-private";
-static const char _new_req[] = "new_request";
-static const char _sync_draw[] = "syncDraw";
 static const char g_kKeyDrawingName[] = "drawing_name";
-static const char g_kKeyDrawingArea[] = "drawing_area";
-static const char g_kKeyDrawingRect[] = "drawing_rect";
-static const char g_kKeySurface[] = "surface";
 static const char g_kKeyUuid[] = "uuid";
 static const char g_kKeyAppId[] = "appid";
-static const char g_kKeyResponse[] = "response";
+static const char g_kKeyTrace[] = "trace";
+static const char g_kKeyRequests[] = "requests";
 static const char g_verb_endDraw[] = "endDraw";
 static const char g_verb_prvdSrf[] = "provide_surface";
+static const unsigned g_call_timeout_ms = 5000;
+static const unsigned g_reconnect_min_ms = 20;
+static const unsigned g_reconnect_max_ms = 2000;
+static const size_t g_outbound_max = 64;
+#define EVENT_SYNC_DRAW_NUM 5
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Event names and payload keys are matched against fixed tables: length
+ * first, then the bytes, so a miss costs one integer compare.
+ */
+typedef struct NameEntry {
+    const char* name;
+    size_t len;
+    int id;
+} NameEntry;
+
+#define NAME_ENTRY(str, id) { str, sizeof(str) - 1, id }
+
+static int match_name(const char* name, const NameEntry* table, size_t count)
+{
+    size_t len = strlen(name);
+    for(size_t i = 0; i < count; i++) {
+        if(table[i].len == len && memcmp(table[i].name, name, len) == 0)
+            return table[i].id;
+    }
+    return -1;
+}
+
+enum event_id { EV_NEW_REQUEST, EV_SYNC_DRAW };
+static const NameEntry g_events[] = {
+    NAME_ENTRY("map-private/new_request", EV_NEW_REQUEST),
+    NAME_ENTRY("windowmanager/syncDraw", EV_SYNC_DRAW),
+};
+
+enum request_key { RQ_SURFACE, RQ_APPID, RQ_ROLE, RQ_UUID, RQ_OP, RQ_TRACE };
+static const NameEntry g_request_keys[] = {
+    NAME_ENTRY("surface", RQ_SURFACE),
+    NAME_ENTRY("appid", RQ_APPID),
+    NAME_ENTRY("role", RQ_ROLE),
+    NAME_ENTRY("uuid", RQ_UUID),
+    NAME_ENTRY("op", RQ_OP),
+    NAME_ENTRY("trace", RQ_TRACE),
+};
+
+enum trace_key { TR_ID, TR_START, TR_LAST };
+static const NameEntry g_trace_keys[] = {
+    NAME_ENTRY("id", TR_ID),
+    NAME_ENTRY("start", TR_START),
+    NAME_ENTRY("last", TR_LAST),
+};
+
+static const NameEntry g_ops[] = {
+    NAME_ENTRY("create", NewRequest::CREATE),
+    NAME_ENTRY("prepare", NewRequest::PREPARE),
+    NAME_ENTRY("assign", NewRequest::ASSIGN),
+    NAME_ENTRY("release", NewRequest::RELEASE),
+};
+
+enum draw_key { SD_NAME, SD_AREA, SD_RECT };
+static const NameEntry g_draw_keys[] = {
+    NAME_ENTRY("drawing_name", SD_NAME),
+    NAME_ENTRY("drawing_area", SD_AREA),
+    NAME_ENTRY("drawing_rect", SD_RECT),
+};
+
+enum rect_key { RC_X, RC_Y, RC_W, RC_H };
+static const NameEntry g_rect_keys[] = {
+    NAME_ENTRY("x", RC_X),
+    NAME_ENTRY("y", RC_Y),
+    NAME_ENTRY("width", RC_W),
+    NAME_ENTRY("height", RC_H),
+};
+
+#define TABLE_SIZE(t) (sizeof(t) / sizeof((t)[0]))
 
 static void _on_hangup_static(void *closure, struct afb_wsj1 *wsj)
 {
@@ -62,34 +136,88 @@ static void _on_event_static(void* closure, const char* event, struct afb_wsj1_m
     static_cast<Binding*>(closure)->on_event(NULL,event,msg);
 }
 
-static void _on_reply_static(void *closure, struct afb_wsj1_msg *msg)
+/* Identifies the call a reply belongs to */
+struct CallClosure {
+    Binding* binding;
+    void* conn; // the afb_wsj1 or afb_proto_ws it was sent on
+    int id;
+};
+
+static void _on_call_reply_static(void *closure, struct afb_wsj1_msg *msg)
+{
+    CallClosure* c = static_cast<CallClosure*>(closure);
+    c->binding->on_call_reply(c, msg);
+}
+
+static void _on_api_reply_static(void *closure, void *request, struct json_object *obj,
+                                 const char *error, const char *info)
+{
+    CallClosure* c = static_cast<CallClosure*>(request);
+    c->binding->on_api_reply(c, obj, error, info);
+}
+
+static void _on_api_event_push_static(void *closure, const char *event_name, int event_id,
+                                      struct json_object *data)
 {
-    static_cast<Binding*>(closure)->on_reply(NULL,msg);
+    Binding::ApiSocket* s = static_cast<Binding::ApiSocket*>(closure);
+    s->binding->dispatch_event(event_name, data);
 }
 
-static void *event_loop_run(void *args)
+static void _on_api_hangup_static(void *closure)
 {
-    struct sd_event* loop = (struct sd_event*)(args);
-    DLOG("start eventloop");
-    for(;;)
-        sd_event_run(loop, 30000000);
+    Binding::ApiSocket* s = static_cast<Binding::ApiSocket*>(closure);
+    s->binding->on_api_hangup(s);
 }
 
 Binding::Binding()
-    : _wmh()
+    : wsj1(NULL), mploop(NULL), mloop(NULL), mnext_call(0), mhungup(NULL),
+      mreconnect_timer(0), mreconnect_attempts(0), mseed((unsigned)time(NULL) ^ (unsigned)getpid()),
+      msubscribed_sync_draw(false), mstarted_service(false), mproto_itf(), _wmh()
 {
+    msockets[0] = ApiSocket{this, wmAPI, NULL, NULL};
+    msockets[1] = ApiSocket{this, mpPrvAPI, NULL, NULL};
 }
 
 Binding::~Binding()
 {
-    if(mploop)
+    for(auto& o : moutbound)
+        json_object_put(o.arg);
+    if(mloop)
     {
-        sd_event_unref(mploop);
+        if(mreconnect_timer)
+            mloop->cancel_timer(mreconnect_timer);
+        for(auto& it : mcalls)
+        {
+            if(it.second.timer)
+                mloop->cancel_timer(it.second.timer);
+        }
     }
+    /* Releasing a connection may still answer its calls */
+    mcalls.clear();
     if(this->wsj1 != NULL)
     {
         afb_wsj1_unref(this->wsj1);
     }
+    if(mhungup != NULL)
+    {
+        afb_wsj1_unref(mhungup);
+    }
+    for(ApiSocket& s : msockets)
+    {
+        struct afb_proto_ws* ws = s.ws;
+        s.ws = NULL;
+        if(ws != NULL)
+            afb_proto_ws_unref(ws);
+        if(s.hungup != NULL)
+            afb_proto_ws_unref(s.hungup);
+    }
+    /* No reply comes once the connections are gone */
+    for(CallClosure* c : mreplies)
+        delete c;
+    if(mploop)
+    {
+        sd_event_unref(mploop);
+    }
 }
 
 
@@ -99,6 +227,8 @@ Binding::~Binding()
  * #### Parameters
  * - port  [in] : This argument should be specified to the port number to be used for websocket
  * - token [in] : This argument should be specified to the token to be used for websocket
+ * - loop  [in] : The loop of the caller, it runs the timeouts and must outlive the binding
+ * - endpoint [in] : Optional "unix:<dir>" holding an afb-proto-ws socket per api, tried before TCP
  *
  * #### Rreturn
  * Returns 0 on success or -1 in case of error.
@@ -106,13 +236,15 @@ Binding::~Binding()
  * #### Note
  *
  */
-int Binding::init(int port, const string& token)
+int Binding::init(int port, const string& token, EventLoop* loop, const string& endpoint)
 {
     int ret;
+    mloop = loop;
     if(port > 0 && token.size() > 0)
     {
         mport = port;
         mtoken = token;
+        mendpoint = endpoint;
     }
     else
     {
@@ -126,11 +258,6 @@ int Binding::init(int port, const string& token)
         ELOG("Failed to initialize websocket");
         return -1;
     }
-    ret = run_eventloop();
-    if(ret == -1){
-        ELOG("Failed to create thread");
-        return -1;
-    }
     return 0;
 }
 
@@ -144,14 +271,12 @@ int Binding::initialize_websocket()
         goto END;
     }
     /* Initialize interface from websocket */
-    {
     minterface.on_hangup = _on_hangup_static;
     minterface.on_call = _on_call_static;
     minterface.on_event = _on_event_static;
-    string muri = "ws://localhost:" + to_string(mport) + "/api?token=" + mtoken;
-    this->wsj1 = afb_ws_client_connect_wsj1(mploop, muri.c_str(), &minterface, this);
-    }
-    if(this->wsj1 == NULL)
+    mproto_itf.on_reply = _on_api_reply_static;
+    mproto_itf.on_event_push = _on_api_event_push_static;
+    if(connect_websocket() != 0)
     {
         ELOG("Failed to create websocket connection");
         goto END;
@@ -162,34 +287,162 @@ END:
     if(mploop)
     {
         sd_event_unref(mploop);
+        mploop = NULL;
     }
     return -1;
 }
 
-#define EVENT_SYNC_DRAW_NUM 5
+/* The unix sockets skip the TCP stack and the websocket framing,
+ * loopback TCP is the fallback */
+int Binding::connect_websocket()
+{
+    if(!mendpoint.empty())
+    {
+        if(this->connect_unix() == 0)
+            return 0;
+        DLOG("cannot connect to %s, using tcp", mendpoint.c_str());
+    }
+    string muri = "ws://localhost:" + to_string(mport) + "/api?token=" + mtoken;
+    this->wsj1 = afb_ws_client_connect_wsj1(mploop, muri.c_str(), &minterface, this);
+    return (this->wsj1 == NULL) ? -1 : 0;
+}
 
-void Binding::set_event_handler(const MyHandler& wmh)
+/* afb-daemon --ws-server=unix:<dir>/<api> serves one api per socket */
+int Binding::connect_unix()
+{
+    for(ApiSocket& s : msockets)
+    {
+        string uri = mendpoint + "/" + s.api;
+        s.ws = afb_ws_client_connect_api(mploop, uri.c_str(), &mproto_itf, &s);
+        if(s.ws == NULL)
+        {
+            this->close_unix();
+            return -1;
+        }
+        afb_proto_ws_on_hangup(s.ws, _on_api_hangup_static);
+    }
+    return 0;
+}
+
+/* Nothing was sent on them yet */
+void Binding::close_unix()
 {
-    // Subscribe
-    const char* ev = "event";
+    for(ApiSocket& s : msockets)
+    {
+        struct afb_proto_ws* ws = s.ws;
+        s.ws = NULL;
+        if(ws != NULL)
+            afb_proto_ws_unref(ws);
+    }
+}
 
-    if(wmh.on_sync_draw != nullptr) {
-        struct json_object* j = json_object_new_object();
-        json_object_object_add(j, ev, json_object_new_int(EVENT_SYNC_DRAW_NUM));
+bool Binding::connected() const
+{
+    return this->wsj1 != NULL || msockets[0].ws != NULL;
+}
+
+Binding::ApiSocket* Binding::socket_of(const string& api)
+{
+    for(ApiSocket& s : msockets)
+    {
+        if(s.ws != NULL && api == s.api)
+            return &s;
+    }
+    return NULL;
+}
+
+/* Try again after a jittered, exponentially growing delay */
+void Binding::schedule_reconnect()
+{
+    if(mreconnect_timer)
+        return;
+    unsigned delay = g_reconnect_min_ms << std::min(mreconnect_attempts, 16u);
+    if(delay > g_reconnect_max_ms || delay == 0)
+        delay = g_reconnect_max_ms;
+    /* Full jitter over the upper half, restarted peers don't reconnect in step */
+    delay = delay / 2 + rand_r(&mseed) % (delay / 2 + 1);
+    ++mreconnect_attempts;
+
+    mreconnect_timer = mloop->add_timer((uint64_t)delay * 1000, [this]() {
+        this->on_reconnect_timer();
+    });
+    DLOG("reconnect in %u ms", delay);
+}
 
-        int ret = afb_wsj1_call_j(this->wsj1, wmAPI, "wm_subscribe", j, _on_reply_static, this);
-        if (0 > ret) {
-            ELOG("Failed to subscribe event active");
+void Binding::on_reconnect_timer()
+{
+    mreconnect_timer = 0;
+    if(mhungup != NULL)
+    {
+        /* libafbwsc is done with it, its hangup callback returned long ago */
+        afb_wsj1_unref(mhungup);
+        this->release_replies(mhungup);
+        mhungup = NULL;
+    }
+    for(ApiSocket& s : msockets)
+    {
+        if(s.hungup != NULL)
+        {
+            afb_proto_ws_unref(s.hungup);
+            this->release_replies(s.hungup);
+            s.hungup = NULL;
         }
     }
+    if(connect_websocket() != 0)
+    {
+        schedule_reconnect();
+        return;
+    }
+    ILOG("websocket is back after %u attempts", mreconnect_attempts);
+    mreconnect_attempts = 0;
+
+    /* Registrations of the old session are gone with it */
+    this->replay_subscriptions();
+
+    /* Then everything sent while the socket was down, in order. Surfaces
+     * were provided for requests of the old session, which map-private
+     * already queued again for the new one: those calls are dropped. */
+    std::deque<Outbound> queued;
+    queued.swap(moutbound);
+    for(Outbound& o : queued)
+    {
+        if(mcalls.find(o.id) == mcalls.end())
+        {
+            /* timed out while waiting */
+            json_object_put(o.arg);
+            continue;
+        }
+        if(o.verb == g_verb_prvdSrf)
+        {
+            json_object_put(o.arg);
+            CallReply reply = {false, "hangup", NULL};
+            this->finish_call(o.id, reply);
+            continue;
+        }
+        this->send_call(o.id, o.api, o.verb, o.arg);
+    }
+}
 
-    if(wmh.on_new_request != nullptr) {
+void Binding::replay_subscriptions()
+{
+    if(msubscribed_sync_draw)
+    {
         struct json_object* j = json_object_new_object();
-        int ret = afb_wsj1_call_j(this->wsj1, mpPrvAPI, "subscribe", j, _on_reply_static, this);
-        if (0 > ret) {
-            ELOG("Failed to subscribe event active");
-        }
+        json_object_object_add(j, "event", json_object_new_int(EVENT_SYNC_DRAW_NUM));
+        this->call(wmAPI, "wm_subscribe", j);
     }
+    if(mstarted_service)
+    {
+        this->call(mpPrvAPI, "start_service", json_object_new_object());
+    }
+}
+
+void Binding::set_event_handler(const MyHandler& wmh)
+{
+    // Subscribe, remembered to be replayed after a reconnection
+    msubscribed_sync_draw = (wmh.on_sync_draw != nullptr);
+    mstarted_service = (wmh.on_new_request != nullptr);
+    this->replay_subscriptions();
 
     // Register
     this->_wmh.on_reply = wmh.on_reply;
@@ -197,38 +450,72 @@ void Binding::set_event_handler(const MyHandler& wmh)
     this->_wmh.on_new_request = wmh.on_new_request;
 }
 
-void Binding::end_draw(const char* role) {
+void Binding::end_draw(const char* role, reply_callback cb) {
     json_object* object = json_object_new_object();
     json_object_object_add(object, g_kKeyDrawingName, json_object_new_string(role));
-    this->call(wmAPI, g_verb_endDraw, object);
+    this->call(wmAPI, g_verb_endDraw, object, cb ? cb : this->default_reply(g_verb_endDraw), g_call_timeout_ms);
 }
 
-void Binding::provide_surface(const NewRequest& req) {
+void Binding::provide_surface(const NewRequest& req, reply_callback cb) {
     json_object* object = json_object_new_object();
     json_object_object_add(object, g_kKeyUuid, json_object_new_string(req.uuid.c_str()));
     json_object_object_add(object, g_kKeyAppId, json_object_new_string(req.appid.c_str()));
-    this->call(mpPrvAPI, g_verb_prvdSrf, object);
+    if(req.trace_id != 0) {
+        // Let map-private split the time spent on our side
+        json_object* trace = json_object_new_object();
+        json_object_object_add(trace, "id", json_object_new_int64(req.trace_id));
+        json_object_object_add(trace, "start", json_object_new_int64(req.trace_start));
+        json_object_object_add(trace, "last", json_object_new_int64(req.trace_last));
+        json_object_object_add(trace, "recv", json_object_new_int64(req.recv_ns));
+        json_object_object_add(trace, "sent", json_object_new_int64(monotonic_ns()));
+        json_object_object_add(object, g_kKeyTrace, trace);
+    }
+    this->call(mpPrvAPI, g_verb_prvdSrf, object, cb ? cb : this->default_reply(g_verb_prvdSrf), g_call_timeout_ms);
 }
 
-int Binding::run_eventloop()
+/* Log a failure and hand the reply to MyHandler::on_reply as before */
+Binding::reply_callback Binding::default_reply(const string& verb)
 {
-    if(mploop && this->wsj1)
-    {
-        pthread_t thread_id;
-        int ret = pthread_create(&thread_id, NULL, event_loop_run, mploop);
-        if(ret != 0)
-        {
-            ELOG("Cannot run eventloop due to error:%d", errno);
-            return -1;
-        }
-        else
-            return 0;
-    }
-    else
+    return [this, verb](const CallReply& reply) {
+        if(!reply.ok)
+            ELOG("%s failed: %s", verb.c_str(), reply.error);
+        if(reply.object && this->_wmh.on_reply)
+            this->_wmh.on_reply(reply.object);
+    };
+}
+
+/**
+ * The fd to watch for the websocket
+ *
+ * #### Rreturn
+ * Returns the fd, readable when dispatch_events() has work, or -1 before init().
+ * It stays the same across reconnections of the websocket.
+ *
+ * #### Note
+ * The binding has no thread of its own, the caller polls this fd in
+ * its event loop so that every handler runs on the render thread.
+ *
+ */
+int Binding::event_fd() const
+{
+    if(!mploop)
     {
-        ELOG("Connecting is not established yet");
         return -1;
     }
+    return sd_event_get_fd(mploop);
+}
+
+void Binding::dispatch_events()
+{
+    /* Run everything pending without blocking */
+    while(this->dispatch_event())
+        ;
+}
+
+/* Run one pending event source, false when nothing was pending */
+bool Binding::dispatch_event()
+{
+    return sd_event_run(mploop, 0) > 0;
 }
 
 /**
@@ -247,105 +534,378 @@ int Binding::run_eventloop()
  */
 int Binding::call(const string& api, const string& verb, struct json_object* arg)
 {
-    int ret;
-    if(!this->wsj1)
+    return this->call(api, verb, arg, this->default_reply(verb));
+}
+
+/**
+ * This function calls a verb and hands its own reply to cb
+ *
+ * #### Parameters
+ * - api, verb  [in] : The verb to call
+ * - arg        [in] : Argument of the verb, the reference is taken
+ * - cb         [in] : Called once with the reply, on timeout or on hangup
+ * - timeout_ms [in] : Give up waiting after this, 0 waits for ever
+ *
+ * #### Rreturn
+ * - Returns the call id (> 0) for cancel() or -1 in case of error.
+ *
+ * #### Note
+ * cb runs from dispatch_events() or a timer of the loop given to init(),
+ * so on the thread of the event loop.
+ * Any number of calls may be in flight, each one gets its own reply.
+ *
+ */
+int Binding::call(const string& api, const string& verb, struct json_object* arg,
+                  reply_callback cb, unsigned timeout_ms)
+{
+    if(!mploop)
     {
+        json_object_put(arg);
         return -1;
     }
-    ret = afb_wsj1_call_j(this->wsj1, api.c_str(), verb.c_str(), arg, _on_reply_static, this);
+    int id = ++mnext_call;
+    if(id <= 0)
+        id = mnext_call = 1;
+    Call& c = mcalls[id];
+    c.cb = cb;
+
+    c.timer = 0;
+
+    if(timeout_ms > 0)
+    {
+        c.timer = mloop->add_timer((uint64_t)timeout_ms * 1000, [this, id]() {
+            this->on_call_timeout(id);
+        });
+    }
+
+    if(!this->connected())
+    {
+        /* Keep it for the reconnection, the oldest is given up when full */
+        if(moutbound.size() >= g_outbound_max)
+        {
+            Outbound dropped = std::move(moutbound.front());
+            moutbound.pop_front();
+            json_object_put(dropped.arg);
+            CallReply reply = {false, "dropped", NULL};
+            this->finish_call(dropped.id, reply);
+        }
+        moutbound.push_back(Outbound{id, api, verb, arg});
+        return id;
+    }
+    if(this->send_call(id, api, verb, arg) < 0)
+    {
+        this->cancel(id);
+        return -1;
+    }
+    return id;
+}
+
+int Binding::send_call(int id, const string& api, const string& verb, struct json_object* arg)
+{
+    int ret;
+    CallClosure* closure;
+    if (this->wsj1 != NULL) {
+        closure = new CallClosure{this, this->wsj1, id};
+        ret = afb_wsj1_call_j(this->wsj1, api.c_str(), verb.c_str(), arg, _on_call_reply_static, closure);
+    } else {
+        ApiSocket* s = this->socket_of(api);
+        if (s == NULL) {
+            ELOG("no socket for api %s in %s", api.c_str(), mendpoint.c_str());
+            json_object_put(arg);
+            return -1;
+        }
+        /* One session for the process, as the websocket token gives */
+        closure = new CallClosure{this, s->ws, id};
+        ret = afb_proto_ws_client_call(s->ws, verb.c_str(), arg, mtoken.c_str(), closure, NULL);
+        json_object_put(arg);
+    }
     if (ret < 0) {
         ELOG("Failed to call verb:%s",verb.c_str());
+        delete closure;
+        return ret;
     }
+    mreplies.insert(closure);
     return ret;
 }
 
+/* Free what was left to wsj, once it is released no reply can come */
+void Binding::release_replies(void* conn)
+{
+    for(auto it = mreplies.begin(); it != mreplies.end();)
+    {
+        if((*it)->conn == conn)
+        {
+            delete *it;
+            it = mreplies.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+/* Forget a call, its callback is not invoked any more */
+void Binding::cancel(int call_id)
+{
+    auto it = mcalls.find(call_id);
+    if(it == mcalls.end())
+        return;
+    if(it->second.timer)
+        mloop->cancel_timer(it->second.timer);
+    mcalls.erase(it);
+}
+
+size_t Binding::calls_in_flight() const
+{
+    return mcalls.size();
+}
+
+void Binding::finish_call(int call_id, const CallReply& reply)
+{
+    auto it = mcalls.find(call_id);
+    if(it == mcalls.end())
+    {
+        /* Timed out or cancelled already */
+        return;
+    }
+    reply_callback cb = std::move(it->second.cb);
+    this->cancel(call_id);
+    if(cb)
+        cb(reply);
+}
+
 /************* Callback Function *************/
 
 void Binding::on_hangup(void *closure, struct afb_wsj1 *wsj)
 {
     DLOG("%s called", __FUNCTION__);
-    if(onHangup != nullptr)
+    /* No reply comes any more for the calls in flight */
+    vector<int> ids;
+    for(const auto& it : mcalls)
+        ids.push_back(it.first);
+    CallReply reply = {false, "hangup", NULL};
+    for(int id : ids)
+        this->finish_call(id, reply);
+
+    /* Calls made from now on wait in the outbound queue. libafbwsc still
+     * uses the connection after this callback, it is released on the
+     * reconnect timer. */
+    if(this->wsj1)
     {
-        onHangup();
+        struct afb_wsj1* old = mhungup;
+        mhungup = this->wsj1;
+        this->wsj1 = NULL;
+        if(old != NULL)
+        {
+            afb_wsj1_unref(old);
+            this->release_replies(old);
+        }
+    }
+    /* One api socket gone is the whole session gone, the other one
+     * is dropped as well and both come back together */
+    for(ApiSocket& s : msockets)
+    {
+        if(s.ws == NULL)
+            continue;
+        struct afb_proto_ws* old = s.hungup;
+        s.hungup = s.ws;
+        s.ws = NULL;
+        if(old != NULL)
+        {
+            afb_proto_ws_unref(old);
+            this->release_replies(old);
+        }
     }
+    this->schedule_reconnect();
+}
+
+void Binding::on_api_hangup(ApiSocket *socket)
+{
+    /* A released socket may call back, only a live one is news */
+    if(socket->ws == NULL)
+        return;
+    this->on_hangup(NULL, NULL);
 }
 
 void Binding::on_call(void *closure, const char *api, const char *verb, struct afb_wsj1_msg *msg)
 {
 }
 
-void Binding::on_event(void *closure, const char *event, struct afb_wsj1_msg *msg)
+/* One pass over the members of a request, strings are copied into the
+ * reused scratch request so that a burst allocates nothing new */
+void Binding::dispatch_new_request(json_object *object, uint64_t recv_ns)
+{
+    NewRequest& req = this->mnew_req;
+    req.appid.clear();
+    req.role.clear();
+    req.uuid.clear();
+    req.surface_id = 0;
+    req.op = NewRequest::CREATE;
+    req.trace_id = req.trace_start = req.trace_last = 0;
+    req.recv_ns = recv_ns;
+
+    json_object_object_foreach(object, key, val) {
+        switch(match_name(key, g_request_keys, TABLE_SIZE(g_request_keys))) {
+        case RQ_SURFACE:
+            req.surface_id = (unsigned)json_object_get_int(val);
+            break;
+        case RQ_APPID:
+            if(json_object_is_type(val, json_type_string))
+                req.appid.assign(json_object_get_string(val), json_object_get_string_len(val));
+            break;
+        case RQ_ROLE:
+            if(json_object_is_type(val, json_type_string))
+                req.role.assign(json_object_get_string(val), json_object_get_string_len(val));
+            break;
+        case RQ_UUID:
+            if(json_object_is_type(val, json_type_string))
+                req.uuid.assign(json_object_get_string(val), json_object_get_string_len(val));
+            break;
+        case RQ_OP: {
+            int op = json_object_is_type(val, json_type_string) ?
+                match_name(json_object_get_string(val), g_ops, TABLE_SIZE(g_ops)) : -1;
+            if(op >= 0)
+                req.op = (NewRequest::Op)op;
+            break;
+        }
+        case RQ_TRACE: {
+            if(!json_object_is_type(val, json_type_object))
+                break;
+            json_object_object_foreach(val, t_key, t_val) {
+                switch(match_name(t_key, g_trace_keys, TABLE_SIZE(g_trace_keys))) {
+                case TR_ID:
+                    req.trace_id = json_object_get_int64(t_val);
+                    break;
+                case TR_START:
+                    req.trace_start = json_object_get_int64(t_val);
+                    break;
+                case TR_LAST:
+                    req.trace_last = json_object_get_int64(t_val);
+                    break;
+                }
+            }
+            break;
+        }
+        }
+    }
+    this->_wmh.on_new_request(req);
+}
+
+void Binding::dispatch_new_requests(json_object *object)
 {
-    /* check event is for us */
-    string ev = string(event);
-    if (ev.find(mpPrvAPI) == string::npos || ev.find(wmAPI) == string::npos) {
-        /* It's not us */
+    if(!this->_wmh.on_new_request) {
         return;
     }
-    struct json_object* object = afb_wsj1_msg_object_j(msg);
-    if(ev.find(_new_req)) {
-        json_object *j_val;
-        json_object_object_get_ex(object, g_kKeySurface, &j_val);
-        int surface_id = json_object_get_string(j_val);
-        json_object_object_get_ex(object, g_kKeyAppId, &j_val);
-        const char* appid  = json_object_get_string(j_val);
-        json_object_object_get_ex(object, g_kKeyUuid, &j_val);
-        const char* uuid = json_object_get_string(j_val);
-        NewRequest nw_req = {appid, uuid, surface_id};
-        this->_wmh.on_new_request(nw_req);
-    }
-    else if(ev.find(_sync_draw)) {
-        json_object *j_val, *j_rect;
-        json_object_object_get_ex(object, g_kKeyDrawingName, &j_val);
-        const char* role = json_object_get_string(j_val);
-        json_object_object_get_ex(object, g_kKeyDrawingArea, &j_val);
-        const char* area = json_object_get_string(j_val);
-        json_object_object_get_ex(object, g_kKeyDrawingRect, &j_rect);
-        json_object_object_get_ex(j_rect, "x", &j_val);
-        int x = json_object_get_int(j_val);
-        json_object_object_get_ex(j_rect, "y", &j_val);
-        int y = json_object_get_int(j_val);
-        json_object_object_get_ex(j_rect, "width", &j_val);
-        int w = json_object_get_int(j_val);
-        json_object_object_get_ex(j_rect, "height", &j_val);
-        int h = json_object_get_int(j_val);
-        Rect rect(x, y, w, h);
-        this->_wmh.on_sync_draw(role, area, rect);
-    }
-
-}
-
-void Binding::on_reply(void *closure, struct afb_wsj1_msg *msg)
-{
-    struct json_object* reply = afb_wsj1_msg_object_j(msg);
-    if(this->_wmh.on_reply)
-    {
-        this->_wmh.on_reply(reply);
+    uint64_t recv_ns = monotonic_ns();
+    json_object *j_requests;
+    if(json_object_object_get_ex(object, g_kKeyRequests, &j_requests)) {
+        /* a batch of request_maps comes in one event */
+        size_t len = json_object_array_length(j_requests);
+        for(size_t i = 0; i < len; i++) {
+            this->dispatch_new_request(json_object_array_get_idx(j_requests, i), recv_ns);
+        }
+    }
+    else {
+        this->dispatch_new_request(object, recv_ns);
+    }
+}
+
+void Binding::dispatch_sync_draw(json_object *object)
+{
+    if(!this->_wmh.on_sync_draw) {
+        return;
     }
+    const char* role = "";
+    const char* area = "";
+    int rc[4] = {0, 0, 0, 0};
+    json_object_object_foreach(object, key, val) {
+        switch(match_name(key, g_draw_keys, TABLE_SIZE(g_draw_keys))) {
+        case SD_NAME:
+            if(json_object_is_type(val, json_type_string))
+                role = json_object_get_string(val);
+            break;
+        case SD_AREA:
+            if(json_object_is_type(val, json_type_string))
+                area = json_object_get_string(val);
+            break;
+        case SD_RECT: {
+            if(!json_object_is_type(val, json_type_object))
+                break;
+            json_object_object_foreach(val, r_key, r_val) {
+                int i = match_name(r_key, g_rect_keys, TABLE_SIZE(g_rect_keys));
+                if(i >= 0)
+                    rc[i] = json_object_get_int(r_val);
+            }
+            break;
+        }
+        }
+    }
+    Rect rect(rc[RC_X], rc[RC_Y], rc[RC_W], rc[RC_H]);
+    this->_wmh.on_sync_draw(role, area, rect);
 }
 
-/* Internal Function in Binding */
+void Binding::on_event(void *closure, const char *event, struct afb_wsj1_msg *msg)
+{
+    this->dispatch_event(event, afb_wsj1_msg_object_j(msg));
+}
 
-static void _ELOG(const char* func, const int line, const char* log, ...)
+void Binding::dispatch_event(const char *event, json_object *object)
 {
-    char *message;
-    va_list args;
-    va_start(args, log);
-    if (log == NULL || vasprintf(&message, log, args) < 0)
-        message = NULL;
-    cout << "[ERROR: soundmanager]" << func << "(" << line << "):" << message << endl;
-    va_end(args);
-    free(message);
+    /* map-private only sends us the requests we own */
+    switch(match_name(event, g_events, TABLE_SIZE(g_events))) {
+    case EV_NEW_REQUEST:
+        this->dispatch_new_requests(object);
+        break;
+    case EV_SYNC_DRAW:
+        this->dispatch_sync_draw(object);
+        break;
+    default:
+        DLOG("unhandled event %s", event);
+        break;
+    }
+}
+
+void Binding::on_call_reply(CallClosure *closure, struct afb_wsj1_msg *msg)
+{
+    this->finish_reply(closure, afb_wsj1_msg_object_j(msg), afb_wsj1_msg_is_reply_ok(msg));
+}
+
+void Binding::on_api_reply(CallClosure *closure, json_object *obj, const char *error, const char *info)
+{
+    /* Shaped as a wsj1 reply, callbacks see the same message on both */
+    json_object* object = json_object_new_object();
+    json_object* j_req = json_object_new_object();
+    json_object_object_add(j_req, "status", json_object_new_string(error ? error : "success"));
+    if(info)
+        json_object_object_add(j_req, "info", json_object_new_string(info));
+    json_object_object_add(object, "request", j_req);
+    if(obj)
+        json_object_object_add(object, "response", json_object_get(obj));
+    this->finish_reply(closure, object, error == NULL);
+    json_object_put(object);
+}
+
+void Binding::finish_reply(CallClosure *closure, json_object *object, bool ok)
+{
+    int call_id = closure->id;
+    mreplies.erase(closure);
+    delete closure;
+
+    CallReply reply = {true, NULL, object};
+    if(!ok)
+    {
+        json_object *j_req, *j_status;
+        reply.ok = false;
+        reply.error = "failed";
+        if(json_object_object_get_ex(object, "request", &j_req) &&
+           json_object_object_get_ex(j_req, "status", &j_status))
+            reply.error = json_object_get_string(j_status);
+    }
+    this->finish_call(call_id, reply);
 }
 
-static void _DLOG(const char* func, const int line, const char* log, ...)
+void Binding::on_call_timeout(int call_id)
 {
-    char *message;
-    va_list args;
-    va_start(args, log);
-    if (log == NULL || vasprintf(&message, log, args) < 0)
-        message = NULL;
-    cout << "[DEBUG: soundmanager]" << func << "(" << line << "):" << message << endl;
-    va_end(args);
-    free(message);
+    DLOG("call %d timed out", call_id);
+    CallReply reply = {false, "timeout", NULL};
+    this->finish_call(call_id, reply);
 }
@@ -18,16 +18,21 @@
 #define BINDING_H
 #include <vector>
 #include <map>
+#include <set>
+#include <deque>
 #include <string>
 #include <functional>
+#include <stdint.h>
 #include <json-c/json.h>
 #include <systemd/sd-event.h>
+#include "event-loop.hpp"
 #define AFB_BINDING_VERSION 3
 extern "C"
 {
 #include <afb/afb-binding.h>
 #include <afb/afb-wsj1.h>
 #include <afb/afb-ws-client.h>
+#include <afb/afb-proto-ws.h>
 }
 
 class Rect {
@@ -52,11 +57,32 @@ class Rect {
 };
 
 typedef struct NewRequest {
+    enum Op {
+        CREATE,  // create the surface and provide it
+        PREPARE, // create a pool surface ahead of any request
+        ASSIGN,  // a pool surface was attached to appid
+        RELEASE  // destroy a surface, idle in the pool or given back by its app
+    };
     std::string appid;
+    // window manager role of the map surface, the drawing_name of syncDraw
+    std::string role;
     std::string uuid;
     unsigned surface_id;
+    Op op;
+    // request_map trace of map-service, echoed back with provide_surface
+    uint64_t trace_id;
+    uint64_t trace_start;
+    uint64_t trace_last;
+    uint64_t recv_ns; // CLOCK_MONOTONIC when new_request arrived
 } NewRequest;
 
+/* Outcome of one Binding::call() */
+typedef struct CallReply {
+    bool ok;
+    const char* error;       // status of the failed call, "timeout" or "hangup"
+    struct json_object* object; // whole reply message, NULL on timeout/hangup
+} CallReply;
+
 class MyHandler {
   public:
     MyHandler() {}
@@ -78,39 +104,105 @@ public:
     ~Binding();
     Binding(const Binding &) = delete;
     Binding &operator=(const Binding &) = delete;
-    int init(int port, const std::string& token);
+    int init(int port, const std::string& token, EventLoop* loop, const std::string& endpoint = "");
     void set_event_handler(const MyHandler& wmh);
     void subscribe_events();
-    void end_draw(const char* role);
-    void provide_surface(const NewRequest& req);
 
     using handler_asyncSetSourceState = std::function<void(int sourceID, int handle)>;
+    using reply_callback = std::function<void(const CallReply&)>;
+
+    void end_draw(const char* role, reply_callback cb = nullptr);
+    void provide_surface(const NewRequest& req, reply_callback cb = nullptr);
 
     int call(const std::string& api, const std::string& verb, struct json_object* arg);
+    int call(const std::string& api, const std::string& verb, struct json_object* arg,
+             reply_callback cb, unsigned timeout_ms = 0);
+    void cancel(int call_id);
+    size_t calls_in_flight() const;
+
+    int event_fd() const;
+    void dispatch_events();
+    bool dispatch_event();
 
 private:
-    int run_eventloop();
     int init_event();
     int initialize_websocket();
+    int connect_websocket();
+    int connect_unix();
+    void close_unix();
+    bool connected() const;
+    void schedule_reconnect();
+    void replay_subscriptions();
+    int send_call(int id, const std::string& api, const std::string& verb, struct json_object* arg);
     int dispatch_asyncSetSourceState(int sourceID, int handle, const std::string& sourceState);
+    void dispatch_new_request(struct json_object *object, uint64_t recv_ns);
+    void dispatch_new_requests(struct json_object *object);
+    void dispatch_sync_draw(struct json_object *object);
 
     void (*onEvent)(const std::string& event, struct json_object* event_contents);
     void (*onReply)(struct json_object* reply);
-    void (*onHangup)(void);
 
     struct afb_wsj1* wsj1;
     struct afb_wsj1_itf minterface;
     sd_event* mploop;
+    EventLoop* mloop; // runs the timers
     int mport;
+    struct Call {
+        reply_callback cb;
+        unsigned timer; // 0 when the call waits for ever
+    };
+    std::map<int, Call> mcalls; // in flight, keyed by call id
+    int mnext_call;
+    /* Closures libafbwsc holds for the calls it sent, it never gives back
+     * those of a connection that hung up */
+    std::set<struct CallClosure*> mreplies;
+    void finish_call(int call_id, const CallReply& reply);
+    void finish_reply(struct CallClosure* closure, struct json_object* object, bool ok);
+    void release_replies(void* conn);
+    reply_callback default_reply(const std::string& verb);
+
+    /* Calls made while the websocket is down */
+    struct Outbound {
+        int id;
+        std::string api;
+        std::string verb;
+        struct json_object* arg;
+    };
+    std::deque<Outbound> moutbound;
+    /* Hung up connection, released once its hangup callback returned */
+    struct afb_wsj1* mhungup;
+    unsigned mreconnect_timer;
+    unsigned mreconnect_attempts;
+    unsigned mseed;
+    bool msubscribed_sync_draw;
+    bool mstarted_service;
     std::string mtoken;
+    std::string mendpoint; // "unix:<dir>" of the afb-proto-ws sockets, empty for TCP only
+    struct afb_proto_ws_client_itf mproto_itf;
     MyHandler _wmh;
+    NewRequest mnew_req; // decoding scratch, reused for every request
 
 public:
     /* Don't use/ Internal only */
+    /* afb-proto-ws connection of one api, over the unix endpoint */
+    struct ApiSocket {
+        Binding* binding;
+        const char* api;
+        struct afb_proto_ws* ws;
+        struct afb_proto_ws* hungup; // released on the reconnect timer
+    };
+    ApiSocket msockets[2];
+    ApiSocket* socket_of(const std::string& api);
+
     void on_hangup(void *closure, struct afb_wsj1 *wsj);
+    void on_api_hangup(ApiSocket *socket);
+    void on_api_reply(struct CallClosure *closure, struct json_object *obj, const char *error, const char *info);
     void on_call(void *closure, const char *api, const char *verb, struct afb_wsj1_msg *msg);
     void on_event(void *closure, const char *event, struct afb_wsj1_msg *msg);
-    void on_reply(void *closure, struct afb_wsj1_msg *msg);
+    void dispatch_event(const char *event, struct json_object *object);
+    void on_call_reply(struct CallClosure *closure, struct afb_wsj1_msg *msg);
+    void on_call_timeout(int call_id);
+    void on_reconnect_timer();
 };
 
 #endif /* BINDING_H */
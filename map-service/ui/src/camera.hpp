@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAMERA_H
+#define CAMERA_H
+#include <math.h>
+
+/* View of one map surface, zoom is fractional, bearing in degrees */
+struct camera {
+    double lon, lat, zoom, bearing;
+};
+
+/* Web Mercator position in [0, 1), y grows southwards like tile rows */
+static inline void camera_world(double lon, double lat, double* wx, double* wy)
+{
+    double s = sin(lat * M_PI / 180.0);
+    if (s > 0.9999)
+        s = 0.9999;
+    else if (s < -0.9999)
+        s = -0.9999;
+    *wx = (lon + 180.0) / 360.0;
+    *wy = 0.5 - log((1 + s) / (1 - s)) / (4 * M_PI);
+}
+
+#endif /* CAMERA_H */
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include "damage.hpp"
+
+/* Buffer ages beyond this are repainted in full, EGL keeps 2 or 3 buffers */
+static const size_t _max_history = 4;
+
+static DamageRect unite(const DamageRect& a, const DamageRect& b)
+{
+    int x0 = std::min(a.x, b.x), y0 = std::min(a.y, b.y);
+    int x1 = std::max(a.x + a.w, b.x + b.w), y1 = std::max(a.y + a.h, b.y + b.h);
+    return DamageRect{x0, y0, x1 - x0, y1 - y0};
+}
+
+DamageTracker::DamageTracker()
+    : width(0), height(0)
+{
+}
+
+void DamageTracker::resize(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    this->history.clear();
+    this->add_full();
+}
+
+void DamageTracker::add(const DamageRect& rect)
+{
+    /* Clip to the surface, drop what is outside */
+    int x0 = std::max(rect.x, 0), y0 = std::max(rect.y, 0);
+    int x1 = std::min(rect.x + rect.w, this->width);
+    int y1 = std::min(rect.y + rect.h, this->height);
+    if (x1 <= x0 || y1 <= y0)
+        return;
+    this->current.push_back(DamageRect{x0, y0, x1 - x0, y1 - y0});
+}
+
+void DamageTracker::add_full()
+{
+    this->current.clear();
+    this->current.push_back(DamageRect{0, 0, this->width, this->height});
+}
+
+bool DamageTracker::empty() const
+{
+    return this->current.empty();
+}
+
+DamageRect DamageTracker::repaint_bounds(int buffer_age, bool* full) const
+{
+    DamageRect all = {0, 0, this->width, this->height};
+    if (buffer_age <= 0 || (size_t)buffer_age > this->history.size() + 1 || this->current.empty()) {
+        *full = true;
+        return all;
+    }
+    DamageRect bounds = this->current[0];
+    for (const DamageRect& r : this->current)
+        bounds = unite(bounds, r);
+    for (int i = 0; i < buffer_age - 1; i++) {
+        for (const DamageRect& r : this->history[i])
+            bounds = unite(bounds, r);
+    }
+    *full = (bounds.x == 0 && bounds.y == 0 && bounds.w == this->width && bounds.h == this->height);
+    return bounds;
+}
+
+std::vector<int> DamageTracker::frame_rects() const
+{
+    std::vector<int> rects;
+    rects.reserve(this->current.size() * 4);
+    for (const DamageRect& r : this->current) {
+        rects.push_back(r.x);
+        rects.push_back(r.y);
+        rects.push_back(r.w);
+        rects.push_back(r.h);
+    }
+    return rects;
+}
+
+void DamageTracker::end_frame()
+{
+    this->history.push_front(std::move(this->current));
+    if (this->history.size() > _max_history)
+        this->history.pop_back();
+    this->current.clear();
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DAMAGE_H
+#define DAMAGE_H
+#include <deque>
+#include <vector>
+
+/* Rectangle in GL window coordinates, origin at the bottom left */
+typedef struct DamageRect {
+    int x, y, w, h;
+} DamageRect;
+
+/*
+ * Damage of the frames drawn into the back buffers of one EGL surface.
+ * A buffer of age n missed the damage of the last n - 1 frames, so that
+ * damage plus the one of the current frame is what has to be repainted.
+ * The compositor is only told about the damage of the current frame.
+ */
+class DamageTracker {
+  public:
+    DamageTracker();
+
+    // A new size invalidates every buffer
+    void resize(int width, int height);
+    void add(const DamageRect& rect);
+    void add_full();
+    bool empty() const;
+
+    // Bounds of the region to repaint into a buffer of buffer_age
+    // (0 when unknown); full is set when that is the whole surface
+    DamageRect repaint_bounds(int buffer_age, bool* full) const;
+    // Damage of the current frame, flattened for eglSwapBuffersWithDamageEXT
+    std::vector<int> frame_rects() const;
+    // The current frame is on its way, start the next one
+    void end_frame();
+
+  private:
+    int width, height;
+    std::vector<DamageRect> current;
+    std::deque<std::vector<DamageRect>> history; // most recent first
+};
+
+#endif /* DAMAGE_H */
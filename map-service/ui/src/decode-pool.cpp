@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "decode-pool.hpp"
+#include "hmi-debug.h"
+
+DecodePool::DecodePool(unsigned threads)
+    : stopping(false), nqueued(0), next_worker(0),
+      ndecoded(0), nstolen(0), ncancelled(0), completed(nullptr)
+{
+    this->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (threads == 0)
+        threads = 1;
+    for (unsigned i = 0; i < threads; i++)
+        this->workers.emplace_back(new Worker());
+    /* Start only once every worker exists, they steal from each other */
+    for (unsigned i = 0; i < threads; i++)
+        this->workers[i]->thread = std::thread(&DecodePool::run, this, i);
+    HMI_DEBUG("decode", "%u decode workers", threads);
+}
+
+DecodePool::~DecodePool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->idle_mtx);
+        this->stopping = true;
+    }
+    this->idle.notify_all();
+    for (auto& w : this->workers)
+        w->thread.join();
+
+    DecodedTile* tile = this->take_completed();
+    while (tile) {
+        DecodedTile* next = tile->next;
+        delete tile;
+        tile = next;
+    }
+    close(this->efd);
+}
+
+void DecodePool::submit(const DecodeJob& job)
+{
+    unsigned i = this->next_worker.fetch_add(1, std::memory_order_relaxed) % this->workers.size();
+    Worker* w = this->workers[i].get();
+    {
+        std::lock_guard<std::mutex> lock(w->mtx);
+        (job.prefetch ? w->prefetches : w->jobs).push_back(job);
+    }
+    {
+        /* Counted under idle_mtx so a worker about to sleep sees it,
+         * and only once pushed: a worker claiming it will find a job */
+        std::lock_guard<std::mutex> lock(this->idle_mtx);
+        this->nqueued.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->idle.notify_one();
+}
+
+bool DecodePool::grab(unsigned self, DecodeJob* job)
+{
+    return this->grab_from(self, false, job) || this->grab_from(self, true, job);
+}
+
+bool DecodePool::grab_from(unsigned self, bool prefetch, DecodeJob* job)
+{
+    Worker* own = this->workers[self].get();
+    {
+        std::lock_guard<std::mutex> lock(own->mtx);
+        std::deque<DecodeJob>& jobs = prefetch ? own->prefetches : own->jobs;
+        if (!jobs.empty()) {
+            *job = std::move(jobs.back());
+            jobs.pop_back();
+            return true;
+        }
+    }
+    size_t n = this->workers.size();
+    for (size_t k = 1; k < n; k++) {
+        Worker* victim = this->workers[(self + k) % n].get();
+        std::lock_guard<std::mutex> lock(victim->mtx);
+        std::deque<DecodeJob>& jobs = prefetch ? victim->prefetches : victim->jobs;
+        if (!jobs.empty()) {
+            *job = std::move(jobs.front());
+            jobs.pop_front();
+            this->nstolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void DecodePool::run(unsigned self)
+{
+    DecodeJob job;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(this->idle_mtx);
+            this->idle.wait(lock, [this] {
+                return this->stopping || this->nqueued.load(std::memory_order_relaxed) > 0;
+            });
+            if (this->stopping)
+                return;
+            /* Claim a job before looking for it, a worker never searches
+             * for a job another one already took */
+            this->nqueued.fetch_sub(1, std::memory_order_relaxed);
+        }
+        /* Every claim has its job in some deque. A scan can still miss it
+         * while others take and push behind it, look again */
+        while (!this->grab(self, &job))
+            std::this_thread::yield();
+
+        DecodedTile* tile = new DecodedTile();
+        tile->key = job.key;
+        if (job.cancel && job.cancel->load(std::memory_order_relaxed)) {
+            /* Still returned, the render thread tracks what is in flight */
+            tile->ok = false;
+            tile->cancelled = true;
+            this->ncancelled.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            if (!mvt_decode(job.data, job.size, tile))
+                HMI_ERROR("decode", "tile %u/%u/%u is malformed", job.key.z, job.key.x, job.key.y);
+            this->ndecoded.fetch_add(1, std::memory_order_relaxed);
+        }
+        job.cancel.reset();
+        this->complete(tile);
+    }
+}
+
+void DecodePool::complete(DecodedTile* tile)
+{
+    DecodedTile* head = this->completed.load(std::memory_order_relaxed);
+    do {
+        tile->next = head;
+    } while (!this->completed.compare_exchange_weak(head, tile,
+                std::memory_order_release, std::memory_order_relaxed));
+    /* Only the first result of a batch wakes the render thread */
+    if (head == nullptr) {
+        uint64_t one = 1;
+        if (write(this->efd, &one, sizeof one) < 0)
+            HMI_ERROR("decode", "cannot wake the render thread");
+    }
+}
+
+DecodedTile* DecodePool::take_completed()
+{
+    /* Reset the fd before taking the list: a result pushed after the
+     * exchange finds it empty and wakes again */
+    uint64_t count;
+    if (read(this->efd, &count, sizeof count) < 0)
+        count = 0;
+    DecodedTile* tile = this->completed.exchange(nullptr, std::memory_order_acquire);
+
+    DecodedTile* ordered = nullptr;
+    while (tile) {
+        DecodedTile* next = tile->next;
+        tile->next = ordered;
+        ordered = tile;
+        tile = next;
+    }
+    return ordered;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DECODE_POOL_H
+#define DECODE_POOL_H
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "mvt-decode.hpp"
+
+/* Encoded tile to decode, data must stay valid until its result is taken.
+ * A prefetch is only decoded when no visible tile waits, and is dropped
+ * once *cancel is set. */
+typedef struct DecodeJob {
+    TileKey key;
+    const uint8_t* data;
+    size_t size;
+    bool prefetch;
+    std::shared_ptr<const std::atomic<bool>> cancel;
+} DecodeJob;
+
+/*
+ * Workers decoding vector tiles off the render thread.
+ * Each worker takes its newest job first and steals the oldest job of
+ * the others when it runs dry, so one slow tile never holds the rest.
+ * Visible tiles go before any prefetch, stale prefetches come back
+ * cancelled without being decoded.
+ * Results are pushed on a lock-free list and event_fd() turns readable;
+ * the render thread takes them and does the GL upload itself.
+ */
+class DecodePool {
+  public:
+    explicit DecodePool(unsigned threads);
+    ~DecodePool();
+    DecodePool(const DecodePool &) = delete;
+    DecodePool &operator=(const DecodePool &) = delete;
+
+    void submit(const DecodeJob& job);
+    // Readable while results are waiting, for the EventLoop
+    int event_fd() const { return this->efd; }
+    // Results in completion order linked by next, the caller deletes them
+    DecodedTile* take_completed();
+
+    size_t queued() const {
+        long n = this->nqueued.load(std::memory_order_relaxed);
+        return n > 0 ? (size_t)n : 0;
+    }
+    uint64_t decoded() const { return this->ndecoded.load(std::memory_order_relaxed); }
+    uint64_t stolen() const { return this->nstolen.load(std::memory_order_relaxed); }
+    uint64_t cancelled() const { return this->ncancelled.load(std::memory_order_relaxed); }
+
+  private:
+    struct Worker {
+        std::mutex mtx;
+        std::deque<DecodeJob> jobs;
+        std::deque<DecodeJob> prefetches;
+        std::thread thread;
+    };
+
+    void run(unsigned self);
+    bool grab(unsigned self, DecodeJob* job);
+    bool grab_from(unsigned self, bool prefetch, DecodeJob* job);
+    void complete(DecodedTile* tile);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex idle_mtx;
+    std::condition_variable idle;
+    bool stopping;
+    std::atomic<long> nqueued; // jobs pushed and not claimed, changed under idle_mtx
+    std::atomic<unsigned> next_worker;
+    std::atomic<uint64_t> ndecoded, nstolen, ncancelled;
+    std::atomic<DecodedTile*> completed; // newest first
+    int efd;
+};
+
+#endif /* DECODE_POOL_H */
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/epoll.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "event-loop.hpp"
+#include "hmi-debug.h"
+
+static const int _max_events = 16;
+
+EventLoop::EventLoop()
+    : epfd(epoll_create1(EPOLL_CLOEXEC)), next_timer(0)
+{
+    if(this->epfd < 0)
+        HMI_ERROR("event-loop", "epoll_create1 failed: %d", errno);
+}
+
+EventLoop::~EventLoop()
+{
+    if(this->epfd >= 0)
+        close(this->epfd);
+}
+
+uint64_t EventLoop::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int EventLoop::add_fd(int fd, uint32_t events, fd_handler handler)
+{
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    if(epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        HMI_ERROR("event-loop", "cannot watch fd %d: %d", fd, errno);
+        return -1;
+    }
+    this->fds[fd] = handler;
+    return 0;
+}
+
+unsigned EventLoop::add_timer(uint64_t delay_us, timer_handler handler)
+{
+    unsigned id = ++this->next_timer;
+    this->timers.emplace(now_us() + delay_us, Timer{id, handler});
+    return id;
+}
+
+void EventLoop::cancel_timer(unsigned id)
+{
+    for(auto it = this->timers.begin(); it != this->timers.end(); ++it) {
+        if(it->second.id == id) {
+            this->timers.erase(it);
+            return;
+        }
+    }
+}
+
+int EventLoop::wait(int timeout_ms)
+{
+    if(!this->timers.empty()) {
+        uint64_t now = now_us();
+        uint64_t first = this->timers.begin()->first;
+        // Round up, waking before the deadline would only spin
+        int until = (first <= now) ? 0 : (int)((first - now + 999) / 1000);
+        if(timeout_ms < 0 || until < timeout_ms)
+            timeout_ms = until;
+    }
+
+    struct epoll_event events[_max_events];
+    int n = epoll_wait(this->epfd, events, _max_events, timeout_ms);
+    this->ready_fds.clear();
+    if(n < 0) {
+        if(errno != EINTR)
+            HMI_ERROR("event-loop", "epoll_wait failed: %d", errno);
+        return (errno == EINTR) ? 0 : -1;
+    }
+    for(int i = 0; i < n; i++)
+        this->ready_fds.emplace_back((int)events[i].data.fd, (uint32_t)events[i].events);
+    return n;
+}
+
+bool EventLoop::ready(int fd) const
+{
+    for(const auto& r : this->ready_fds) {
+        if(r.first == fd)
+            return r.second != 0;
+    }
+    return false;
+}
+
+void EventLoop::dispatch()
+{
+    // Fds without a handler were read by the caller already
+    for(const auto& r : this->ready_fds) {
+        auto it = this->fds.find(r.first);
+        if(it == this->fds.end() || !it->second)
+            continue;
+        it->second(r.second);
+    }
+    this->ready_fds.clear();
+
+    uint64_t now = now_us();
+    std::vector<timer_handler> expired;
+    while(!this->timers.empty() && this->timers.begin()->first <= now) {
+        expired.push_back(std::move(this->timers.begin()->second.handler));
+        this->timers.erase(this->timers.begin());
+    }
+    for(auto& handler : expired)
+        handler();
+}
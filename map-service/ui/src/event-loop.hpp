@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+#include <functional>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * The one loop of the UI process, run by the render thread.
+ * File descriptors are multiplexed with epoll and timers shorten the wait,
+ * so every handler runs on the thread that owns the EGL context.
+ * wait() and dispatch() are split to let the caller finish the Wayland
+ * prepare_read/read_events protocol before any handler runs.
+ */
+class EventLoop {
+  public:
+    using fd_handler = std::function<void(uint32_t events)>;
+    using timer_handler = std::function<void()>;
+
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // handler may be empty for a fd the caller checks with ready()
+    int add_fd(int fd, uint32_t events, fd_handler handler);
+    // One shot timer, returns an id for cancel_timer()
+    unsigned add_timer(uint64_t delay_us, timer_handler handler);
+    void cancel_timer(unsigned id);
+
+    // Wait for fds at most timeout_ms (-1 for ever), cut short by timers
+    int wait(int timeout_ms);
+    bool ready(int fd) const;
+    // Run handlers of the ready fds and the expired timers
+    void dispatch();
+
+    static uint64_t now_us();
+
+  private:
+    struct Timer {
+        unsigned id;
+        timer_handler handler;
+    };
+
+    int epfd;
+    unsigned next_timer;
+    std::map<int, fd_handler> fds;
+    std::multimap<uint64_t, Timer> timers; // keyed by deadline
+    std::vector<std::pair<int, uint32_t>> ready_fds;
+};
+
+#endif /* EVENT_LOOP_H */
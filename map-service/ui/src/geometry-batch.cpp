@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <EGL/egl.h>
+#include "geometry-batch.hpp"
+#include "hmi-debug.h"
+
+/* Attribute locations, bound before linking */
+enum { ATTRIB_POS = 0, ATTRIB_CORNER = 1, ATTRIB_CLASS = 2 };
+
+/* Pixels of a tile at its own zoom level, and of a symbol */
+static const double _tile_px = 256;
+static const double _symbol_px = 8;
+
+static const char *_vert_shader_text =
+    "uniform vec4 tile;\n"      /* NDC of the tile origin, NDC per tile unit */
+    "uniform vec2 symbol;\n"    /* NDC half size of a symbol */
+    "uniform vec4 colors[7];\n" /* _class_colors */
+    "attribute vec2 pos;\n"
+    "attribute vec2 corner;\n"
+    "attribute float cls;\n"
+    "varying vec4 color;\n"
+    "void main() {\n"
+    "  color = colors[int(cls)];\n"
+    "  gl_Position = vec4(tile.xy + pos * tile.zw + corner * symbol, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *_frag_shader_text =
+    "precision mediump float;\n"
+    "varying vec4 color;\n"
+    "void main() {\n"
+    "  gl_FragColor = color;\n"
+    "}\n";
+
+/* Paint of the feature classes, then of symbols */
+static const GLfloat _class_colors[FEATURE_CLASSES + 1][4] = {
+    {0.60, 0.60, 0.60, 1.0}, // other
+    {0.45, 0.65, 0.90, 1.0}, // water
+    {0.70, 0.85, 0.60, 1.0}, // landuse
+    {0.80, 0.75, 0.70, 1.0}, // building
+    {1.00, 1.00, 1.00, 1.0}, // road
+    {0.70, 0.50, 0.80, 1.0}, // boundary
+    {0.90, 0.30, 0.20, 1.0}, // symbols
+};
+
+static_assert(FEATURE_CLASSES + 1 == 7, "colors[] of the vertex shader");
+
+/* Corners of a symbol, as a strip when instanced */
+static const GLfloat _quad[4][2] = {{-1, -1}, {1, -1}, {-1, 1}, {1, 1}};
+/* Same corners as two triangles, for quads expanded at upload */
+static const int _quad_triangles[6] = {0, 1, 2, 2, 1, 3};
+
+static GLuint compile(const char *source, GLenum type)
+{
+    GLuint shader = glCreateShader(type);
+    GLint status;
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        char log[1000];
+        GLsizei len;
+        glGetShaderInfoLog(shader, sizeof log, &len, log);
+        HMI_ERROR("batch", "compiling %s: %*s",
+            type == GL_VERTEX_SHADER ? "vertex" : "fragment", len, log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+GeometryBatch::GeometryBatch()
+    : program(0), tile_uniform(-1), symbol_uniform(-1), colors_uniform(-1),
+      quad_buffer(0), draw_instanced(nullptr), attrib_divisor(nullptr)
+{
+}
+
+bool GeometryBatch::init()
+{
+    GLuint vert = compile(_vert_shader_text, GL_VERTEX_SHADER);
+    GLuint frag = compile(_frag_shader_text, GL_FRAGMENT_SHADER);
+    if (!vert || !frag)
+        return false;
+
+    GLint status;
+    this->program = glCreateProgram();
+    glAttachShader(this->program, vert);
+    glAttachShader(this->program, frag);
+    glBindAttribLocation(this->program, ATTRIB_POS, "pos");
+    glBindAttribLocation(this->program, ATTRIB_CORNER, "corner");
+    glBindAttribLocation(this->program, ATTRIB_CLASS, "cls");
+    glLinkProgram(this->program);
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+    glGetProgramiv(this->program, GL_LINK_STATUS, &status);
+    if (!status) {
+        HMI_ERROR("batch", "cannot link the tile program");
+        glDeleteProgram(this->program);
+        this->program = 0;
+        return false;
+    }
+    this->tile_uniform = glGetUniformLocation(this->program, "tile");
+    this->symbol_uniform = glGetUniformLocation(this->program, "symbol");
+    this->colors_uniform = glGetUniformLocation(this->program, "colors");
+
+    /* ES2 has no instancing of its own, take it from an extension */
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    if (extensions && strstr(extensions, "GL_EXT_instanced_arrays")) {
+        this->draw_instanced = (PFN_DRAW_ARRAYS_INSTANCED)eglGetProcAddress("glDrawArraysInstancedEXT");
+        this->attrib_divisor = (PFN_VERTEX_ATTRIB_DIVISOR)eglGetProcAddress("glVertexAttribDivisorEXT");
+    } else if (extensions && strstr(extensions, "GL_ANGLE_instanced_arrays")) {
+        this->draw_instanced = (PFN_DRAW_ARRAYS_INSTANCED)eglGetProcAddress("glDrawArraysInstancedANGLE");
+        this->attrib_divisor = (PFN_VERTEX_ATTRIB_DIVISOR)eglGetProcAddress("glVertexAttribDivisorANGLE");
+    }
+    if (!this->draw_instanced || !this->attrib_divisor)
+        this->draw_instanced = nullptr;
+
+    glGenBuffers(1, &this->quad_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, this->quad_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof _quad, _quad, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    HMI_DEBUG("batch", "symbols are %s", this->instanced() ? "instanced" : "expanded");
+    return true;
+}
+
+void GeometryBatch::fini()
+{
+    if (this->quad_buffer)
+        glDeleteBuffers(1, &this->quad_buffer);
+    if (this->program)
+        glDeleteProgram(this->program);
+    this->quad_buffer = 0;
+    this->program = 0;
+}
+
+GpuTile GeometryBatch::upload(const DecodedTile& tile)
+{
+    GpuTile gpu = { 0 };
+
+    if (!tile.indices.empty()) {
+        GLuint buffers[2];
+        glGenBuffers(2, buffers);
+        gpu.vertex_buffer = buffers[0];
+        gpu.index_buffer = buffers[1];
+        gpu.index_count = tile.indices.size();
+        /* Positions, then the class of every vertex: a feature has its
+         * own vertices, so a vertex is in one class only */
+        size_t count = tile.vertices.size() / 2;
+        size_t positions = tile.vertices.size() * sizeof(float);
+        std::vector<uint8_t> classes(count, 0);
+        for (const IndexRange& r : tile.ranges) {
+            for (uint32_t i = r.first; i < r.first + r.count; i++)
+                classes[tile.indices[i]] = r.cls;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, gpu.vertex_buffer);
+        glBufferData(GL_ARRAY_BUFFER, positions + count, NULL, GL_STATIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, positions, tile.vertices.data());
+        glBufferSubData(GL_ARRAY_BUFFER, positions, count, classes.data());
+        gpu.class_offset = positions;
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpu.index_buffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, tile.indices.size() * sizeof(uint16_t),
+                     tile.indices.data(), GL_STATIC_DRAW);
+        gpu.bytes += positions + count + tile.indices.size() * sizeof(uint16_t);
+    }
+
+    if (!tile.points.empty()) {
+        gpu.symbol_count = tile.points.size() / 2;
+        glGenBuffers(1, &gpu.symbol_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, gpu.symbol_buffer);
+        if (this->instanced()) {
+            /* One position per instance */
+            glBufferData(GL_ARRAY_BUFFER, tile.points.size() * sizeof(float),
+                         tile.points.data(), GL_STATIC_DRAW);
+            gpu.bytes += tile.points.size() * sizeof(float);
+        } else {
+            /* pos, corner for the six vertices of every quad */
+            std::vector<float> quads;
+            quads.reserve(gpu.symbol_count * 6 * 4);
+            for (GLsizei i = 0; i < gpu.symbol_count; i++) {
+                for (int v : _quad_triangles) {
+                    quads.push_back(tile.points[2 * i]);
+                    quads.push_back(tile.points[2 * i + 1]);
+                    quads.push_back(_quad[v][0]);
+                    quads.push_back(_quad[v][1]);
+                }
+            }
+            glBufferData(GL_ARRAY_BUFFER, quads.size() * sizeof(float), quads.data(), GL_STATIC_DRAW);
+            gpu.bytes += quads.size() * sizeof(float);
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    return gpu;
+}
+
+unsigned GeometryBatch::draw(const std::vector<std::pair<TileKey, const GpuTile*>>& tiles,
+                             const struct camera& cam, int width, int height)
+{
+    if (!this->program || tiles.empty())
+        return 0;
+
+    unsigned draws = 0;
+    double wx, wy;
+    camera_world(cam.lon, cam.lat, &wx, &wy);
+    /* NDC per world unit, world y grows southwards */
+    double world_px = _tile_px * pow(2.0, cam.zoom);
+    double sx = 2 * world_px / width, sy = -2 * world_px / height;
+
+    /* Tile placement, same for every class of a tile */
+    std::vector<GLfloat> placement(tiles.size() * 4);
+    for (size_t i = 0; i < tiles.size(); i++) {
+        const TileKey& key = tiles[i].first;
+        double n = (double)(1u << key.z);
+        double dx = key.x / n - wx;
+        if (dx > 0.5)
+            dx -= 1.0;
+        else if (dx < -0.5)
+            dx += 1.0;
+        placement[4 * i + 0] = dx * sx;
+        placement[4 * i + 1] = (key.y / n - wy) * sy;
+        placement[4 * i + 2] = sx / n;
+        placement[4 * i + 3] = sy / n;
+    }
+
+    glUseProgram(this->program);
+    glUniform4fv(this->colors_uniform, FEATURE_CLASSES + 1, &_class_colors[0][0]);
+    glUniform2f(this->symbol_uniform, 0, 0);
+    glDisableVertexAttribArray(ATTRIB_CORNER);
+    glVertexAttrib2f(ATTRIB_CORNER, 0, 0);
+    glEnableVertexAttribArray(ATTRIB_POS);
+    glEnableVertexAttribArray(ATTRIB_CLASS);
+
+    /* Every class of a tile in one call, the vertices carry the color */
+    for (size_t i = 0; i < tiles.size(); i++) {
+        const GpuTile* tile = tiles[i].second;
+        if (!tile->index_count)
+            continue;
+        glUniform4fv(this->tile_uniform, 1, &placement[4 * i]);
+        glBindBuffer(GL_ARRAY_BUFFER, tile->vertex_buffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tile->index_buffer);
+        glVertexAttribPointer(ATTRIB_POS, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glVertexAttribPointer(ATTRIB_CLASS, 1, GL_UNSIGNED_BYTE, GL_FALSE, 0,
+                              (const void *)(uintptr_t)tile->class_offset);
+        glDrawElements(GL_LINES, tile->index_count, GL_UNSIGNED_SHORT, 0);
+        draws++;
+    }
+
+    /* Symbols on top, one call per tile */
+    glDisableVertexAttribArray(ATTRIB_CLASS);
+    glVertexAttrib1f(ATTRIB_CLASS, FEATURE_CLASSES);
+    glUniform2f(this->symbol_uniform, _symbol_px / width, _symbol_px / height);
+    glEnableVertexAttribArray(ATTRIB_CORNER);
+    for (size_t i = 0; i < tiles.size(); i++) {
+        const GpuTile* tile = tiles[i].second;
+        if (!tile->symbol_count)
+            continue;
+        glUniform4fv(this->tile_uniform, 1, &placement[4 * i]);
+        if (this->instanced()) {
+            glBindBuffer(GL_ARRAY_BUFFER, tile->symbol_buffer);
+            glVertexAttribPointer(ATTRIB_POS, 2, GL_FLOAT, GL_FALSE, 0, 0);
+            this->attrib_divisor(ATTRIB_POS, 1);
+            glBindBuffer(GL_ARRAY_BUFFER, this->quad_buffer);
+            glVertexAttribPointer(ATTRIB_CORNER, 2, GL_FLOAT, GL_FALSE, 0, 0);
+            this->draw_instanced(GL_TRIANGLE_STRIP, 0, 4, tile->symbol_count);
+            this->attrib_divisor(ATTRIB_POS, 0);
+        } else {
+            glBindBuffer(GL_ARRAY_BUFFER, tile->symbol_buffer);
+            glVertexAttribPointer(ATTRIB_POS, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
+            glVertexAttribPointer(ATTRIB_CORNER, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float),
+                                  (const void *)(2 * sizeof(float)));
+            glDrawArrays(GL_TRIANGLES, 0, tile->symbol_count * 6);
+        }
+        draws++;
+    }
+
+    glDisableVertexAttribArray(ATTRIB_POS);
+    glDisableVertexAttribArray(ATTRIB_CORNER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    return draws;
+}
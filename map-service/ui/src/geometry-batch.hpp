@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GEOMETRY_BATCH_H
+#define GEOMETRY_BATCH_H
+#include <utility>
+#include <vector>
+#include <GLES2/gl2.h>
+#include "camera.hpp"
+#include "mvt-decode.hpp"
+
+typedef void (GL_APIENTRYP PFN_DRAW_ARRAYS_INSTANCED)(GLenum mode, GLint first, GLsizei count, GLsizei primcount);
+typedef void (GL_APIENTRYP PFN_VERTEX_ATTRIB_DIVISOR)(GLuint index, GLuint divisor);
+
+/*
+ * Draws tile geometry out of buffer objects.
+ * upload() puts a decoded tile in a vertex and an index buffer, every
+ * vertex carrying the feature class the shader picks its color by, so
+ * draw() issues one call for the lines of a tile. Tiles are not merged,
+ * each keeps its buffers for the TileCache to evict. Symbols are one
+ * instanced quad per tile with GL_EXT_instanced_arrays or
+ * GL_ANGLE_instanced_arrays, quads expanded at upload otherwise.
+ * Only use it on the GL thread with the shared context current.
+ */
+class GeometryBatch {
+  public:
+    GeometryBatch();
+    GeometryBatch(const GeometryBatch &) = delete;
+    GeometryBatch &operator=(const GeometryBatch &) = delete;
+
+    // Builds the program and the symbol quad, false if GL refused
+    bool init();
+    void fini();
+    bool instanced() const { return this->draw_instanced != nullptr; }
+
+    // Buffers of tile for the TileCache, all 0 for an empty tile
+    GpuTile upload(const DecodedTile& tile);
+    // Draws tiles as seen by cam, returns the number of draw calls
+    unsigned draw(const std::vector<std::pair<TileKey, const GpuTile*>>& tiles,
+                  const struct camera& cam, int width, int height);
+
+  private:
+    GLuint program;
+    GLint tile_uniform, symbol_uniform, colors_uniform;
+    GLuint quad_buffer; // corners of the instanced symbol quad
+    PFN_DRAW_ARRAYS_INSTANCED draw_instanced;
+    PFN_VERTEX_ATTRIB_DIVISOR attrib_divisor;
+};
+
+#endif /* GEOMETRY_BATCH_H */
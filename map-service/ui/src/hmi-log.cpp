@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <errno.h>
+#include <mutex>
+#include <thread>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include "hmi-debug.h"
+#include "hmi-log-format.h"
+
+/* Text of a message longer than this is cut */
+static const size_t _msg_max = 1024;
+/* Records per thread, a power of two */
+static const size_t _ring_size = 256;
+/* Idle wait of the writer thread when it has no eventfd to sleep on */
+static const long _idle_wait_ns = 20 * 1000 * 1000;
+
+namespace {
+
+/* The message is made from fmt and args by the writer */
+struct Record {
+    uint64_t time_us;
+    const char* file;
+    const char* func;
+    const char* prefix;
+    const char* fmt;
+    int line;
+    uint8_t level;
+    uint16_t args_len;
+    unsigned char args[HMI_LOG_ARGS_MAX];
+};
+
+/* Written by its thread only, read by the writer thread only */
+struct Ring {
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> dead; // its thread exited, freed once drained
+    Ring* next; // pushed rings are linked before this, under the drain lock after
+    Record records[_ring_size];
+    Ring() : head(0), tail(0), dropped(0), dead(false), next(NULL) {}
+};
+
+/* Hands the ring of a thread back when the thread exits */
+struct RingOwner {
+    Ring* ring;
+    ~RingOwner() {
+        if (ring != NULL)
+            ring->dead.store(true, std::memory_order_release);
+    }
+};
+
+class Logger {
+  public:
+    Logger();
+    ~Logger();
+    Ring* ring();
+    // A record was published, wakes the writer if it sleeps
+    void published();
+    void flush();
+  private:
+    void run();
+    size_t drain();
+    bool pending();
+    void unlink(Ring* ring);
+    void write(const Record& r);
+
+    std::mutex mtx; // one drain at a time, guards the output and unlinking
+    std::atomic<Ring*> rings; // pushed by their threads, removed by drain
+    std::atomic<bool> stopping;
+    std::atomic<bool> sleeping;
+    int wake_fd;
+    FILE* binary;
+    std::thread writer;
+};
+
+}
+
+int hmi_log_level(void)
+{
+    /* Initialized on first use, logging from static constructors works */
+    static const int level = [] {
+        const char* env = getenv("USE_HMI_DEBUG");
+        return (env == NULL) ? (int)LOG_LEVEL_ERROR : atoi(env);
+    }();
+    return level;
+}
+
+static Logger& logger()
+{
+    static Logger instance;
+    return instance;
+}
+
+Logger::Logger()
+    : rings(NULL), stopping(false), sleeping(false), binary(NULL)
+{
+    this->wake_fd = eventfd(0, EFD_CLOEXEC);
+    const char* path = getenv("HMI_LOG_BINARY");
+    if (path != NULL && *path != '\0') {
+        this->binary = fopen(path, "wb");
+        if (this->binary)
+            fwrite(HMI_LOG_MAGIC, 1, HMI_LOG_MAGIC_LEN, this->binary);
+        else
+            fprintf(stderr, "cannot open %s, logging as text\n", path);
+    }
+    this->writer = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger()
+{
+    this->stopping.store(true);
+    if (this->wake_fd >= 0)
+        eventfd_write(this->wake_fd, 1);
+    if (this->writer.joinable())
+        this->writer.join();
+    this->drain();
+    if (this->binary)
+        fclose(this->binary);
+    if (this->wake_fd >= 0)
+        close(this->wake_fd);
+    Ring* r = this->rings.load();
+    while (r != NULL) {
+        Ring* next = r->next;
+        delete r;
+        r = next;
+    }
+}
+
+Ring* Logger::ring()
+{
+    /* Records a thread left behind are still written, then its ring is
+     * freed by drain(). A new ring is pushed without the drain lock, a
+     * thread never waits for the output */
+    static thread_local RingOwner mine = {NULL};
+    if (mine.ring == NULL) {
+        Ring* ring = new Ring();
+        Ring* first = this->rings.load(std::memory_order_relaxed);
+        do {
+            ring->next = first;
+        } while (!this->rings.compare_exchange_weak(first, ring, std::memory_order_release,
+                                                    std::memory_order_relaxed));
+        mine.ring = ring;
+    }
+    return mine.ring;
+}
+
+/* Called with the drain lock, threads only ever push in front */
+void Logger::unlink(Ring* ring)
+{
+    Ring* first = ring;
+    if (this->rings.compare_exchange_strong(first, ring->next, std::memory_order_acq_rel))
+        return;
+    for (Ring* prev = first; prev != NULL; prev = prev->next) {
+        if (prev->next == ring) {
+            prev->next = ring->next;
+            return;
+        }
+    }
+}
+
+void Logger::published()
+{
+    /* Pairs with run(): either the writer sees the new tail before it
+     * sleeps, or this sees it sleeping and wakes it */
+    if (this->sleeping.load() && this->sleeping.exchange(false))
+        eventfd_write(this->wake_fd, 1);
+}
+
+void Logger::write(const Record& r)
+{
+    if (this->binary) {
+        /* Not even formatted here, hmi-log-expand does it */
+        struct hmi_log_record h;
+        size_t file_len = strnlen(r.file, 255);
+        size_t func_len = strnlen(r.func, 255);
+        size_t prefix_len = strnlen(r.prefix, 255);
+        size_t fmt_len = strnlen(r.fmt, 65535);
+        h.time_us = r.time_us;
+        h.line = r.line;
+        h.level = r.level;
+        h.file_len = file_len;
+        h.func_len = func_len;
+        h.prefix_len = prefix_len;
+        h.args_len = r.args_len;
+        h.fmt_len = fmt_len;
+        fwrite(&h, sizeof(h), 1, this->binary);
+        fwrite(r.file, 1, file_len, this->binary);
+        fwrite(r.func, 1, func_len, this->binary);
+        fwrite(r.prefix, 1, prefix_len, this->binary);
+        fwrite(r.fmt, 1, fmt_len, this->binary);
+        fwrite(r.args, 1, r.args_len, this->binary);
+        return;
+    }
+    char msg[_msg_max];
+    hmi_log_expand(r.fmt, r.args, r.args_len, msg, sizeof(msg));
+    fprintf(stderr, "[%10.3f] [%s %s] [%s, %s(), Line:%d] >>> %s \n",
+            (r.time_us % 1000000000ULL) / 1000.0, r.prefix, hmi_log_level_names[r.level],
+            r.file, r.func, r.line, msg);
+}
+
+size_t Logger::drain()
+{
+    size_t n = 0;
+    std::lock_guard<std::mutex> lock(this->mtx);
+    Ring* next;
+    for (Ring* ring = this->rings.load(std::memory_order_acquire); ring != NULL; ring = next) {
+        next = ring->next;
+        /* Read before the tail, a dead ring gets no record after it */
+        bool dead = ring->dead.load(std::memory_order_acquire);
+        size_t head = ring->head.load(std::memory_order_relaxed);
+        size_t tail = ring->tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head, ++n)
+            this->write(ring->records[head & (_ring_size - 1)]);
+        ring->head.store(head, std::memory_order_release);
+
+        uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped != 0)
+            fprintf(stderr, "[hmi-log] %llu records dropped\n", (unsigned long long)dropped);
+        if (dead) {
+            this->unlink(ring);
+            delete ring;
+        }
+    }
+    if (n != 0)
+        fflush(this->binary ? this->binary : stderr);
+    return n;
+}
+
+bool Logger::pending()
+{
+    std::lock_guard<std::mutex> lock(this->mtx);
+    for (Ring* ring = this->rings.load(std::memory_order_acquire); ring != NULL; ring = ring->next) {
+        if (ring->tail.load() != ring->head.load(std::memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+void Logger::run()
+{
+    while (!this->stopping.load(std::memory_order_relaxed)) {
+        if (this->drain() != 0)
+            continue;
+        if (this->wake_fd < 0) {
+            struct timespec ts = {0, _idle_wait_ns};
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        /* Sleep until a thread publishes into an empty ring */
+        this->sleeping.store(true);
+        if (this->pending() || this->stopping.load()) {
+            this->sleeping.store(false);
+            continue;
+        }
+        eventfd_t count;
+        eventfd_read(this->wake_fd, &count);
+        this->sleeping.store(false);
+    }
+}
+
+void Logger::flush()
+{
+    this->drain();
+}
+
+static bool put(unsigned char* args, size_t* len, const void* v, size_t n)
+{
+    if (HMI_LOG_ARGS_MAX - *len < n)
+        return false;
+    memcpy(args + *len, v, n);
+    *len += n;
+    return true;
+}
+
+static int64_t signed_arg(char size, va_list* ap)
+{
+    switch (size) {
+    case 'H': return (signed char)va_arg(*ap, int);
+    case 'h': return (short)va_arg(*ap, int);
+    case 'l': return va_arg(*ap, long);
+    case 'q': case 'L': return va_arg(*ap, long long);
+    case 'j': return va_arg(*ap, intmax_t);
+    case 'z': return va_arg(*ap, ssize_t);
+    case 't': return va_arg(*ap, ptrdiff_t);
+    default: return va_arg(*ap, int);
+    }
+}
+
+static uint64_t unsigned_arg(char size, va_list* ap)
+{
+    switch (size) {
+    case 'H': return (unsigned char)va_arg(*ap, unsigned);
+    case 'h': return (unsigned short)va_arg(*ap, unsigned);
+    case 'l': return va_arg(*ap, unsigned long);
+    case 'q': case 'L': return va_arg(*ap, unsigned long long);
+    case 'j': return va_arg(*ap, uintmax_t);
+    case 'z': return va_arg(*ap, size_t);
+    case 't': return va_arg(*ap, ptrdiff_t);
+    default: return va_arg(*ap, unsigned);
+    }
+}
+
+/* Copy the arguments of fmt as hmi-log-format.h lays them out, returns
+ * their length. Only the strings are copied, nothing is formatted */
+static size_t capture(const char* fmt, va_list* ap, int err, unsigned char* args)
+{
+    struct hmi_log_spec spec;
+    size_t len = 0;
+    while ((fmt = hmi_log_next_spec(fmt, &spec)) != NULL) {
+        for (int i = 0; i < spec.stars; i++) {
+            int64_t star = va_arg(*ap, int);
+            if (!put(args, &len, &star, sizeof(star)))
+                return len;
+        }
+        union { int64_t i; uint64_t u; double d; } v;
+        switch (spec.arg) {
+        case HMI_LOG_ARG_NONE:
+            continue;
+        case HMI_LOG_ARG_SKIP:
+            va_arg(*ap, void*);
+            continue;
+        case HMI_LOG_ARG_SIGNED:
+            v.i = signed_arg(spec.size, ap);
+            break;
+        case HMI_LOG_ARG_UNSIGNED:
+            v.u = unsigned_arg(spec.size, ap);
+            break;
+        case HMI_LOG_ARG_DOUBLE:
+            v.d = (spec.size == 'L') ? (double)va_arg(*ap, long double) : va_arg(*ap, double);
+            break;
+        case HMI_LOG_ARG_POINTER:
+            v.u = (uintptr_t)va_arg(*ap, void*);
+            break;
+        case HMI_LOG_ARG_STRING: {
+            const char* str = (spec.conv == 'm') ? strerror(err) : va_arg(*ap, const char*);
+            if (str == NULL)
+                str = "(null)";
+            if (HMI_LOG_ARGS_MAX - len <= sizeof(uint16_t))
+                return len;
+            /* A long string is cut, the conversions after it are lost */
+            uint16_t n = strnlen(str, HMI_LOG_ARGS_MAX - len - sizeof(uint16_t));
+            put(args, &len, &n, sizeof(n));
+            put(args, &len, str, n);
+            continue;
+        }
+        }
+        if (!put(args, &len, &v, sizeof(v)))
+            return len;
+    }
+    return len;
+}
+
+void _HMI_LOG(enum LOG_LEVEL level, const char* file, const char* func, const int line, const char* prefix, const char* log, ...)
+{
+    int err = errno;
+    Ring* ring = logger().ring();
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail - ring->head.load(std::memory_order_acquire) == _ring_size) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Record& r = ring->records[tail & (_ring_size - 1)];
+    struct timespec tp;
+    clock_gettime(CLOCK_REALTIME, &tp);
+    r.time_us = (uint64_t)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+    r.file = file;
+    r.func = func;
+    r.prefix = prefix ? prefix : "";
+    r.fmt = log ? log : "";
+    r.line = line;
+    r.level = (level > LOG_LEVEL_MAX) ? LOG_LEVEL_MAX : level;
+
+    va_list args;
+    va_start(args, log);
+    r.args_len = capture(r.fmt, &args, err, r.args);
+    va_end(args);
+
+    ring->tail.store(tail + 1);
+    logger().published();
+}
+
+void hmi_log_flush(void)
+{
+    logger().flush();
+}
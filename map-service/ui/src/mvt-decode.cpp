@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "mvt-decode.hpp"
+
+namespace {
+
+/* Wire types of protobuf */
+enum { PB_VARINT = 0, PB_FIXED64 = 1, PB_BYTES = 2, PB_FIXED32 = 5 };
+
+/* Fields of vector_tile.proto */
+enum { TILE_LAYERS = 3 };
+enum { LAYER_NAME = 1, LAYER_FEATURES = 2, LAYER_EXTENT = 5 };
+enum { FEATURE_TYPE = 3, FEATURE_GEOMETRY = 4 };
+enum { GEOM_POINT = 1, GEOM_LINESTRING = 2, GEOM_POLYGON = 3 };
+enum { CMD_MOVE_TO = 1, CMD_LINE_TO = 2, CMD_CLOSE_PATH = 7 };
+
+/* Forward only reader over one message, every read is bounds checked */
+class PbReader {
+  public:
+    PbReader(const uint8_t* data, size_t size)
+        : p(data), end(data + size), failed(false) {}
+
+    bool at_end() const { return this->p >= this->end || this->failed; }
+    bool ok() const { return !this->failed; }
+    const uint8_t* data() const { return this->p; }
+    size_t remaining() const { return this->at_end() ? 0 : this->end - this->p; }
+
+    bool next(uint32_t* field, uint32_t* wire) {
+        if (this->at_end())
+            return false;
+        uint64_t tag = this->varint();
+        *field = (uint32_t)(tag >> 3);
+        *wire = (uint32_t)(tag & 7);
+        return !this->failed;
+    }
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (this->p >= this->end)
+                break;
+            uint8_t b = *this->p++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        this->failed = true;
+        return 0;
+    }
+
+    PbReader bytes() {
+        uint64_t n = this->varint();
+        if (this->failed || n > (uint64_t)(this->end - this->p)) {
+            this->failed = true;
+            return PbReader(this->end, 0);
+        }
+        PbReader sub(this->p, (size_t)n);
+        this->p += n;
+        return sub;
+    }
+
+    void skip(uint32_t wire) {
+        size_t n;
+        switch (wire) {
+        case PB_VARINT: this->varint(); return;
+        case PB_FIXED64: n = 8; break;
+        case PB_FIXED32: n = 4; break;
+        case PB_BYTES: this->bytes(); return;
+        default: this->failed = true; return;
+        }
+        if (n > (size_t)(this->end - this->p))
+            this->failed = true;
+        else
+            this->p += n;
+    }
+
+  private:
+    const uint8_t* p;
+    const uint8_t* end;
+    bool failed;
+};
+
+inline int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)((v >> 1) ^ (~(v & 1) + 1));
+}
+
+class GeometryBuilder {
+  public:
+    typedef std::vector<uint16_t> ClassIndices[FEATURE_CLASSES];
+
+    GeometryBuilder(DecodedTile* out, ClassIndices& indices, feature_class cls, float scale)
+        : out(out), indices(indices[cls]), scale(scale) {}
+
+    bool feature(uint32_t type, PbReader geometry) {
+        int32_t x = 0, y = 0;
+        size_t first = 0;   // vertex that starts the current ring or line
+        bool open = false;
+
+        while (!geometry.at_end()) {
+            uint32_t cmd = (uint32_t)geometry.varint();
+            uint32_t id = cmd & 7, count = cmd >> 3;
+            if (id == CMD_CLOSE_PATH) {
+                if (open && type == GEOM_POLYGON)
+                    this->segment(this->vertex_count() - 1, first);
+                continue;
+            }
+            if (id != CMD_MOVE_TO && id != CMD_LINE_TO)
+                return false;
+            for (uint32_t i = 0; i < count && geometry.ok(); i++) {
+                x += unzigzag((uint32_t)geometry.varint());
+                y += unzigzag((uint32_t)geometry.varint());
+                float fx = x * this->scale, fy = y * this->scale;
+                if (type == GEOM_POINT) {
+                    this->out->points.push_back(fx);
+                    this->out->points.push_back(fy);
+                    continue;
+                }
+                if (!this->add_vertex(fx, fy))
+                    return true;
+                if (id == CMD_MOVE_TO) {
+                    first = this->vertex_count() - 1;
+                    open = true;
+                } else if (open) {
+                    this->segment(this->vertex_count() - 2, this->vertex_count() - 1);
+                }
+            }
+        }
+        return geometry.ok();
+    }
+
+  private:
+    size_t vertex_count() const { return this->out->vertices.size() / 2; }
+
+    bool add_vertex(float x, float y) {
+        if (this->vertex_count() >= 65536) {
+            this->out->truncated = true;
+            return false;
+        }
+        this->out->vertices.push_back(x);
+        this->out->vertices.push_back(y);
+        return true;
+    }
+
+    void segment(size_t a, size_t b) {
+        this->indices.push_back((uint16_t)a);
+        this->indices.push_back((uint16_t)b);
+    }
+
+    DecodedTile* out;
+    std::vector<uint16_t>& indices;
+    float scale;
+};
+
+bool decode_layer(PbReader layer, DecodedTile* out, GeometryBuilder::ClassIndices& indices)
+{
+    /* extent and name may follow the features, find them first */
+    uint32_t extent = 4096;
+    feature_class cls = FEATURE_OTHER;
+    uint32_t field, wire;
+    PbReader scan = layer;
+    while (scan.next(&field, &wire)) {
+        if (field == LAYER_EXTENT && wire == PB_VARINT) {
+            extent = (uint32_t)scan.varint();
+        } else if (field == LAYER_NAME && wire == PB_BYTES) {
+            PbReader name = scan.bytes();
+            cls = mvt_feature_class((const char*)name.data(), name.remaining());
+        } else {
+            scan.skip(wire);
+        }
+    }
+    if (!scan.ok() || extent == 0)
+        return false;
+
+    GeometryBuilder builder(out, indices, cls, 1.0f / extent);
+    while (layer.next(&field, &wire)) {
+        if (field != LAYER_FEATURES || wire != PB_BYTES) {
+            layer.skip(wire);
+            continue;
+        }
+        PbReader feature = layer.bytes();
+        uint32_t type = 0;
+        PbReader geometry(nullptr, 0);
+        while (feature.next(&field, &wire)) {
+            if (field == FEATURE_TYPE && wire == PB_VARINT)
+                type = (uint32_t)feature.varint();
+            else if (field == FEATURE_GEOMETRY && wire == PB_BYTES)
+                geometry = feature.bytes();
+            else
+                feature.skip(wire);
+        }
+        if (!feature.ok())
+            return false;
+        if (type < GEOM_POINT || type > GEOM_POLYGON)
+            continue;
+        if (!builder.feature(type, geometry))
+            return false;
+        if (out->truncated)
+            return true;
+    }
+    return layer.ok();
+}
+
+} // namespace
+
+feature_class mvt_feature_class(const char* name, size_t len)
+{
+    static const struct {
+        const char* name;
+        feature_class cls;
+    } classes[] = {
+        {"water", FEATURE_WATER},
+        {"waterway", FEATURE_WATER},
+        {"landuse", FEATURE_LANDUSE},
+        {"landcover", FEATURE_LANDUSE},
+        {"park", FEATURE_LANDUSE},
+        {"building", FEATURE_BUILDING},
+        {"road", FEATURE_ROAD},
+        {"transportation", FEATURE_ROAD},
+        {"boundary", FEATURE_BOUNDARY},
+        {"admin", FEATURE_BOUNDARY},
+    };
+    for (const auto& c : classes) {
+        if (strlen(c.name) == len && memcmp(c.name, name, len) == 0)
+            return c.cls;
+    }
+    return FEATURE_OTHER;
+}
+
+bool mvt_decode(const uint8_t* data, size_t size, DecodedTile* out)
+{
+    PbReader tile(data, size);
+    uint32_t field, wire;
+    GeometryBuilder::ClassIndices indices;
+
+    out->ok = false;
+    out->truncated = false;
+    out->cancelled = false;
+    out->vertices.clear();
+    out->indices.clear();
+    out->ranges.clear();
+    out->points.clear();
+    while (tile.next(&field, &wire)) {
+        if (field != TILE_LAYERS || wire != PB_BYTES) {
+            tile.skip(wire);
+            continue;
+        }
+        if (!decode_layer(tile.bytes(), out, indices))
+            return false;
+        if (out->truncated)
+            break;
+    }
+
+    /* One range per class, in painting order */
+    for (int cls = 0; cls < FEATURE_CLASSES; cls++) {
+        if (indices[cls].empty())
+            continue;
+        IndexRange range = {(uint8_t)cls, (uint32_t)out->indices.size(), (uint32_t)indices[cls].size()};
+        out->ranges.push_back(range);
+        out->indices.insert(out->indices.end(), indices[cls].begin(), indices[cls].end());
+    }
+    out->ok = tile.ok();
+    return out->ok;
+}
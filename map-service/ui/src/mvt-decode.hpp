@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MVT_DECODE_H
+#define MVT_DECODE_H
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "tile-cache.hpp"
+
+/* Indices of one feature class */
+typedef struct IndexRange {
+    uint8_t cls;
+    uint32_t first, count;
+} IndexRange;
+
+/*
+ * Geometry of one Mapbox Vector Tile, ready for glBufferData.
+ * Coordinates are scaled to [0, 1] over the tile extent. Lines and the
+ * rings of polygons are GL_LINES segments over vertices, grouped by the
+ * feature class of their layer into ranges. Points are kept apart for
+ * symbols. Indices are 16 bit as ES2 requires, geometry beyond
+ * 65536 vertices is dropped and truncated is set.
+ */
+typedef struct DecodedTile {
+    TileKey key;
+    bool ok;
+    bool truncated;
+    bool cancelled;                 // prefetch went stale, nothing decoded
+    std::vector<float> vertices;    // x, y
+    std::vector<uint16_t> indices;  // pairs of vertices
+    std::vector<IndexRange> ranges; // of indices, one per class present
+    std::vector<float> points;      // x, y
+    DecodedTile* next;              // link of the completion queue
+} DecodedTile;
+
+// Class of the features of a layer, by the usual layer names
+feature_class mvt_feature_class(const char* name, size_t len);
+
+// Fills out from the protobuf encoded tile, false on malformed data
+bool mvt_decode(const uint8_t* data, size_t size, DecodedTile* out);
+
+#endif /* MVT_DECODE_H */
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include "prefetcher.hpp"
+
+/* Pixels of a tile at its own zoom level */
+static const double _tile_px = 256;
+static const int _max_zoom = 22;
+/* Prefetches of one plan on top of the visible tiles: motion and route
+ * may take the first share, zooming out and in get at least the rest */
+static const size_t _ahead_prefetch = 64, _max_prefetch = 96;
+
+Prefetcher::Prefetcher(double lookahead_s)
+    : lookahead_s(lookahead_s), has_sample(false), last_us(0),
+      last_wx(0), last_wy(0), vx(0), vy(0),
+      nentered(0), nresident(0)
+{
+}
+
+void Prefetcher::set_route(const std::vector<std::pair<double, double>>& lonlat)
+{
+    this->route.clear();
+    for (const auto& p : lonlat) {
+        double wx, wy;
+        camera_world(p.first, p.second, &wx, &wy);
+        this->route.emplace_back(wx, wy);
+    }
+}
+
+void Prefetcher::add_view(double wx, double wy, double zoom, int z, int width, int height,
+                          double bearing, size_t limit, std::vector<TileRequest>* out)
+{
+    if (z < 0 || z > _max_zoom)
+        return;
+    double n = (double)(1u << z);
+    double px = _tile_px * pow(2.0, zoom - z);
+    double hw = width / 2.0 / px, hh = height / 2.0 / px;
+    if (fmod(bearing, 180.0) != 0) {
+        /* A turned view fits in the circle around it */
+        hw = hh = sqrt(hw * hw + hh * hh);
+    }
+    long x0 = (long)floor(wx * n - hw), x1 = (long)floor(wx * n + hw);
+    long y0 = std::max(0L, (long)floor(wy * n - hh));
+    long y1 = std::min((long)n - 1, (long)floor(wy * n + hh));
+    for (long y = y0; y <= y1; y++) {
+        for (long x = x0; x <= x1; x++) {
+            if (out->size() >= limit)
+                return;
+            TileRequest r;
+            /* Wrap around the antimeridian */
+            r.key.x = (uint32_t)(((x % (long)n) + (long)n) % (long)n);
+            r.key.y = (uint32_t)y;
+            r.key.z = (uint8_t)z;
+            r.key.style = 0;
+            r.visible = limit == SIZE_MAX; // only the view itself is unlimited
+            r.entered = false;
+            bool seen = false;
+            for (const TileRequest& o : *out) {
+                if (o.key == r.key) {
+                    seen = true;
+                    break;
+                }
+            }
+            if (!seen)
+                out->push_back(r);
+        }
+    }
+}
+
+void Prefetcher::plan(const struct camera& cam, int width, int height, uint64_t now_us,
+                      std::vector<TileRequest>* out)
+{
+    double wx, wy;
+    camera_world(cam.lon, cam.lat, &wx, &wy);
+
+    /* Velocity smoothed over the frames, forgotten after a pause */
+    if (this->has_sample && now_us > this->last_us) {
+        double dt = (now_us - this->last_us) / 1e6;
+        if (dt < 1.0) {
+            double dx = wx - this->last_wx;
+            if (dx > 0.5)
+                dx -= 1.0;
+            else if (dx < -0.5)
+                dx += 1.0;
+            this->vx = 0.5 * this->vx + 0.5 * dx / dt;
+            this->vy = 0.5 * this->vy + 0.5 * (wy - this->last_wy) / dt;
+        } else {
+            this->vx = this->vy = 0;
+        }
+    }
+    this->has_sample = true;
+    this->last_us = now_us;
+    this->last_wx = wx;
+    this->last_wy = wy;
+
+    int z = std::max(0, std::min(_max_zoom, (int)floor(cam.zoom)));
+    out->clear();
+    this->add_view(wx, wy, cam.zoom, z, width, height, cam.bearing, SIZE_MAX, out);
+    size_t nvisible = out->size();
+    size_t ahead = nvisible + _ahead_prefetch, zooms = nvisible + _max_prefetch;
+
+    /* Where the camera will be, halfway and at the end of the lookahead */
+    for (double f : {0.5, 1.0}) {
+        double t = this->lookahead_s * f;
+        double px = wx + this->vx * t, py = wy + this->vy * t;
+        if (px != wx || py != wy)
+            this->add_view(px - floor(px), py, cam.zoom, z, width, height, cam.bearing, ahead, out);
+    }
+
+    /* The route ahead of its point nearest to the camera, as far as the
+     * motion reaches but at least one view */
+    if (!this->route.empty()) {
+        size_t nearest = 0;
+        double best = INFINITY;
+        for (size_t i = 0; i < this->route.size(); i++) {
+            double dx = this->route[i].first - wx, dy = this->route[i].second - wy;
+            if (dx * dx + dy * dy < best) {
+                best = dx * dx + dy * dy;
+                nearest = i;
+            }
+        }
+        double view = std::max(width, height) / (_tile_px * pow(2.0, cam.zoom));
+        double reach = std::max(view, hypot(this->vx, this->vy) * this->lookahead_s);
+        double walked = 0;
+        for (size_t i = nearest + 1; i < this->route.size() && walked < reach; i++) {
+            walked += hypot(this->route[i].first - this->route[i - 1].first,
+                            this->route[i].second - this->route[i - 1].second);
+            this->add_view(this->route[i].first, this->route[i].second, cam.zoom, z,
+                           width, height, cam.bearing, ahead, out);
+        }
+    }
+
+    /* One level out for zooming out, one in last as it is four times larger */
+    this->add_view(wx, wy, cam.zoom, z - 1, width, height, cam.bearing, zooms, out);
+    this->add_view(wx, wy, cam.zoom, z + 1, width, height, cam.bearing, zooms, out);
+
+    /* Visible tiles that were not in the previous plan just came into view */
+    std::vector<TileKey> visible;
+    std::unordered_map<TileKey, std::shared_ptr<std::atomic<bool>>, TileKeyHash> prefetched;
+    for (size_t i = 0; i < out->size(); i++) {
+        TileRequest& r = (*out)[i];
+        if (i < nvisible) {
+            r.entered = std::find(this->visible.begin(), this->visible.end(), r.key) == this->visible.end();
+            visible.push_back(r.key);
+            continue;
+        }
+        auto it = this->prefetched.find(r.key);
+        if (it != this->prefetched.end()) {
+            prefetched.emplace(r.key, std::move(it->second));
+            this->prefetched.erase(it);
+        }
+    }
+    /* Prefetches left behind are stale; those now in view are cancelled
+     * too, the caller asks for them again as visible */
+    for (auto& p : this->prefetched)
+        p.second->store(true, std::memory_order_relaxed);
+    this->visible.swap(visible);
+    this->prefetched.swap(prefetched);
+}
+
+std::shared_ptr<const std::atomic<bool>> Prefetcher::cancel_flag(const TileKey& key)
+{
+    auto& flag = this->prefetched[key];
+    if (!flag)
+        flag = std::make_shared<std::atomic<bool>>(false);
+    return flag;
+}
+
+void Prefetcher::count_entered(size_t entered, size_t resident)
+{
+    this->nentered += entered;
+    this->nresident += resident;
+}
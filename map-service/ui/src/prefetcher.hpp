@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "camera.hpp"
+#include "tile-cache.hpp"
+
+typedef struct TileRequest {
+    TileKey key;
+    bool visible;
+    bool entered; // visible now but not in the previous plan
+} TileRequest;
+
+/*
+ * Tiles one window needs now and is about to need.
+ * The camera motion is extrapolated lookahead seconds ahead, the route
+ * when one is set is followed as far, and the view is repeated one zoom
+ * level out and in. A plan lists visible tiles first. Every prefetch has
+ * a cancel flag that is raised once a later plan no longer lists it.
+ */
+class Prefetcher {
+  public:
+    explicit Prefetcher(double lookahead_s = 1.5);
+
+    // Points of the active route as lon, lat; empty clears it
+    void set_route(const std::vector<std::pair<double, double>>& lonlat);
+    void plan(const struct camera& cam, int width, int height, uint64_t now_us,
+              std::vector<TileRequest>* out);
+
+    // Cancel flag of a prefetch of the last plan, for its DecodeJob
+    std::shared_ptr<const std::atomic<bool>> cancel_flag(const TileKey& key);
+
+    // Tiles that came into view, and how many of them were resident then
+    void count_entered(size_t entered, size_t resident);
+    uint64_t entered() const { return this->nentered; }
+    uint64_t resident() const { return this->nresident; }
+
+  private:
+    void add_view(double wx, double wy, double zoom, int z, int width, int height,
+                  double bearing, size_t limit, std::vector<TileRequest>* out);
+
+    double lookahead_s;
+    std::vector<std::pair<double, double>> route; // world coordinates
+    bool has_sample;
+    uint64_t last_us;
+    double last_wx, last_wy, vx, vy; // world units per second
+    std::vector<TileKey> visible; // of the previous plan
+    std::unordered_map<TileKey, std::shared_ptr<std::atomic<bool>>, TileKeyHash> prefetched;
+    uint64_t nentered, nresident;
+};
+
+#endif /* PREFETCHER_H */
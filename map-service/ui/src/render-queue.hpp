@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+#include <deque>
+#include <stddef.h>
+#include <string>
+#include "binding.hpp"
+
+/*
+ * Work the binding callbacks hand to the render loop.
+ * The loop drains the queue once per frame; of several resizes only the
+ * last one is applied. Callbacks run on the render thread, so the queue
+ * needs no lock. Nothing is dropped: a dropped syncDraw would never get
+ * its endDraw, a dropped new_request would hold a renderer slot. Instead
+ * the loop stops reading the binding once RENDER_QUEUE_MAX commands wait,
+ * the rest stays in the socket until the next frame.
+ */
+typedef struct RenderCommand {
+    enum Type {
+        RESIZE,      // syncDraw of role, endDraw is due after the next frame
+        NEW_REQUEST  // new_request of map-private
+    };
+    Type type;
+    std::string role;
+    Rect rect;
+    NewRequest request;
+} RenderCommand;
+
+typedef std::deque<RenderCommand> RenderQueue;
+
+/* One binding event may carry a batch, the queue can pass this by that much */
+static const size_t RENDER_QUEUE_MAX = 64;
+
+#endif /* RENDER_QUEUE_H */
@@ -31,8 +31,10 @@
 #include <sys/types.h>
 #include <thread>
 #include <exception>
+#include <unordered_map>
 #include <vector>
 #include <sstream>
+#include <algorithm>
 
 #include <assert.h>
 #include <signal.h>
@@ -46,10 +48,21 @@
 
 #include <unistd.h>
 #include <time.h>
+#include <string.h>
 
 
+#include <sys/epoll.h>
 #include <ilm/ivi-application-client-protocol.h>
 #include "binding.hpp"
+#include "event-loop.hpp"
+#include "render-queue.hpp"
+#include "damage.hpp"
+#include "tile-cache.hpp"
+#include "decode-pool.hpp"
+#include "tile-store.hpp"
+#include "camera.hpp"
+#include "prefetcher.hpp"
+#include "geometry-batch.hpp"
 #include "hmi-debug.h"
 
 using namespace std;
@@ -58,9 +71,11 @@ const char* log_prefix = "simple-egl";
 uint32_t g_id_ivisurf = 9009;
 long port = 1700;
 static string token = string("wm");
+static string endpoint;
 static string app_name = string("map-service");
 static const char* main_role = "map-service";
 Binding *bdg;
+static RenderQueue commands;
 
 static const struct wl_interface *types[] = {
         NULL,
@@ -121,6 +136,26 @@ struct display {
     } egl;
     struct window *window;
     struct ivi_application *ivi_application;
+    /* Every map surface, the main window first. They share egl.ctx and
+     * the program below, only the EGL surface is switched per frame. */
+    std::vector<struct window *> windows;
+    struct {
+        GLuint program;
+        GLuint rotation_uniform;
+        GLuint pos;
+        GLuint col;
+        GLuint triangle; // vertex buffer of the demo triangle
+    } gl;
+    /* Tile geometry in buffer objects, drawn class by class */
+    GeometryBatch batch;
+    /* Uploaded tiles, shared by every window */
+    TileCache *tiles;
+    /* Decodes tiles on worker threads, uploads happen on this one */
+    DecodePool *decoder;
+    /* Offline tiles, mapped; decode jobs point straight into it */
+    TileStore store;
+    /* Tiles handed to the decoder, true while only as a prefetch */
+    std::unordered_map<TileKey, bool, TileKeyHash> inflight;
 
     PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC swap_buffers_with_damage;
 };
@@ -132,11 +167,15 @@ struct geometry {
 struct window {
     struct display *display;
     struct geometry geometry, window_size;
-    struct {
-        GLuint rotation_uniform;
-        GLuint pos;
-        GLuint col;
-    } gl;
+    /* The triangle is turned by the bearing until tiles are drawn */
+    struct camera camera;
+    Prefetcher prefetch;
+    std::vector<TileKey> visible_tiles; // of the last request_tiles
+    uint64_t draw_calls;
+    /* ivi id of the surface, and the role whose syncDraw resizes it */
+    uint32_t surface_id;
+    std::string role;
+    std::vector<std::string> end_draws;
 
     uint32_t benchmark_time, frames;
     struct wl_egl_window *native;
@@ -144,7 +183,13 @@ struct window {
     struct ivi_surface *ivi_surface;
     EGLSurface egl_surface;
     struct wl_callback *callback;
-    int fullscreen, opaque, buffer_size, frame_sync;
+    int fullscreen, opaque, buffer_size;
+    /* A frame is produced only when dirty and the compositor asked for one */
+    int dirty, animate;
+    /* Damage per back buffer, and where the triangle was last drawn */
+    DamageTracker damage;
+    DamageRect marker;
+    int has_marker;
 };
 
 static const char *vert_shader_text =
@@ -166,6 +211,29 @@ static const char *frag_shader_text =
 
 static int running = 1;
 
+/* Demo triangle, x, y then r, g, b per vertex */
+static const GLfloat triangle[3][5] = {
+    { -0.5, -0.5, 1, 0, 0 },
+    {  0.5, -0.5, 0, 1, 0 },
+    {  0,    0.5, 0, 0, 1 }
+};
+
+/* Window rectangle covered by the rotated triangle, with a pixel of margin */
+static DamageRect
+triangle_bounds(const struct window *window, GLfloat angle)
+{
+    GLfloat x0 = 1, y0 = 1, x1 = -1, y1 = -1;
+    for (int i = 0; i < 3; i++) {
+        GLfloat x = triangle[i][0] * cos(angle), y = triangle[i][1];
+        x0 = std::min(x0, x); x1 = std::max(x1, x);
+        y0 = std::min(y0, y); y1 = std::max(y1, y);
+    }
+    int w = window->geometry.width, h = window->geometry.height;
+    int px0 = (int)floor((x0 + 1) / 2 * w) - 1, py0 = (int)floor((y0 + 1) / 2 * h) - 1;
+    int px1 = (int)ceil((x1 + 1) / 2 * w) + 1, py1 = (int)ceil((y1 + 1) / 2 * h) + 1;
+    return DamageRect{px0, py0, px1 - px0, py1 - py0};
+}
+
 static void
 init_egl(struct display *display, struct window *window)
 {
@@ -303,21 +371,30 @@ init_gl(struct window *window)
 
     glUseProgram(program);
 
-    window->gl.pos = 0;
-    window->gl.col = 1;
+    /* The program belongs to the shared context, every window uses it */
+    struct display *display = window->display;
+    display->gl.pos = 0;
+    display->gl.col = 1;
 
-    glBindAttribLocation(program, window->gl.pos, "pos");
-    glBindAttribLocation(program, window->gl.col, "color");
+    glBindAttribLocation(program, display->gl.pos, "pos");
+    glBindAttribLocation(program, display->gl.col, "color");
     glLinkProgram(program);
 
-    window->gl.rotation_uniform =
+    display->gl.rotation_uniform =
         glGetUniformLocation(program, "rotation");
+    display->gl.program = program;
+
+    /* Static geometry lives in a buffer object, not in client memory */
+    glGenBuffers(1, &display->gl.triangle);
+    glBindBuffer(GL_ARRAY_BUFFER, display->gl.triangle);
+    glBufferData(GL_ARRAY_BUFFER, sizeof triangle, triangle, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 static void
 create_ivi_surface(struct window *window, struct display *display)
 {
-    uint32_t id_ivisurf = g_id_ivisurf;
+    uint32_t id_ivisurf = window->surface_id;
     window->ivi_surface =
         ivi_application_surface_create(display->ivi_application,
                            id_ivisurf, window->surface);
@@ -357,8 +434,10 @@ create_surface(struct window *window)
                  window->egl_surface, window->display->egl.ctx);
     assert(ret == EGL_TRUE);
 
-    if (!window->frame_sync)
-        eglSwapInterval(display->egl.dpy, 0);
+    /* Frames are paced by our own wl_surface.frame callbacks. With an
+     * interval of 1 EGL would also wait for one inside eglSwapBuffers,
+     * which never returns for a hidden surface. */
+    eglSwapInterval(display->egl.dpy, 0);
 
 }
 
@@ -382,22 +461,28 @@ destroy_surface(struct window *window)
 }
 
 static void
-redraw(void *data, struct wl_callback *callback, uint32_t time)
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
 {
     struct window *window = data;
-    struct display *display = window->display;
-    static const GLfloat verts[3][2] = {
-        { -0.5, -0.5 },
-        {  0.5, -0.5 },
-        {  0,    0.5 }
-    };
 
-    static const GLfloat colors[3][3] = {
-        { 1, 0, 0 },
-        { 0, 1, 0 },
-        { 0, 0, 1 }
-    };
+    assert(window->callback == callback);
+    window->callback = NULL;
+    wl_callback_destroy(callback);
+
+    /* The rotation is the only thing changing on its own */
+    if (window->animate)
+        window->dirty = 1;
+}
 
+static const struct wl_callback_listener frame_listener = {
+    frame_done
+};
+
+static void
+redraw(void *data, struct wl_callback *callback, uint32_t time)
+{
+    struct window *window = data;
+    struct display *display = window->display;
     GLfloat angle;
     GLfloat rotation[4][4] = {
         { 1, 0, 0, 0 },
@@ -407,15 +492,10 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
     };
     static const uint32_t speed_div = 5, benchmark_interval = 5;
     struct wl_region *region;
-    EGLint rect[4];
     EGLint buffer_age = 0;
     struct timeval tv;
 
-    assert(window->callback == callback);
-    window->callback = NULL;
-
-    if (callback)
-        wl_callback_destroy(callback);
+    window->dirty = 0;
 
     gettimeofday(&tv, NULL);
     time = tv.tv_sec * 1000 + tv.tv_usec / 1000;
@@ -423,41 +503,100 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
         window->benchmark_time = time;
 
     if (time - window->benchmark_time > (benchmark_interval * 1000)) {
-        HMI_DEBUG(log_prefix,"%d frames in %d seconds: %f fps",
+        TileCache *tiles = display->tiles;
+        HMI_DEBUG(log_prefix,"surface %u: %d frames in %d seconds: %f fps, "
+               "tiles %zu (%zu/%zu bytes) hit %llu miss %llu evicted %llu, "
+               "resident on view %llu/%llu, prefetches cancelled %llu, "
+               "%.1f draw calls per frame",
+               window->surface_id,
                window->frames,
                benchmark_interval,
-               (float) window->frames / benchmark_interval);
+               (float) window->frames / benchmark_interval,
+               tiles->size(), tiles->bytes(), tiles->budget(),
+               (unsigned long long)tiles->hits(),
+               (unsigned long long)tiles->misses(),
+               (unsigned long long)tiles->evictions(),
+               (unsigned long long)window->prefetch.resident(),
+               (unsigned long long)window->prefetch.entered(),
+               (unsigned long long)display->decoder->cancelled(),
+               (double) window->draw_calls / std::max(1u, window->frames));
         window->benchmark_time = time;
         window->frames = 0;
+        window->draw_calls = 0;
     }
 
-    angle = (time / speed_div) % 360 * M_PI / 180.0;
+    angle = window->animate ? (time / speed_div) % 360 * M_PI / 180.0 : 0;
+    angle += window->camera.bearing * M_PI / 180.0;
     rotation[0][0] =  cos(angle);
     rotation[0][2] =  sin(angle);
     rotation[2][0] = -sin(angle);
     rotation[2][2] =  cos(angle);
 
+    /* Only what the triangle covered before and covers now has changed */
+    DamageRect marker = triangle_bounds(window, angle);
+    if (!window->has_marker || memcmp(&marker, &window->marker, sizeof marker) != 0) {
+        if (window->has_marker)
+            window->damage.add(window->marker);
+        window->damage.add(marker);
+        window->marker = marker;
+        window->has_marker = 1;
+    }
+    if (window->damage.empty()) {
+        /* Nothing moved, keep the front buffer and skip the frame */
+        return;
+    }
+
     if (display->swap_buffers_with_damage)
         eglQuerySurface(display->egl.dpy, window->egl_surface,
                 EGL_BUFFER_AGE_EXT, &buffer_age);
 
-    glViewport(0, 0, window->geometry.width, window->geometry.height);
+    bool full = true;
+    DamageRect bounds = window->damage.repaint_bounds(buffer_age, &full);
 
-    glUniformMatrix4fv(window->gl.rotation_uniform, 1, GL_FALSE,
-               (GLfloat *) rotation);
+    /* Windows share the context, draw into this one's surface */
+    if (eglGetCurrentSurface(EGL_DRAW) != window->egl_surface)
+        eglMakeCurrent(display->egl.dpy, window->egl_surface,
+                       window->egl_surface, display->egl.ctx);
+
+    glViewport(0, 0, window->geometry.width, window->geometry.height);
+    if (!full) {
+        /* The rest of the buffer already holds the current content */
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(bounds.x, bounds.y, bounds.w, bounds.h);
+    }
 
     glClearColor(0.0, 0.0, 0.0, 0.5);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    glVertexAttribPointer(window->gl.pos, 2, GL_FLOAT, GL_FALSE, 0, verts);
-    glVertexAttribPointer(window->gl.col, 3, GL_FLOAT, GL_FALSE, 0, colors);
-    glEnableVertexAttribArray(window->gl.pos);
-    glEnableVertexAttribArray(window->gl.col);
+    /* Resident tiles in view, those still decoding show up later */
+    std::vector<std::pair<TileKey, const GpuTile *>> tiles;
+    for (const TileKey& key : window->visible_tiles) {
+        const GpuTile *tile = display->tiles->find(key);
+        if (tile)
+            tiles.emplace_back(key, tile);
+    }
+    window->draw_calls += display->batch.draw(tiles, window->camera,
+                                              window->geometry.width, window->geometry.height);
+
+    glUseProgram(display->gl.program);
+    glUniformMatrix4fv(display->gl.rotation_uniform, 1, GL_FALSE,
+               (GLfloat *) rotation);
+
+    glBindBuffer(GL_ARRAY_BUFFER, display->gl.triangle);
+    glVertexAttribPointer(display->gl.pos, 2, GL_FLOAT, GL_FALSE,
+                          sizeof triangle[0], (const void *) 0);
+    glVertexAttribPointer(display->gl.col, 3, GL_FLOAT, GL_FALSE,
+                          sizeof triangle[0], (const void *) (2 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(display->gl.pos);
+    glEnableVertexAttribArray(display->gl.col);
 
     glDrawArrays(GL_TRIANGLES, 0, 3);
+    window->draw_calls++;
 
-    glDisableVertexAttribArray(window->gl.pos);
-    glDisableVertexAttribArray(window->gl.col);
+    glDisableVertexAttribArray(display->gl.pos);
+    glDisableVertexAttribArray(display->gl.col);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDisable(GL_SCISSOR_TEST);
 
     if (window->opaque || window->fullscreen) {
         region = wl_compositor_create_region(window->display->compositor);
@@ -470,17 +609,20 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
         wl_surface_set_opaque_region(window->surface, NULL);
     }
 
-    if (display->swap_buffers_with_damage && buffer_age > 0) {
-        rect[0] = window->geometry.width / 4 - 1;
-        rect[1] = window->geometry.height / 4 - 1;
-        rect[2] = window->geometry.width / 2 + 2;
-        rect[3] = window->geometry.height / 2 + 2;
+    /* Ask for the next frame slot before the commit of the swap */
+    window->callback = wl_surface_frame(window->surface);
+    wl_callback_add_listener(window->callback, &frame_listener, window);
+
+    if (display->swap_buffers_with_damage) {
+        /* The compositor only needs what changed since the last frame */
+        std::vector<EGLint> rects = window->damage.frame_rects();
         display->swap_buffers_with_damage(display->egl.dpy,
                           window->egl_surface,
-                          rect, 1);
+                          rects.data(), rects.size() / 4);
     } else {
         eglSwapBuffers(display->egl.dpy, window->egl_surface);
     }
+    window->damage.end_frame();
 
     window->frames++;
 }
@@ -519,12 +661,248 @@ signal_int(int signum)
     running = 0;
 }
 
+/* Upload what the decode workers finished, on the GL thread */
+static void
+upload_decoded(struct display *display)
+{
+    DecodedTile *tile = display->decoder->take_completed();
+    if (tile == NULL)
+        return;
+
+    struct window *main_window = display->window;
+    if (eglGetCurrentContext() != display->egl.ctx)
+        eglMakeCurrent(display->egl.dpy, main_window->egl_surface,
+                       main_window->egl_surface, display->egl.ctx);
+
+    bool uploaded = false;
+    while (tile) {
+        DecodedTile *next = tile->next;
+        if (tile->cancelled) {
+            /* A stale prefetch, unless the tile was asked for again since */
+            auto it = display->inflight.find(tile->key);
+            if (it != display->inflight.end() && it->second)
+                display->inflight.erase(it);
+            delete tile;
+            tile = next;
+            continue;
+        }
+        display->inflight.erase(tile->key);
+        uploaded = true;
+        /* Empty or malformed tiles are resident as nothing, not retried */
+        if (tile->ok)
+            display->tiles->insert(tile->key, display->batch.upload(*tile));
+        else
+            display->tiles->insert(tile->key, GpuTile());
+        delete tile;
+        tile = next;
+    }
+
+    /* New tiles may be in view of any window, and cover all of it */
+    if (!uploaded)
+        return;
+    for (struct window *window : display->windows) {
+        window->damage.add_full();
+        window->dirty = 1;
+    }
+}
+
+/* Hand the tiles the window needs to the decoder, visible ones first */
+static void
+request_tiles(struct display *display, struct window *window)
+{
+    if (!display->store.is_open())
+        return;
+
+    vector<TileRequest> plan;
+    size_t entered = 0, resident = 0;
+    window->prefetch.plan(window->camera, window->geometry.width, window->geometry.height,
+                          EventLoop::now_us(), &plan);
+    window->visible_tiles.clear();
+    for (const TileRequest& r : plan) {
+        if (r.visible)
+            window->visible_tiles.push_back(r.key);
+        bool cached = display->tiles->contains(r.key);
+        if (r.entered) {
+            entered++;
+            resident += cached;
+        }
+        if (cached)
+            continue;
+        auto it = display->inflight.find(r.key);
+        /* A prefetch coming into view was cancelled, ask for it as visible */
+        if (it != display->inflight.end() && (!it->second || !r.visible))
+            continue;
+        TileSpan span = display->store.find(r.key.z, r.key.x, r.key.y);
+        if (span.data == NULL)
+            continue;
+
+        DecodeJob job;
+        job.key = r.key;
+        job.data = span.data;
+        job.size = span.size;
+        job.prefetch = !r.visible;
+        if (job.prefetch)
+            job.cancel = window->prefetch.cancel_flag(r.key);
+        display->decoder->submit(job);
+        display->inflight[r.key] = job.prefetch;
+    }
+    window->prefetch.count_entered(entered, resident);
+}
+
+static struct window *
+find_window(struct display *display, uint32_t surface_id)
+{
+    for (struct window *window : display->windows) {
+        if (window->surface_id == surface_id)
+            return window;
+    }
+    return NULL;
+}
+
+/* Window resized by syncDraw of role, NULL if no window has that role */
+static struct window *
+window_for_role(struct display *display, const string& role)
+{
+    for (struct window *window : display->windows) {
+        if (window->role == role)
+            return window;
+    }
+    return NULL;
+}
+
+/* New map surface sharing the context of the main window, drawn at the
+ * main window size until its role gets a syncDraw */
+static struct window *
+create_window(struct display *display, uint32_t surface_id, const string& role)
+{
+    struct window *main_window = display->window;
+    struct window *window = new struct window();
+
+    window->display = display;
+    window->surface_id = surface_id;
+    window->role = role;
+    window->geometry = main_window->window_size;
+    window->window_size = main_window->window_size;
+    window->buffer_size = main_window->buffer_size;
+    window->opaque = main_window->opaque;
+    window->animate = main_window->animate;
+    window->damage.resize(window->geometry.width, window->geometry.height);
+    window->dirty = 1;
+
+    create_surface(window);
+    display->windows.push_back(window);
+    HMI_DEBUG(log_prefix, "surface %u created, %zu windows", surface_id, display->windows.size());
+    return window;
+}
+
+static void
+destroy_window(struct window *window)
+{
+    struct display *display = window->display;
+
+    /* The window manager still waits for these */
+    for (const string& role : window->end_draws)
+        bdg->end_draw(role.c_str());
+    display->windows.erase(find(display->windows.begin(), display->windows.end(), window));
+    destroy_surface(window);
+    delete window;
+}
+
+static void
+handle_new_request(struct display *display, const NewRequest& req)
+{
+    uint32_t surface = req.surface_id;
+    struct window *window = find_window(display, surface);
+
+    switch(req.op) {
+    case NewRequest::CREATE:
+    case NewRequest::PREPARE:
+        /* A pooled surface has no owner, hence no role, until assigned */
+        if (window == NULL)
+            window = create_window(display, surface,
+                                   req.op == NewRequest::CREATE ? req.role : string());
+        /* The ivi surface must reach the compositor before map-service
+         * tells the window manager it is there */
+        wl_display_flush(display->display);
+        bdg->provide_surface(req);
+        break;
+    case NewRequest::ASSIGN:
+        // pooled surface is shown to req.appid as req.role from now on
+        HMI_DEBUG(log_prefix, "surface %u assigned to %s as %s", surface,
+                  req.appid.c_str(), req.role.c_str());
+        if (window) {
+            window->role = req.role;
+            window->dirty = 1;
+        }
+        break;
+    case NewRequest::RELEASE:
+        HMI_DEBUG(log_prefix, "surface %u released", surface);
+        if (window && window != display->window)
+            destroy_window(window);
+        break;
+    }
+}
+
+/* Apply the commands posted since the last frame, called once per frame.
+ * Roles whose syncDraw was applied are queued on the end_draws of the
+ * window they resized. */
+static void
+drain_commands(struct display *display)
+{
+    RenderCommand cmd;
+    vector<struct window *> resized;
+
+    while (!commands.empty()) {
+        cmd = std::move(commands.front());
+        commands.pop_front();
+        switch (cmd.type) {
+        case RenderCommand::RESIZE: {
+            /* Only the last size matters, every role still gets endDraw */
+            struct window *window = window_for_role(display, cmd.role);
+            if (window == NULL) {
+                /* Released meanwhile, or never ours: nothing to draw */
+                HMI_DEBUG(log_prefix, "syncDraw of unknown role %s", cmd.role.c_str());
+                bdg->end_draw(cmd.role.c_str());
+                break;
+            }
+            window->window_size.width = cmd.rect.width();
+            window->window_size.height = cmd.rect.height();
+            if (find(resized.begin(), resized.end(), window) == resized.end())
+                resized.push_back(window);
+            if (find(window->end_draws.begin(), window->end_draws.end(), cmd.role) == window->end_draws.end())
+                window->end_draws.push_back(std::move(cmd.role));
+            break;
+        }
+        case RenderCommand::NEW_REQUEST:
+            handle_new_request(display, cmd.request);
+            break;
+        }
+    }
+
+    for (struct window *window : resized) {
+        /* A resized pool window may have been released meanwhile */
+        if (find(display->windows.begin(), display->windows.end(), window) == display->windows.end())
+            continue;
+        /* A hidden surface, as during syncDraw, gets no frame callback:
+         * do not wait for one, endDraw is due after this frame */
+        if (window->callback) {
+            wl_callback_destroy(window->callback);
+            window->callback = NULL;
+        }
+        wl_egl_window_resize(window->native, window->window_size.width, window->window_size.height, 0, 0);
+        window->geometry = window->window_size;
+        window->damage.resize(window->geometry.width, window->geometry.height);
+        window->has_marker = 0;
+        window->dirty = 1;
+    }
+}
+
 int
-init_bdg(struct window *window)
+init_bdg(struct window *window, EventLoop *loop)
 {
     HMI_DEBUG(log_prefix,"called");
 
-    if (bdg->init(port, token) != 0) {
+    if (bdg->init(port, token, loop, endpoint) != 0) {
         HMI_ERROR(log_prefix,"bdg init failed. ");
         return -1;
     }
@@ -535,22 +913,22 @@ init_bdg(struct window *window)
         json_object* j_val;
         HMI_DEBUG(log_prefix, "reply : %s", json_object_get_string(j));
     };
-    handler.on_sync_draw = [bdg, window](const char* role, const char* area, Rect rect) {
+    /* Callbacks only post commands, the render loop applies them */
+    handler.on_sync_draw = [](const char* role, const char* area, Rect rect) {
 
         HMI_DEBUG(log_prefix,"Surface %s got syncDraw! Area: %s. w:%d, h:%d", role, area, rect.width(), rect.height());
 
-        wl_egl_window_resize(window->native, rect.width(), rect.height(), 0, 0);
-        window->geometry.width  = rect.width();
-        window->geometry.height = rect.height();
-
-        bdg->end_draw(role);
+        RenderCommand cmd;
+        cmd.type = RenderCommand::RESIZE;
+        cmd.role = role;
+        cmd.rect = rect;
+        commands.push_back(std::move(cmd));
     };
-    handler.on_new_request = [bdg](const NewRequest& req) {
-        // Get surface
-        int surface = req.surface_id;
-        // create and redaw surface
-        // call provide_surface
-        bdg->provide_surface(req);
+    handler.on_new_request = [](const NewRequest& req) {
+        RenderCommand cmd;
+        cmd.type = RenderCommand::NEW_REQUEST;
+        cmd.request = req;
+        commands.push_back(std::move(cmd));
     };
 
     bdg->set_event_handler(handler);
@@ -567,16 +945,27 @@ main(int argc, char **argv)
 
     window.display = &display;
     display.window = &window;
+    display.windows.push_back(&window);
+    window.surface_id = g_id_ivisurf;
+    window.role = main_role;
     window.geometry.width  = 1080;
     window.geometry.height = 1488;
     window.window_size = window.geometry;
+    window.damage.resize(window.geometry.width, window.geometry.height);
     window.buffer_size = 32;
-    window.frame_sync = 1;
+    window.dirty = 1;
+    /* The spinning triangle is a demo, a static map must not use the GPU */
+    window.animate = getenv("SIMPLE_EGL_ANIMATE") != NULL;
 
     if(argc > 2){
         port = strtol(argv[1], NULL, 10);
         token = argv[2];
     }
+    /* unix:<dir> of the daemon's api sockets, tried before TCP */
+    if(argc > 3)
+        endpoint = argv[3];
+    else if(getenv("MAP_SERVICE_UI_ENDPOINT") != NULL)
+        endpoint = getenv("MAP_SERVICE_UI_ENDPOINT");
 
     HMI_DEBUG(log_prefix,"main_role: %s, port: %d, token: %s. ", main_role, port, token.c_str());
 
@@ -591,8 +980,11 @@ main(int argc, char **argv)
 
     init_egl(&display, &window);
 
+    /* Wayland, the binding websocket and timers share one epoll loop on
+     * this thread, so binding callbacks never race the renderer. */
+    EventLoop loop;
     bdg = new Binding();
-    if(init_bdg(&window)!=0){
+    if(init_bdg(&window, &loop)!=0){
         fini_egl(&display);
         if (display.ivi_application)
             ivi_application_destroy(display.ivi_application);
@@ -606,6 +998,24 @@ main(int argc, char **argv)
     create_surface(&window);
     init_gl(&window);
 
+    /* GPU memory for tiles, in MiB */
+    size_t tile_budget = 64;
+    if (getenv("SIMPLE_EGL_TILE_CACHE_MB") != NULL)
+        tile_budget = strtoul(getenv("SIMPLE_EGL_TILE_CACHE_MB"), NULL, 10);
+    display.tiles = new TileCache(tile_budget << 20);
+    if (!display.batch.init())
+        HMI_ERROR(log_prefix, "no tile program, only the triangle is drawn");
+
+    /* Decode workers, one core is left to this thread by default */
+    unsigned cores = std::thread::hardware_concurrency();
+    unsigned decode_threads = cores > 1 ? cores - 1 : 1;
+    if (getenv("SIMPLE_EGL_DECODE_THREADS") != NULL)
+        decode_threads = strtoul(getenv("SIMPLE_EGL_DECODE_THREADS"), NULL, 10);
+    display.decoder = new DecodePool(decode_threads);
+
+    if (getenv("SIMPLE_EGL_TILE_PACK") != NULL)
+        display.store.open(getenv("SIMPLE_EGL_TILE_PACK"));
+
     //Ctrl+C
     sigint.sa_handler = signal_int;
     sigemptyset(&sigint.sa_mask);
@@ -616,17 +1026,72 @@ main(int argc, char **argv)
 
     //wm->activateWindow(main_role);
 
-    /* The mainloop here is a little subtle.  Redrawing will cause
-     * EGL to read events so we can just call
-     * wl_display_dispatch_pending() to handle any events that got
-     * queued up as a side effect. */
+    /* The Wayland fd is read with the prepare_read protocol: no handler
+     * may touch the display between prepare and read. A frame is drawn
+     * when something changed and no frame callback is pending, otherwise
+     * the loop sleeps until an fd or timer wakes it. */
+    int wl_fd = wl_display_get_fd(display.display);
+    loop.add_fd(wl_fd, EPOLLIN, nullptr);
+    /* A full command queue leaves the fd readable, it is read again
+     * once this frame drained the queue */
+    loop.add_fd(bdg->event_fd(), EPOLLIN, [](uint32_t events) {
+        while (commands.size() < RENDER_QUEUE_MAX && bdg->dispatch_event())
+            ;
+    });
+    loop.add_fd(display.decoder->event_fd(), EPOLLIN, [&display](uint32_t events) {
+        upload_decoded(&display);
+    });
+    /* Requests made during init may have been answered already */
+    bdg->dispatch_events();
+
     while (running) {
+        while (wl_display_prepare_read(display.display) != 0)
+            wl_display_dispatch_pending(display.display);
+        wl_display_flush(display.display);
+
+        /* One scheduler for all windows: each is drawn when it changed
+         * and its own frame callback came back */
+        int timeout = -1;
+        for (struct window *w : display.windows) {
+            if (w->dirty && !w->callback)
+                timeout = 0;
+        }
+        if (loop.wait(timeout) < 0) {
+            wl_display_cancel_read(display.display);
+            break;
+        }
+        if (loop.ready(wl_fd))
+            wl_display_read_events(display.display);
+        else
+            wl_display_cancel_read(display.display);
         wl_display_dispatch_pending(display.display);
-        redraw(&window, NULL, 0);
+
+        loop.dispatch();
+        drain_commands(&display);
+
+        for (struct window *w : display.windows) {
+            if (!w->dirty || w->callback)
+                continue;
+            request_tiles(&display, w);
+            redraw(w, NULL, 0);
+            /* The frame at the new size is out, window manager may go on */
+            for (const string& role : w->end_draws)
+                bdg->end_draw(role.c_str());
+            w->end_draws.clear();
+        }
     }
 
     HMI_DEBUG(log_prefix,"simple-egl exiting! ");
-
+    hmi_log_flush();
+
+    delete display.decoder;
+    /* Tiles go with the context, delete them while it is current */
+    eglMakeCurrent(display.egl.dpy, window.egl_surface, window.egl_surface, display.egl.ctx);
+    delete display.tiles;
+    display.batch.fini();
+    glDeleteBuffers(1, &display.gl.triangle);
+    while (display.windows.size() > 1)
+        destroy_window(display.windows.back());
     destroy_surface(&window);
     fini_egl(&display);
 
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tile-cache.hpp"
+
+/* Host memory of an entry: list and index nodes.
+ * Charged on top of the GPU bytes so that empty tiles, which own no GL
+ * object, still count against the budget and get evicted */
+static const size_t _entry_bytes = 256;
+
+TileCache::TileCache(size_t budget_bytes)
+    : budget_bytes(budget_bytes), used_bytes(0),
+      nhits(0), nmisses(0), nevictions(0)
+{
+}
+
+TileCache::~TileCache()
+{
+    this->clear();
+}
+
+const GpuTile* TileCache::find(const TileKey& key)
+{
+    auto it = this->index.find(key);
+    if (it == this->index.end()) {
+        this->nmisses++;
+        return nullptr;
+    }
+    this->nhits++;
+    this->lru.splice(this->lru.begin(), this->lru, it->second);
+    return &it->second->second;
+}
+
+bool TileCache::contains(const TileKey& key) const
+{
+    return this->index.count(key) != 0;
+}
+
+void TileCache::insert(const TileKey& key, const GpuTile& tile)
+{
+    this->erase(key);
+    this->lru.emplace_front(key, tile);
+    this->index[key] = this->lru.begin();
+    this->used_bytes += cost(tile);
+    this->evict(this->budget_bytes);
+}
+
+void TileCache::erase(const TileKey& key)
+{
+    auto it = this->index.find(key);
+    if (it == this->index.end())
+        return;
+    this->used_bytes -= cost(it->second->second);
+    release(it->second->second);
+    this->lru.erase(it->second);
+    this->index.erase(it);
+}
+
+void TileCache::clear()
+{
+    for (const Entry& e : this->lru)
+        release(e.second);
+    this->lru.clear();
+    this->index.clear();
+    this->used_bytes = 0;
+}
+
+void TileCache::set_budget(size_t budget_bytes)
+{
+    this->budget_bytes = budget_bytes;
+    this->evict(budget_bytes);
+}
+
+void TileCache::evict(size_t budget_bytes)
+{
+    /* The newest tile stays even when it alone is over budget, it is
+     * about to be drawn */
+    while (this->used_bytes > budget_bytes && this->lru.size() > 1) {
+        const Entry& e = this->lru.back();
+        this->used_bytes -= cost(e.second);
+        release(e.second);
+        this->index.erase(e.first);
+        this->lru.pop_back();
+        this->nevictions++;
+    }
+}
+
+size_t TileCache::cost(const GpuTile& tile)
+{
+    return tile.bytes + _entry_bytes;
+}
+
+void TileCache::release(const GpuTile& tile)
+{
+    if (tile.texture)
+        glDeleteTextures(1, &tile.texture);
+    GLuint buffers[3];
+    GLsizei n = 0;
+    if (tile.vertex_buffer)
+        buffers[n++] = tile.vertex_buffer;
+    if (tile.index_buffer)
+        buffers[n++] = tile.index_buffer;
+    if (tile.symbol_buffer)
+        buffers[n++] = tile.symbol_buffer;
+    if (n)
+        glDeleteBuffers(n, buffers);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <GLES2/gl2.h>
+
+typedef struct TileKey {
+    uint32_t x, y;
+    uint8_t z;
+    uint16_t style; // id of the style the tile was tessellated for
+
+    bool operator==(const TileKey& o) const {
+        return x == o.x && y == o.y && z == o.z && style == o.style;
+    }
+} TileKey;
+
+struct TileKeyHash {
+    size_t operator()(const TileKey& k) const {
+        uint64_t v = ((uint64_t)k.x << 32 | k.y) ^ ((uint64_t)k.z << 56) ^ ((uint64_t)k.style << 40);
+        v ^= v >> 33;
+        v *= 0xff51afd7ed558ccdULL;
+        v ^= v >> 33;
+        return (size_t)v;
+    }
+};
+
+/* Feature classes of a tile, in the order they are painted */
+enum feature_class {
+    FEATURE_OTHER = 0,
+    FEATURE_WATER,
+    FEATURE_LANDUSE,
+    FEATURE_BUILDING,
+    FEATURE_ROAD,
+    FEATURE_BOUNDARY,
+    FEATURE_CLASSES
+};
+
+/* GL objects of one uploaded tile, 0 for the ones it does not use */
+typedef struct GpuTile {
+    GLuint texture;
+    GLuint vertex_buffer;
+    GLuint index_buffer;
+    GLsizei index_count;
+    size_t class_offset;    // of the vertex classes in vertex_buffer
+    GLuint symbol_buffer;   // positions, or expanded quads without instancing
+    GLsizei symbol_count;
+    size_t bytes; // GPU memory, charged to the budget with the entry itself
+} GpuTile;
+
+/*
+ * Uploaded tiles of every surface of the process, least recently used
+ * first out once the byte budget is exceeded.
+ * Owns the GL objects: only use it on the GL thread with the shared
+ * context current, evicted tiles are deleted right away.
+ */
+class TileCache {
+  public:
+    explicit TileCache(size_t budget_bytes);
+    ~TileCache();
+    TileCache(const TileCache &) = delete;
+    TileCache &operator=(const TileCache &) = delete;
+
+    // Tile to draw, marked most recently used; NULL on a miss
+    const GpuTile* find(const TileKey& key);
+    // Residency check that neither counts nor touches the LRU order
+    bool contains(const TileKey& key) const;
+    // Takes ownership of the GL objects of tile, replaces a tile of key
+    void insert(const TileKey& key, const GpuTile& tile);
+    void erase(const TileKey& key);
+    void clear();
+    void set_budget(size_t budget_bytes);
+
+    size_t budget() const { return this->budget_bytes; }
+    size_t bytes() const { return this->used_bytes; }
+    size_t size() const { return this->index.size(); }
+    uint64_t hits() const { return this->nhits; }
+    uint64_t misses() const { return this->nmisses; }
+    uint64_t evictions() const { return this->nevictions; }
+
+  private:
+    typedef std::pair<TileKey, GpuTile> Entry;
+
+    void evict(size_t budget_bytes);
+    static size_t cost(const GpuTile& tile);
+    static void release(const GpuTile& tile);
+
+    size_t budget_bytes;
+    size_t used_bytes;
+    uint64_t nhits, nmisses, nevictions;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<TileKey, std::list<Entry>::iterator, TileKeyHash> index;
+};
+
+#endif /* TILE_CACHE_H */
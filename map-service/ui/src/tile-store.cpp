@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tile-store.hpp"
+#include "hmi-debug.h"
+
+static bool entry_less(const struct tile_pack_entry& e, uint8_t z, uint32_t x, uint32_t y)
+{
+    if (e.z != z)
+        return e.z < z;
+    if (le32toh(e.x) != x)
+        return le32toh(e.x) < x;
+    return le32toh(e.y) < y;
+}
+
+TileStore::TileStore()
+    : base(nullptr), length(0), index(nullptr), count(0)
+{
+}
+
+TileStore::~TileStore()
+{
+    this->close();
+}
+
+int TileStore::open(const char* path)
+{
+    this->close();
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        HMI_ERROR("tile-store", "cannot open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct tile_pack_header)) {
+        HMI_ERROR("tile-store", "%s is not a tile pack", path);
+        ::close(fd);
+        return -1;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        HMI_ERROR("tile-store", "cannot map %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    const struct tile_pack_header* h = (const struct tile_pack_header*)map;
+    size_t size = st.st_size;
+    uint32_t count = le32toh(h->count);
+    uint64_t index_offset = le64toh(h->index_offset);
+    uint64_t index_bytes = (uint64_t)count * sizeof(struct tile_pack_entry);
+    if (memcmp(h->magic, TILE_PACK_MAGIC, TILE_PACK_MAGIC_LEN) != 0 ||
+        le32toh(h->version) != TILE_PACK_VERSION || index_offset % 8 != 0 ||
+        index_offset > size || index_bytes > size - index_offset) {
+        HMI_ERROR("tile-store", "%s is not a tile pack of version %d", path, TILE_PACK_VERSION);
+        munmap(map, size);
+        return -1;
+    }
+
+    /* Lookups touch scattered pages, do not read ahead of them */
+    madvise(map, size, MADV_RANDOM);
+
+    this->base = (const uint8_t*)map;
+    this->length = size;
+    this->index = (const struct tile_pack_entry*)(this->base + index_offset);
+    this->count = count;
+    HMI_DEBUG("tile-store", "%s: %zu tiles", path, this->count);
+    return 0;
+}
+
+void TileStore::close()
+{
+    if (this->base)
+        munmap((void*)this->base, this->length);
+    this->base = nullptr;
+    this->length = 0;
+    this->index = nullptr;
+    this->count = 0;
+}
+
+TileSpan TileStore::find(uint8_t z, uint32_t x, uint32_t y) const
+{
+    TileSpan span = { nullptr, 0 };
+    const struct tile_pack_entry* end = this->index + this->count;
+    const struct tile_pack_entry* e = std::lower_bound(this->index, end, 0,
+        [z, x, y](const struct tile_pack_entry& e, int) { return entry_less(e, z, x, y); });
+    if (e == end || e->z != z || le32toh(e->x) != x || le32toh(e->y) != y)
+        return span;
+    /* The index was checked at open, the blobs it points to were not */
+    uint64_t offset = le64toh(e->offset);
+    uint32_t length = le32toh(e->length);
+    if (offset > this->length || length > this->length - offset) {
+        HMI_ERROR("tile-store", "tile %u/%u/%u is out of the pack", z, x, y);
+        return span;
+    }
+    span.data = this->base + offset;
+    span.size = length;
+    return span;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TILE_STORE_H
+#define TILE_STORE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "tile-pack-format.h"
+
+/* Bytes of one tile inside the mapping, valid while the store is open */
+typedef struct TileSpan {
+    const uint8_t* data;
+    size_t size;
+} TileSpan;
+
+/*
+ * Read only view of a tile pack.
+ * The file is mapped, not read: open() only checks the header and the
+ * bounds of the index, lookups binary search the mapped index and the
+ * page cache keeps what was touched.
+ */
+class TileStore {
+  public:
+    TileStore();
+    ~TileStore();
+    TileStore(const TileStore &) = delete;
+    TileStore &operator=(const TileStore &) = delete;
+
+    // 0 on success, -1 with errno-like logging otherwise
+    int open(const char* path);
+    void close();
+    bool is_open() const { return this->base != nullptr; }
+
+    // Empty span (data NULL) when the pack has no such tile
+    TileSpan find(uint8_t z, uint32_t x, uint32_t y) const;
+    size_t size() const { return this->count; }
+
+  private:
+    const uint8_t* base;
+    size_t length;
+    const struct tile_pack_entry* index;
+    size_t count;
+};
+
+#endif /* TILE_STORE_H */
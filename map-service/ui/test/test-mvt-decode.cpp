@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mvt-decode.hpp"
+
+typedef std::vector<uint8_t> Bytes;
+
+/* Just enough of a protobuf writer for vector_tile.proto */
+static void varint(Bytes* b, uint64_t v)
+{
+    while (v >= 0x80) {
+        b->push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    b->push_back((uint8_t)v);
+}
+
+static void field_varint(Bytes* b, uint32_t field, uint64_t v)
+{
+    varint(b, field << 3 | 0);
+    varint(b, v);
+}
+
+static void field_bytes(Bytes* b, uint32_t field, const Bytes& v)
+{
+    varint(b, field << 3 | 2);
+    varint(b, v.size());
+    b->insert(b->end(), v.begin(), v.end());
+}
+
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+/* Square polygon of side 2 at (2, 2): MoveTo, LineTo x3, ClosePath */
+static Bytes square_geometry()
+{
+    Bytes g;
+    varint(&g, 1 << 3 | 1);
+    varint(&g, zigzag(2));
+    varint(&g, zigzag(2));
+    varint(&g, 3 << 3 | 2);
+    const int32_t moves[] = {2, 0, 0, 2, -2, 0};
+    for (int32_t m : moves)
+        varint(&g, zigzag(m));
+    varint(&g, 1 << 3 | 7);
+    return g;
+}
+
+static Bytes feature(uint32_t type, const Bytes& geometry)
+{
+    Bytes f;
+    field_varint(&f, 3, type);
+    field_bytes(&f, 4, geometry);
+    return f;
+}
+
+static Bytes layer(const char* name, const Bytes& feat, uint32_t extent = 16)
+{
+    Bytes l;
+    Bytes n(name, name + strlen(name));
+    field_bytes(&l, 1, n);
+    field_bytes(&l, 2, feat);
+    field_varint(&l, 5, extent);
+    return l;
+}
+
+static Bytes tile_of(const Bytes& lay)
+{
+    Bytes t;
+    field_bytes(&t, 3, lay);
+    return t;
+}
+
+static bool decode(const Bytes& b, DecodedTile* out)
+{
+    return mvt_decode(b.data(), b.size(), out);
+}
+
+static void test_valid_polygon()
+{
+    DecodedTile t;
+    assert(decode(tile_of(layer("water", feature(3, square_geometry()))), &t));
+    assert(t.ok && !t.truncated);
+    assert(t.vertices.size() == 8);
+    assert(t.vertices[0] == 2 / 16.0f && t.vertices[1] == 2 / 16.0f);
+    assert(t.vertices[4] == 4 / 16.0f && t.vertices[5] == 4 / 16.0f);
+    // Three sides and the closing one
+    assert(t.indices.size() == 8);
+    assert(t.indices[6] == 3 && t.indices[7] == 0);
+    assert(t.ranges.size() == 1);
+    assert(t.ranges[0].cls == FEATURE_WATER && t.ranges[0].first == 0 && t.ranges[0].count == 8);
+    assert(t.points.empty());
+}
+
+static void test_empty_input()
+{
+    DecodedTile t;
+    assert(mvt_decode(nullptr, 0, &t));
+    assert(t.vertices.empty() && t.indices.empty() && t.ranges.empty());
+}
+
+static void test_truncated_varint()
+{
+    DecodedTile t;
+    const uint8_t tag[] = {0x80};
+    assert(!mvt_decode(tag, sizeof tag, &t));
+    // More than ten bytes is not a 64 bit varint
+    Bytes b(11, 0xff);
+    b.push_back(0x01);
+    assert(!decode(b, &t));
+}
+
+static void test_length_beyond_end()
+{
+    DecodedTile t;
+    Bytes b;
+    varint(&b, 3 << 3 | 2);
+    varint(&b, 1000);
+    b.push_back(0);
+    assert(!decode(b, &t));
+    assert(!t.ok);
+
+    // A huge length must not wrap the bounds check
+    b.clear();
+    varint(&b, 3 << 3 | 2);
+    varint(&b, ~0ULL);
+    assert(!decode(b, &t));
+}
+
+static void test_bad_wire_types()
+{
+    DecodedTile t;
+    // Groups (3, 4) and the unused 6 and 7 have no length to skip by
+    for (uint32_t wire : {3u, 4u, 6u, 7u}) {
+        Bytes b;
+        varint(&b, 9 << 3 | wire);
+        b.push_back(0);
+        assert(!decode(b, &t));
+    }
+    // Fixed fields cut short
+    Bytes b;
+    varint(&b, 9 << 3 | 1);
+    b.insert(b.end(), 7, 0);
+    assert(!decode(b, &t));
+    b.clear();
+    varint(&b, 9 << 3 | 5);
+    b.insert(b.end(), 3, 0);
+    assert(!decode(b, &t));
+}
+
+static void test_unknown_fields_skipped()
+{
+    DecodedTile t;
+    Bytes b;
+    field_varint(&b, 9, 12345);
+    varint(&b, 10 << 3 | 1);
+    b.insert(b.end(), 8, 0);
+    varint(&b, 11 << 3 | 5);
+    b.insert(b.end(), 4, 0);
+    Bytes lay = tile_of(layer("road", feature(2, square_geometry())));
+    b.insert(b.end(), lay.begin(), lay.end());
+    assert(decode(b, &t));
+    assert(t.ranges.size() == 1 && t.ranges[0].cls == FEATURE_ROAD);
+    // A line is not closed
+    assert(t.indices.size() == 6);
+}
+
+static void test_zero_extent()
+{
+    DecodedTile t;
+    assert(!decode(tile_of(layer("water", feature(3, square_geometry()), 0)), &t));
+}
+
+static void test_bad_geometry()
+{
+    DecodedTile t;
+    // Command id 3 does not exist
+    Bytes g;
+    varint(&g, 1 << 3 | 3);
+    assert(!decode(tile_of(layer("water", feature(3, g))), &t));
+
+    // LineTo announces more points than the geometry holds
+    g.clear();
+    varint(&g, 1 << 3 | 1);
+    varint(&g, 0);
+    varint(&g, 0);
+    varint(&g, 5 << 3 | 2);
+    varint(&g, zigzag(1));
+    varint(&g, zigzag(1));
+    assert(!decode(tile_of(layer("water", feature(2, g))), &t));
+
+    // Unknown geometry types are skipped
+    assert(decode(tile_of(layer("water", feature(9, g))), &t));
+    assert(t.vertices.empty());
+}
+
+static void test_every_truncation()
+{
+    Bytes full = tile_of(layer("building", feature(3, square_geometry())));
+    DecodedTile t;
+    for (size_t n = 1; n < full.size(); n++) {
+        Bytes cut(full.begin(), full.begin() + n);
+        assert(!decode(cut, &t));
+    }
+    assert(decode(full, &t));
+    assert(t.ranges.size() == 1 && t.ranges[0].cls == FEATURE_BUILDING);
+}
+
+static void test_random_bytes()
+{
+    DecodedTile t;
+    srand(1);
+    for (int i = 0; i < 20000; i++) {
+        Bytes b(rand() % 64);
+        for (uint8_t& c : b)
+            c = (uint8_t)rand();
+        if (!decode(b, &t))
+            continue;
+        // Whatever is accepted is consistent
+        for (uint16_t index : t.indices)
+            assert(index < t.vertices.size() / 2);
+        assert(t.indices.size() % 2 == 0);
+    }
+}
+
+int main()
+{
+    test_valid_polygon();
+    test_empty_input();
+    test_truncated_varint();
+    test_length_beyond_end();
+    test_bad_wire_types();
+    test_unknown_fields_skipped();
+    test_zero_extent();
+    test_bad_geometry();
+    test_every_truncation();
+    test_random_bytes();
+    printf("mvt-decode: ok\n");
+    return 0;
+}
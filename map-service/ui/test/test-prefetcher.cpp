@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include "prefetcher.hpp"
+
+typedef std::vector<TileRequest> Plan;
+
+static size_t count_visible(const Plan& plan)
+{
+    size_t n = 0;
+    while (n < plan.size() && plan[n].visible)
+        n++;
+    // Visible tiles come first, nothing visible after them
+    for (size_t i = n; i < plan.size(); i++)
+        assert(!plan[i].visible);
+    return n;
+}
+
+static size_t count_entered(const Plan& plan)
+{
+    size_t n = 0;
+    for (const TileRequest& r : plan)
+        n += r.entered;
+    return n;
+}
+
+static bool has(const Plan& plan, uint8_t z, uint32_t x, uint32_t y)
+{
+    for (const TileRequest& r : plan) {
+        if (r.key.z == z && r.key.x == x && r.key.y == y)
+            return true;
+    }
+    return false;
+}
+
+static void check_unique(const Plan& plan)
+{
+    for (size_t i = 0; i < plan.size(); i++) {
+        for (size_t j = i + 1; j < plan.size(); j++)
+            assert(!(plan[i].key == plan[j].key));
+    }
+}
+
+/* 512x512 pixels at zoom 2 centred on 0, 0 covers tiles 1..3 both ways */
+static const struct camera centre = {0.0, 0.0, 2.0, 0.0};
+
+static void test_visible_view()
+{
+    Prefetcher p;
+    Plan plan;
+    p.plan(centre, 512, 512, 0, &plan);
+    assert(count_visible(plan) == 9);
+    for (uint32_t x = 1; x <= 3; x++) {
+        for (uint32_t y = 1; y <= 3; y++)
+            assert(has(plan, 2, x, y));
+    }
+    check_unique(plan);
+
+    // Standing still, only the zoom levels around are prefetched
+    for (size_t i = 9; i < plan.size(); i++)
+        assert(plan[i].key.z == 1 || plan[i].key.z == 3);
+    assert(has(plan, 1, 0, 0) && has(plan, 3, 4, 4));
+}
+
+static void test_entered()
+{
+    Prefetcher p;
+    Plan plan;
+    p.plan(centre, 512, 512, 0, &plan);
+    assert(count_entered(plan) == 9);
+    p.plan(centre, 512, 512, 16000, &plan);
+    assert(count_entered(plan) == 0);
+
+    // One column further east, three tiles come into view
+    struct camera east = centre;
+    east.lon += 90.0;
+    p.plan(east, 512, 512, 2000000, &plan);
+    assert(count_entered(plan) == 3);
+    for (const TileRequest& r : plan) {
+        if (r.entered)
+            assert(r.key.x == 0); // wrapped from 4
+    }
+}
+
+static void test_turned_view_is_larger()
+{
+    Prefetcher p;
+    Plan plan;
+    struct camera turned = centre;
+    turned.bearing = 45.0;
+    p.plan(turned, 512, 512, 0, &plan);
+    assert(count_visible(plan) > 9);
+    turned.bearing = 180.0;
+    p.plan(turned, 512, 512, 0, &plan);
+    assert(count_visible(plan) == 9);
+}
+
+static void test_wraps_antimeridian()
+{
+    Prefetcher p;
+    Plan plan;
+    struct camera c = {179.9, 0.0, 3.0, 0.0};
+    p.plan(c, 1024, 512, 0, &plan);
+    check_unique(plan);
+    for (const TileRequest& r : plan)
+        assert(r.key.x < (1u << r.key.z));
+    assert(has(plan, 3, 0, 4) && has(plan, 3, 7, 4));
+}
+
+static uint32_t max_visible_x(const Plan& plan)
+{
+    uint32_t x = 0;
+    for (size_t i = 0; i < count_visible(plan); i++)
+        x = std::max(x, plan[i].key.x);
+    return x;
+}
+
+static void test_motion_ahead()
+{
+    Prefetcher p(1.0);
+    Plan plan;
+    struct camera c = {10.0, 0.0, 12.0, 0.0};
+    // About one tile of 1/4096 world every 100ms, eastwards
+    for (int i = 0; i < 10; i++) {
+        c.lon += 360.0 / 4096;
+        p.plan(c, 512, 512, i * 100000, &plan);
+    }
+    uint32_t edge = max_visible_x(plan);
+    bool ahead = false;
+    for (size_t i = count_visible(plan); i < plan.size(); i++) {
+        if (plan[i].key.z == 12) {
+            assert(plan[i].key.x > edge - 3); // nothing behind
+            ahead |= plan[i].key.x > edge;
+        }
+    }
+    assert(ahead);
+    assert(plan.size() - count_visible(plan) <= 96);
+
+    // After a pause the old motion is forgotten
+    p.plan(c, 512, 512, 10 * 100000 + 5000000, &plan);
+    p.plan(c, 512, 512, 10 * 100000 + 5016000, &plan);
+    for (size_t i = count_visible(plan); i < plan.size(); i++)
+        assert(plan[i].key.z != 12);
+}
+
+static void test_route_ahead()
+{
+    Prefetcher p;
+    Plan plan;
+    struct camera c = {10.0, 45.0, 12.0, 0.0};
+    std::vector<std::pair<double, double>> route;
+    for (int i = 0; i < 20; i++)
+        route.emplace_back(10.0, 45.0 + i * 0.05);
+    p.set_route(route);
+    p.plan(c, 512, 512, 0, &plan);
+    size_t nvisible = count_visible(plan);
+    uint32_t top = plan[0].key.y;
+    for (size_t i = 0; i < nvisible; i++)
+        top = std::min(top, plan[i].key.y);
+    bool north = false;
+    for (size_t i = nvisible; i < plan.size(); i++)
+        north |= plan[i].key.z == 12 && plan[i].key.y < top;
+    assert(north);
+
+    // Without the route only zoom levels are prefetched
+    p.set_route({});
+    p.plan(c, 512, 512, 16000, &plan);
+    for (size_t i = count_visible(plan); i < plan.size(); i++)
+        assert(plan[i].key.z != 12);
+}
+
+static void test_cancel_flags()
+{
+    Prefetcher p;
+    Plan plan;
+    p.plan(centre, 512, 512, 0, &plan);
+    TileKey kept = plan.back().key;
+    TileKey dropped = plan[9].key;
+    auto kept_flag = p.cancel_flag(kept);
+    auto dropped_flag = p.cancel_flag(dropped);
+    assert(!kept_flag->load() && !dropped_flag->load());
+    assert(p.cancel_flag(kept) == kept_flag);
+
+    // The same view keeps every prefetch
+    p.plan(centre, 512, 512, 16000, &plan);
+    assert(!kept_flag->load() && !dropped_flag->load());
+
+    // Far away none of them is planned any more
+    struct camera away = {120.0, 60.0, 8.0, 0.0};
+    p.plan(away, 512, 512, 32000, &plan);
+    assert(kept_flag->load() && dropped_flag->load());
+}
+
+static void test_zoom_limits()
+{
+    Prefetcher p;
+    Plan plan;
+    struct camera world = {0.0, 0.0, 0.0, 0.0};
+    p.plan(world, 256, 256, 0, &plan);
+    for (const TileRequest& r : plan)
+        assert(r.key.z <= 1);
+    assert(has(plan, 0, 0, 0));
+
+    struct camera deep = {0.0, 0.0, 30.0, 0.0};
+    p.plan(deep, 256, 256, 16000, &plan);
+    for (const TileRequest& r : plan)
+        assert(r.key.z >= 21 && r.key.z <= 22);
+}
+
+int main()
+{
+    test_visible_view();
+    test_entered();
+    test_turned_view_is_larger();
+    test_wraps_antimeridian();
+    test_motion_ahead();
+    test_route_ahead();
+    test_cancel_flags();
+    test_zoom_limits();
+    printf("prefetcher: ok\n");
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <set>
+#include "tile-cache.hpp"
+
+/* GL objects the cache deleted, in place of libGLESv2 */
+static std::set<GLuint> deleted_textures, deleted_buffers;
+
+void glDeleteTextures(GLsizei n, const GLuint* textures)
+{
+    for (GLsizei i = 0; i < n; i++) {
+        assert(deleted_textures.insert(textures[i]).second);
+    }
+}
+
+void glDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+    for (GLsizei i = 0; i < n; i++) {
+        assert(deleted_buffers.insert(buffers[i]).second);
+    }
+}
+
+static void reset_deleted()
+{
+    deleted_textures.clear();
+    deleted_buffers.clear();
+}
+
+static TileKey key(uint32_t x)
+{
+    TileKey k = {x, 0, 10, 0};
+    return k;
+}
+
+/* Tile whose GL names are derived from x, so deletions can be told apart */
+static GpuTile tile(uint32_t x, size_t bytes)
+{
+    GpuTile t = {};
+    t.vertex_buffer = 1000 + x;
+    t.index_buffer = 2000 + x;
+    t.index_count = 2;
+    t.bytes = bytes;
+    return t;
+}
+
+static void test_find_counts_hits_and_misses()
+{
+    reset_deleted();
+    TileCache cache(1 << 20);
+    assert(cache.find(key(1)) == nullptr);
+    cache.insert(key(1), tile(1, 100));
+    const GpuTile* t = cache.find(key(1));
+    assert(t != nullptr && t->vertex_buffer == 1001);
+    assert(cache.hits() == 1 && cache.misses() == 1);
+    // contains() is not a lookup
+    assert(cache.contains(key(1)) && !cache.contains(key(2)));
+    assert(cache.hits() == 1 && cache.misses() == 1);
+
+    TileKey other_style = key(1);
+    other_style.style = 1;
+    assert(cache.find(other_style) == nullptr);
+}
+
+static void test_least_recently_used_goes_first()
+{
+    reset_deleted();
+    TileCache cache(1 << 20);
+    cache.insert(key(0), tile(0, 0));
+    size_t entry = cache.bytes(); // the host cost of one entry
+    assert(entry > 0);
+    cache.clear();
+
+    // Room for three tiles of 1000 bytes
+    cache.set_budget(3 * (1000 + entry));
+    cache.insert(key(1), tile(1, 1000));
+    cache.insert(key(2), tile(2, 1000));
+    cache.insert(key(3), tile(3, 1000));
+    assert(cache.size() == 3 && cache.evictions() == 0);
+
+    // 1 is used again, 2 is now the oldest
+    assert(cache.find(key(1)) != nullptr);
+    cache.insert(key(4), tile(4, 1000));
+    assert(cache.size() == 3 && cache.evictions() == 1);
+    assert(!cache.contains(key(2)));
+    assert(cache.contains(key(1)) && cache.contains(key(3)) && cache.contains(key(4)));
+    assert(deleted_buffers.count(1002) && deleted_buffers.count(2002));
+    assert(cache.bytes() == 3 * (1000 + entry));
+}
+
+static void test_budget_counts_empty_tiles()
+{
+    reset_deleted();
+    TileCache cache(1 << 20);
+    cache.insert(key(0), tile(0, 0));
+    size_t entry = cache.bytes();
+    cache.clear();
+
+    // Tiles without geometry own no GL object but still fill the cache
+    cache.set_budget(4 * entry);
+    for (uint32_t x = 0; x < 10; x++) {
+        GpuTile t = {};
+        cache.insert(key(x), t);
+    }
+    assert(cache.size() == 4);
+    assert(cache.bytes() <= cache.budget());
+}
+
+static void test_newest_tile_stays_over_budget()
+{
+    reset_deleted();
+    TileCache cache(5000);
+    cache.insert(key(1), tile(1, 1000));
+    cache.insert(key(2), tile(2, 100000));
+    assert(cache.size() == 1 && cache.contains(key(2)));
+    assert(cache.bytes() > cache.budget());
+    assert(deleted_buffers.count(1001) && !deleted_buffers.count(1002));
+
+    // A lower budget trims down to the newest one as well
+    cache.insert(key(3), tile(3, 10));
+    cache.set_budget(0);
+    assert(cache.size() == 1 && cache.contains(key(3)));
+}
+
+static void test_replace_and_erase_release_gl_objects()
+{
+    reset_deleted();
+    TileCache cache(1 << 20);
+    GpuTile t = tile(1, 500);
+    t.texture = 7;
+    t.symbol_buffer = 3001;
+    cache.insert(key(1), t);
+    size_t bytes = cache.bytes();
+
+    // Same key, the previous objects are deleted and not charged twice
+    cache.insert(key(1), tile(5, 500));
+    assert(cache.size() == 1 && cache.bytes() == bytes);
+    assert(deleted_textures.count(7));
+    assert(deleted_buffers.count(1001) && deleted_buffers.count(2001) && deleted_buffers.count(3001));
+    assert(cache.find(key(1))->vertex_buffer == 1005);
+
+    cache.erase(key(1));
+    cache.erase(key(1));
+    assert(cache.size() == 0 && cache.bytes() == 0);
+    assert(deleted_buffers.count(1005));
+    assert(cache.evictions() == 0);
+}
+
+static void test_destructor_releases_everything()
+{
+    reset_deleted();
+    {
+        TileCache cache(1 << 20);
+        for (uint32_t x = 0; x < 5; x++)
+            cache.insert(key(x), tile(x, 10));
+    }
+    assert(deleted_buffers.size() == 10);
+}
+
+int main()
+{
+    test_find_counts_hits_and_misses();
+    test_least_recently_used_goes_first();
+    test_budget_counts_empty_tiles();
+    test_newest_tile_stays_over_budget();
+    test_replace_and_erase_release_gl_objects();
+    test_destructor_releases_everything();
+    printf("tile-cache: ok\n");
+    return 0;
+}
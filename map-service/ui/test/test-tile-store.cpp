@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <endian.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "tile-store.hpp"
+
+typedef std::vector<uint8_t> Bytes;
+
+static char pack_path[] = "/tmp/test-tile-store-XXXXXX";
+
+typedef struct Tile {
+    uint8_t z;
+    uint32_t x, y;
+    std::string data;
+} Tile;
+
+/* Pack as tools/tile-pack lays it out, tiles given sorted by z, x, y */
+static Bytes build(const std::vector<Tile>& tiles)
+{
+    Bytes b(sizeof(struct tile_pack_header));
+    std::vector<struct tile_pack_entry> index;
+    for (const Tile& t : tiles) {
+        struct tile_pack_entry e = {};
+        e.z = t.z;
+        e.x = htole32(t.x);
+        e.y = htole32(t.y);
+        e.length = htole32((uint32_t)t.data.size());
+        e.offset = htole64(b.size());
+        index.push_back(e);
+        b.insert(b.end(), t.data.begin(), t.data.end());
+    }
+    while (b.size() % 8)
+        b.push_back(0);
+    struct tile_pack_header h = {};
+    memcpy(h.magic, TILE_PACK_MAGIC, TILE_PACK_MAGIC_LEN);
+    h.version = htole32(TILE_PACK_VERSION);
+    h.count = htole32((uint32_t)index.size());
+    h.index_offset = htole64(b.size());
+    memcpy(b.data(), &h, sizeof h);
+    const uint8_t* p = (const uint8_t*)index.data();
+    b.insert(b.end(), p, p + index.size() * sizeof(struct tile_pack_entry));
+    return b;
+}
+
+static struct tile_pack_header* header(Bytes& b)
+{
+    return (struct tile_pack_header*)b.data();
+}
+
+static struct tile_pack_entry* entry(Bytes& b, size_t i)
+{
+    return (struct tile_pack_entry*)(b.data() + le64toh(header(b)->index_offset)) + i;
+}
+
+static const char* write_pack(const Bytes& b)
+{
+    FILE* f = fopen(pack_path, "wb");
+    assert(f != nullptr);
+    assert(fwrite(b.data(), 1, b.size(), f) == b.size());
+    fclose(f);
+    return pack_path;
+}
+
+static std::string str(const TileSpan& s)
+{
+    return std::string((const char*)s.data, s.size);
+}
+
+static const std::vector<Tile> tiles = {
+    {0, 0, 0, "root"},
+    {1, 0, 1, "a"},
+    {1, 1, 0, "bb"},
+    {1, 1, 1, "ccc"},
+    {2, 3, 3, "last"},
+};
+
+static void test_find()
+{
+    TileStore store;
+    assert(store.open(write_pack(build(tiles))) == 0);
+    assert(store.size() == tiles.size());
+    for (const Tile& t : tiles)
+        assert(str(store.find(t.z, t.x, t.y)) == t.data);
+
+    // Before the first, between entries, after the last
+    assert(store.find(0, 0, 1).data == nullptr);
+    assert(store.find(1, 0, 0).data == nullptr);
+    assert(store.find(1, 1, 2).data == nullptr);
+    assert(store.find(2, 3, 4).data == nullptr);
+    assert(store.find(3, 0, 0).data == nullptr);
+    // Same x and y on another level
+    assert(store.find(2, 1, 1).data == nullptr);
+    assert(store.find(1, 0xffffffff, 0xffffffff).data == nullptr);
+}
+
+static void test_empty_and_closed()
+{
+    TileStore store;
+    assert(!store.is_open());
+    assert(store.find(0, 0, 0).data == nullptr);
+    assert(store.open(write_pack(build({}))) == 0);
+    assert(store.size() == 0);
+    assert(store.find(0, 0, 0).data == nullptr);
+    store.close();
+    assert(store.find(0, 0, 0).data == nullptr);
+}
+
+// The index is checked at open, the blobs only when a tile is looked up
+static void test_blob_out_of_file()
+{
+    Bytes b = build(tiles);
+    entry(b, 1)->offset = htole64(b.size());
+    entry(b, 1)->length = htole32(1);
+    entry(b, 2)->offset = htole64(b.size() + 1);
+    entry(b, 3)->offset = htole64(~0ULL);
+    entry(b, 3)->length = htole32(16);
+    entry(b, 4)->offset = htole64(8);
+    entry(b, 4)->length = htole32((uint32_t)b.size() - 7);
+
+    TileStore store;
+    assert(store.open(write_pack(b)) == 0);
+    assert(str(store.find(0, 0, 0)) == "root");
+    assert(store.find(1, 0, 1).data == nullptr);
+    assert(store.find(1, 1, 0).data == nullptr);
+    assert(store.find(1, 1, 1).data == nullptr);
+    assert(store.find(2, 3, 3).data == nullptr);
+
+    // Ending exactly at the end of the file is fine
+    entry(b, 4)->length = htole32((uint32_t)b.size() - 8);
+    assert(store.open(write_pack(b)) == 0);
+    assert(store.find(2, 3, 3).size == b.size() - 8);
+}
+
+static void test_open_rejects()
+{
+    TileStore store;
+    Bytes good = build(tiles);
+
+    Bytes b = good;
+    b[0] = 'X';
+    assert(store.open(write_pack(b)) < 0 && !store.is_open());
+
+    b = good;
+    header(b)->version = htole32(TILE_PACK_VERSION + 1);
+    assert(store.open(write_pack(b)) < 0);
+
+    b = good;
+    header(b)->index_offset = htole64(le64toh(header(b)->index_offset) + 4);
+    assert(store.open(write_pack(b)) < 0);
+
+    b = good;
+    header(b)->index_offset = htole64(b.size() + 8);
+    assert(store.open(write_pack(b)) < 0);
+
+    // One entry more than the file holds
+    b = good;
+    header(b)->count = htole32((uint32_t)tiles.size() + 1);
+    assert(store.open(write_pack(b)) < 0);
+
+    // A count far beyond the file
+    b = good;
+    header(b)->count = htole32(0xffffffff);
+    assert(store.open(write_pack(b)) < 0);
+
+    b.assign(good.begin(), good.begin() + sizeof(struct tile_pack_header) - 1);
+    assert(store.open(write_pack(b)) < 0);
+
+    assert(store.open("/nonexistent/pack") < 0);
+
+    // A failed open leaves the store closed, not holding the previous pack
+    assert(store.open(write_pack(good)) == 0);
+    assert(store.open("/nonexistent/pack") < 0);
+    assert(!store.is_open() && store.size() == 0);
+}
+
+int main()
+{
+    int fd = mkstemp(pack_path);
+    assert(fd >= 0);
+    close(fd);
+    test_find();
+    test_empty_and_closed();
+    test_blob_out_of_file();
+    test_open_rejects();
+    unlink(pack_path);
+    printf("tile-store: ok\n");
+    return 0;
+}
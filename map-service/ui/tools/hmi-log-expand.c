@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Expands a binary log of HMI_LOG_BINARY to the text stderr would show.
+ *
+ *   hmi-log-expand <file>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "hmi-log-format.h"
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <binary log>\n", argv[0]);
+        return 2;
+    }
+    FILE* in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    char magic[HMI_LOG_MAGIC_LEN];
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+        memcmp(magic, HMI_LOG_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s: not a binary hmi log\n", argv[1]);
+        fclose(in);
+        return 1;
+    }
+
+    struct hmi_log_record h;
+    char file[256], func[256], prefix[256];
+    static char fmt[65536], msg[65536];
+    static unsigned char args[65536];
+    while (fread(&h, sizeof(h), 1, in) == 1) {
+        if (fread(file, 1, h.file_len, in) != h.file_len ||
+            fread(func, 1, h.func_len, in) != h.func_len ||
+            fread(prefix, 1, h.prefix_len, in) != h.prefix_len ||
+            fread(fmt, 1, h.fmt_len, in) != h.fmt_len ||
+            fread(args, 1, h.args_len, in) != h.args_len) {
+            fprintf(stderr, "%s: truncated record\n", argv[1]);
+            break;
+        }
+        fmt[h.fmt_len] = '\0';
+        hmi_log_expand(fmt, args, h.args_len, msg, sizeof(msg));
+        const char* level = (h.level < 6) ? hmi_log_level_names[h.level] : "?";
+        printf("[%10.3f] [%.*s %s] [%.*s, %.*s(), Line:%u] >>> %s \n",
+               (h.time_us % 1000000000ULL) / 1000.0, (int)h.prefix_len, prefix, level,
+               (int)h.file_len, file, (int)h.func_len, func, h.line, msg);
+    }
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2017 TOYOTA MOTOR CORPORATION
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Builds a tile pack for simple-egl (SIMPLE_EGL_TILE_PACK).
+ *
+ *   tile-pack <out.pack> <in.mbtiles | tile directory>
+ *
+ * A directory holds <z>/<x>/<y>.<any extension>. MBTiles need sqlite3 at
+ * build time; their gzip compressed tiles are inflated when zlib was found,
+ * stored as they are otherwise.
+ */
+
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "tile-pack-format.h"
+#ifdef HAVE_SQLITE3
+#include <sqlite3.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* Deepest zoom whose x and y still fit in 32 bits */
+#define MAX_ZOOM 31
+
+struct pack {
+    FILE *out;
+    uint64_t offset;
+    struct tile_pack_entry *entries;
+    size_t count, capacity;
+};
+
+static int add_tile(struct pack *p, unsigned z, unsigned x, unsigned y,
+                    const void *data, size_t size)
+{
+    if (z > MAX_ZOOM || x >> z != 0 || y >> z != 0 || size > UINT32_MAX) {
+        fprintf(stderr, "skipping tile %u/%u/%u\n", z, x, y);
+        return 0;
+    }
+    if (p->count == p->capacity) {
+        size_t capacity = p->capacity ? p->capacity * 2 : 4096;
+        struct tile_pack_entry *e = realloc(p->entries, capacity * sizeof *e);
+        if (e == NULL)
+            return -1;
+        p->entries = e;
+        p->capacity = capacity;
+    }
+    if (fwrite(data, 1, size, p->out) != size)
+        return -1;
+    struct tile_pack_entry *e = &p->entries[p->count++];
+    memset(e, 0, sizeof *e);
+    e->z = z;
+    e->x = x;
+    e->y = y;
+    e->length = size;
+    e->offset = p->offset;
+    p->offset += size;
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct tile_pack_entry *l = a, *r = b;
+    if (l->z != r->z)
+        return l->z < r->z ? -1 : 1;
+    if (l->x != r->x)
+        return l->x < r->x ? -1 : 1;
+    if (l->y != r->y)
+        return l->y < r->y ? -1 : 1;
+    return 0;
+}
+
+/* Numeric directory entry name, up to the first '.' */
+static int parse_number(const char *name, unsigned *value)
+{
+    char *end;
+    if (name[0] < '0' || name[0] > '9')
+        return -1;
+    *value = strtoul(name, &end, 10);
+    return (*end == '\0' || *end == '.') ? 0 : -1;
+}
+
+static int read_file(const char *path, char **data, size_t *size)
+{
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
+        return -1;
+    fseek(in, 0, SEEK_END);
+    long n = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    *data = n > 0 ? malloc(n) : NULL;
+    *size = n > 0 ? (size_t)n : 0;
+    int ret = (n < 0 || (n > 0 && (*data == NULL || fread(*data, 1, n, in) != (size_t)n))) ? -1 : 0;
+    fclose(in);
+    return ret;
+}
+
+static int add_directory(struct pack *p, const char *root)
+{
+    char path[4096];
+    unsigned z, x, y;
+    DIR *zd = opendir(root);
+    if (zd == NULL)
+        return -1;
+    for (struct dirent *ze; (ze = readdir(zd)) != NULL;) {
+        if (parse_number(ze->d_name, &z) != 0)
+            continue;
+        snprintf(path, sizeof path, "%s/%s", root, ze->d_name);
+        DIR *xd = opendir(path);
+        if (xd == NULL)
+            continue;
+        for (struct dirent *xe; (xe = readdir(xd)) != NULL;) {
+            if (parse_number(xe->d_name, &x) != 0)
+                continue;
+            snprintf(path, sizeof path, "%s/%s/%s", root, ze->d_name, xe->d_name);
+            DIR *yd = opendir(path);
+            if (yd == NULL)
+                continue;
+            for (struct dirent *ye; (ye = readdir(yd)) != NULL;) {
+                if (parse_number(ye->d_name, &y) != 0)
+                    continue;
+                snprintf(path, sizeof path, "%s/%s/%s/%s", root, ze->d_name, xe->d_name, ye->d_name);
+                char *data = NULL;
+                size_t size;
+                if (read_file(path, &data, &size) != 0 || add_tile(p, z, x, y, data, size) != 0) {
+                    perror(path);
+                    free(data);
+                    closedir(yd);
+                    closedir(xd);
+                    closedir(zd);
+                    return -1;
+                }
+                free(data);
+            }
+            closedir(yd);
+        }
+        closedir(xd);
+    }
+    closedir(zd);
+    return 0;
+}
+
+#ifdef HAVE_SQLITE3
+/* gzip blob inflated into *out, which the caller frees */
+static int inflate_tile(const void *data, size_t size, void **out, size_t *out_size)
+{
+#ifdef HAVE_ZLIB
+    const unsigned char *bytes = data;
+    if (size < 2 || bytes[0] != 0x1f || bytes[1] != 0x8b)
+        return -1;
+    z_stream zs;
+    memset(&zs, 0, sizeof zs);
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+        return -1;
+    size_t capacity = size * 4 + 1024, used = 0;
+    unsigned char *buf = malloc(capacity);
+    int ret = Z_OK;
+    zs.next_in = (unsigned char *)data;
+    zs.avail_in = size;
+    while (buf && ret == Z_OK) {
+        if (used == capacity) {
+            unsigned char *grown = realloc(buf, capacity * 2);
+            if (grown == NULL)
+                break;
+            buf = grown;
+            capacity *= 2;
+        }
+        zs.next_out = buf + used;
+        zs.avail_out = capacity - used;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        used = capacity - zs.avail_out;
+    }
+    inflateEnd(&zs);
+    if (ret != Z_STREAM_END) {
+        free(buf);
+        return -1;
+    }
+    *out = buf;
+    *out_size = used;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static int add_mbtiles(struct pack *p, const char *path)
+{
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return -1;
+    }
+    if (sqlite3_prepare_v2(db, "SELECT zoom_level, tile_column, tile_row, tile_data FROM tiles",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return -1;
+    }
+    int ret = 0;
+    while (ret == 0 && sqlite3_step(stmt) == SQLITE_ROW) {
+        sqlite3_int64 z = sqlite3_column_int64(stmt, 0);
+        sqlite3_int64 x = sqlite3_column_int64(stmt, 1);
+        sqlite3_int64 row = sqlite3_column_int64(stmt, 2);
+        if (z < 0 || z > MAX_ZOOM || x < 0 || x >> z != 0 || row < 0 || row >> z != 0) {
+            fprintf(stderr, "skipping tile %lld/%lld/%lld\n", (long long)z, (long long)x, (long long)row);
+            continue;
+        }
+        /* MBTiles rows are TMS, counted from the south */
+        unsigned y = (1u << z) - 1 - (unsigned)row;
+        const void *data = sqlite3_column_blob(stmt, 3);
+        size_t size = sqlite3_column_bytes(stmt, 3);
+        void *plain;
+        size_t plain_size;
+        if (inflate_tile(data, size, &plain, &plain_size) == 0) {
+            ret = add_tile(p, z, x, y, plain, plain_size);
+            free(plain);
+        } else {
+            ret = add_tile(p, z, x, y, data, size);
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return ret;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <out.pack> <in.mbtiles | tile directory>\n", argv[0]);
+        return 2;
+    }
+    struct stat st;
+    if (stat(argv[2], &st) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    struct pack p;
+    memset(&p, 0, sizeof p);
+    p.out = fopen(argv[1], "wb");
+    if (p.out == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    /* Blobs are streamed after the header, the index is written last */
+    struct tile_pack_header h;
+    memset(&h, 0, sizeof h);
+    fwrite(&h, sizeof h, 1, p.out);
+    p.offset = sizeof h;
+
+    int ret;
+    if (S_ISDIR(st.st_mode)) {
+        ret = add_directory(&p, argv[2]);
+    } else {
+#ifdef HAVE_SQLITE3
+        ret = add_mbtiles(&p, argv[2]);
+#else
+        fprintf(stderr, "%s: built without sqlite3, only directories are read\n", argv[0]);
+        ret = -1;
+#endif
+    }
+    if (ret != 0 || p.count > UINT32_MAX) {
+        fclose(p.out);
+        remove(argv[1]);
+        return 1;
+    }
+
+    qsort(p.entries, p.count, sizeof *p.entries, compare_entries);
+    for (size_t i = 0; i < p.count; ++i) {
+        struct tile_pack_entry *e = &p.entries[i];
+        e->x = htole32(e->x);
+        e->y = htole32(e->y);
+        e->length = htole32(e->length);
+        e->offset = htole64(e->offset);
+    }
+    static const char pad[8];
+    size_t padding = (8 - p.offset % 8) % 8;
+    fwrite(pad, 1, padding, p.out);
+
+    memcpy(h.magic, TILE_PACK_MAGIC, TILE_PACK_MAGIC_LEN);
+    h.version = htole32(TILE_PACK_VERSION);
+    h.count = htole32(p.count);
+    h.index_offset = htole64(p.offset + padding);
+    if (fwrite(p.entries, sizeof *p.entries, p.count, p.out) != p.count ||
+        fseek(p.out, 0, SEEK_SET) != 0 || fwrite(&h, sizeof h, 1, p.out) != 1 ||
+        fclose(p.out) != 0) {
+        perror(argv[1]);
+        remove(argv[1]);
+        return 1;
+    }
+    printf("%zu tiles\n", p.count);
+    free(p.entries);
+    return 0;
+}